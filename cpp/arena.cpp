@@ -0,0 +1,367 @@
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+#define ARENA_MIN_BLOCK (1 << 20)
+#define ARENA_BLOCK     (64 << 20)
+#define HUGE_PAGE       (2 << 20)
+#define MIN_SPLIT       256
+
+using namespace blocs__atlas;
+
+namespace
+{
+    // written in front of every allocation, records the region
+    // it was carved from so it can be given back on free
+    struct header
+    {
+        uint8_t*    begin;
+        uint8_t*    end;
+    };
+
+    inline header* header_of(void* ptr)
+    {
+        return static_cast<header*>(ptr) - 1;
+    }
+
+    inline uint8_t* align_up(uint8_t* ptr, std::size_t align)
+    {
+        return (uint8_t*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    // orders the free list by address, so neighbours can be joined
+    inline bool before(const uint8_t* ptr, const uint8_t* begin)
+    {
+        return std::less<const uint8_t*>()(ptr, begin);
+    }
+}
+
+arena::arena()
+    : m_huge_pages(false), m_reserved(0), m_next_block(ARENA_MIN_BLOCK) {}
+
+arena::~arena()
+{
+    release();
+}
+
+/**
+ * @brief           Backs new blocks with huge pages where the os allows
+ *                  it, cutting page faults and tlb misses on large bitmaps
+ *
+ * @param huge_pages Whether to request huge pages
+ */
+void arena::set_huge_pages(bool huge_pages)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_huge_pages = huge_pages;
+}
+
+/**
+ * @brief           Allocates memory from the arena
+ *
+ * @param size      Number of bytes
+ * @param align     Alignment of the returned pointer (power of two)
+ * @return void*
+ */
+void* arena::allocate(std::size_t size, std::size_t align)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return allocate_unlocked(size, align);
+}
+
+/**
+ * @brief           Grows or shrinks an allocation, in place when it
+ *                  is the most recent one in the arena
+ *
+ * @param ptr       Allocation to resize (or nullptr)
+ * @param size      New number of bytes
+ * @return void*
+ */
+void* arena::reallocate(void* ptr, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (ptr == nullptr)
+        return allocate_unlocked(size, 16);
+
+    header* h = header_of(ptr);
+    uint8_t* data = static_cast<uint8_t*>(ptr);
+    std::size_t capacity = h->end - data;
+    if (size <= capacity)
+        return ptr;
+
+    if (!m_blocks.empty())
+    {
+        block& top = m_blocks.back();
+        if (h->end == top.data + top.used && data + size <= top.data + top.size)
+        {
+            h->end = data + size;
+            top.used = h->end - top.data;
+            return ptr;
+        }
+    }
+
+    void* moved = allocate_unlocked(size, 16);
+    if (moved != nullptr)
+    {
+        memcpy(moved, ptr, capacity);
+        free_unlocked(ptr);
+    }
+    return moved;
+}
+
+/**
+ * @brief           Gives an allocation back to the arena so that its
+ *                  space can be reused by later allocations
+ *
+ * @param ptr       Allocation to free (or nullptr)
+ */
+void arena::free(void* ptr)
+{
+    if (ptr == nullptr)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    free_unlocked(ptr);
+}
+
+/**
+ * @brief           Returns every block to the os at once,
+ *                  invalidating all allocations
+ */
+void arena::release()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& b : m_blocks)
+        unmap(b.data, b.size);
+    for (auto& b : m_large)
+        unmap(b.data, b.size);
+    m_blocks.clear();
+    m_large.clear();
+    m_free.clear();
+    m_reserved = 0;
+    m_next_block = ARENA_MIN_BLOCK;
+}
+
+void* arena::allocate_unlocked(std::size_t size, std::size_t align)
+{
+    align = std::max(align, alignof(header));
+
+    // best fit from space given back by earlier frees
+    int best = -1;
+    for (int i = 0; i < (int)m_free.size(); i++)
+    {
+        uint8_t* data = align_up(m_free[i].begin + sizeof(header), align);
+        if (data + size <= m_free[i].end &&
+            (best < 0 || m_free[i].end - m_free[i].begin < m_free[best].end - m_free[best].begin))
+            best = i;
+    }
+    if (best >= 0)
+    {
+        region r = m_free[best];
+        m_free.erase(m_free.begin() + best);
+
+        uint8_t* data = align_up(r.begin + sizeof(header), align);
+        uint8_t* end = r.end;
+        if (r.end - (data + size) >= MIN_SPLIT)
+        {
+            end = data + size;
+            give_back({ end, r.end });
+        }
+        *header_of(data) = { r.begin, end };
+        return data;
+    }
+
+    // bump from the newest block
+    if (!m_blocks.empty())
+    {
+        block& top = m_blocks.back();
+        uint8_t* begin = top.data + top.used;
+        uint8_t* data = align_up(begin + sizeof(header), align);
+        if (data + size <= top.data + top.size)
+        {
+            top.used = data + size - top.data;
+            *header_of(data) = { begin, data + size };
+            return data;
+        }
+    }
+
+    // very large allocations get a mapping of their own
+    std::size_t need = size + sizeof(header) + align;
+    if (need > ARENA_BLOCK / 2)
+    {
+        std::size_t mapped = need;
+        uint8_t* begin = map(mapped);
+        if (begin == nullptr)
+            return nullptr;
+        m_large.push_back({ begin, mapped, mapped });
+
+        uint8_t* data = align_up(begin + sizeof(header), align);
+        *header_of(data) = { begin, begin + mapped };
+        return data;
+    }
+
+    // blocks start small and double, so small atlases
+    // never reserve more than they are likely to use
+    std::size_t mapped = std::max(m_next_block, need);
+    uint8_t* begin = map(mapped);
+    if (begin == nullptr)
+        return nullptr;
+    m_next_block = std::min<std::size_t>(mapped * 2, ARENA_BLOCK);
+
+    // whatever is left of the old block stays reusable
+    if (!m_blocks.empty())
+    {
+        block& top = m_blocks.back();
+        if (top.size - top.used >= MIN_SPLIT)
+            give_back({ top.data + top.used, top.data + top.size });
+        top.used = top.size;
+    }
+    m_blocks.push_back({ begin, mapped, 0 });
+
+    uint8_t* data = align_up(begin + sizeof(header), align);
+    m_blocks.back().used = data + size - begin;
+    *header_of(data) = { begin, data + size };
+    return data;
+}
+
+void arena::free_unlocked(void* ptr)
+{
+    header h = *header_of(ptr);
+
+    for (std::size_t i = 0; i < m_large.size(); i++)
+    {
+        if (m_large[i].data == h.begin)
+        {
+            unmap(m_large[i].data, m_large[i].size);
+            m_large[i] = m_large.back();
+            m_large.pop_back();
+            return;
+        }
+    }
+
+    // roll the newest block back when freeing its last allocation,
+    // also taking the freed space directly below it, which is a
+    // single region as neighbouring regions are always joined
+    if (!m_blocks.empty() && h.end == m_blocks.back().data + m_blocks.back().used)
+    {
+        block& top = m_blocks.back();
+        top.used = h.begin - top.data;
+
+        auto below = std::lower_bound(m_free.begin(), m_free.end(), h.begin, [](const region& r, const uint8_t* p)
+        {
+            return before(r.begin, p);
+        });
+        if (below != m_free.begin() && (below - 1)->end == h.begin && !before((below - 1)->begin, top.data))
+        {
+            top.used = (below - 1)->begin - top.data;
+            m_free.erase(below - 1);
+        }
+        return;
+    }
+
+    give_back({ h.begin, h.end });
+}
+
+// whether a block starts at ptr, regions of two blocks
+// are never joined even when they are mapped side by side
+bool arena::starts_block(const uint8_t* ptr) const
+{
+    for (const auto& b : m_blocks)
+        if (b.data == ptr)
+            return true;
+    return false;
+}
+
+/**
+ * @brief           Adds a region to the free list, kept in address order,
+ *                  joining it with the free regions right before and after
+ *                  it so freed space is never lost or left in slivers
+ */
+void arena::give_back(region r)
+{
+    auto next = std::lower_bound(m_free.begin(), m_free.end(), r.begin, [](const region& f, const uint8_t* p)
+    {
+        return before(f.begin, p);
+    });
+    if (next != m_free.end() && next->begin == r.end && !starts_block(r.end))
+    {
+        r.end = next->end;
+        next = m_free.erase(next);
+    }
+    if (next != m_free.begin() && (next - 1)->end == r.begin && !starts_block(r.begin))
+    {
+        (next - 1)->end = r.end;
+        return;
+    }
+    m_free.insert(next, r);
+}
+
+/**
+ * @brief           Maps zeroed memory from the os, rounding the
+ *                  size up to whole (huge) pages
+ *
+ * @param size      Requested size, updated to the mapped size
+ * @return uint8_t*
+ */
+uint8_t* arena::map(std::size_t& size)
+{
+    std::size_t page = m_huge_pages ? HUGE_PAGE : 4096;
+    size = (size + page - 1) & ~(page - 1);
+    void* data = nullptr;
+
+#if defined(_WIN32)
+    if (m_huge_pages && GetLargePageMinimum() > 0)
+    {
+        std::size_t large = GetLargePageMinimum();
+        std::size_t large_size = (size + large - 1) & ~(large - 1);
+        data = VirtualAlloc(nullptr, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (data != nullptr)
+            size = large_size;
+    }
+    if (data == nullptr)
+        data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    #if defined(MAP_HUGETLB)
+    if (m_huge_pages)
+    {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED)
+            data = nullptr;
+    }
+    #endif
+    if (data == nullptr)
+    {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return nullptr;
+    #if defined(MADV_HUGEPAGE)
+        // fall back to transparent huge pages
+        if (m_huge_pages)
+            madvise(data, size, MADV_HUGEPAGE);
+    #endif
+    }
+#endif
+
+    m_reserved += size;
+    return static_cast<uint8_t*>(data);
+}
+
+void arena::unmap(uint8_t* data, std::size_t size)
+{
+#if defined(_WIN32)
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, size);
+#endif
+    m_reserved -= size;
+}
@@ -0,0 +1,64 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // arena allocator backing all pixel
+    // storage, released in bulk
+    //
+
+    class arena
+    {
+    public:
+        arena();
+        ~arena();
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        void* allocate(std::size_t size, std::size_t align = 16);
+        void* reallocate(void* ptr, std::size_t size);
+        void free(void* ptr);
+        void release();
+
+        void set_huge_pages(bool huge_pages);
+        std::size_t reserved() const { return m_reserved; }
+
+    private:
+        struct region
+        {
+            uint8_t*    begin;
+            uint8_t*    end;
+        };
+
+        struct block
+        {
+            uint8_t*    data;
+            std::size_t size;
+            std::size_t used;
+        };
+
+        std::mutex  m_mutex;
+        bool        m_huge_pages;
+        std::size_t m_reserved;
+        std::size_t m_next_block;
+
+        std::vector<block>  m_blocks;
+        std::vector<block>  m_large;
+        std::vector<region> m_free;         // ordered by address
+
+        void* allocate_unlocked(std::size_t size, std::size_t align);
+        void  free_unlocked(void* ptr);
+        void  give_back(region r);
+        bool  starts_block(const uint8_t* ptr) const;
+        uint8_t* map(std::size_t& size);
+        void unmap(uint8_t* data, std::size_t size);
+    };
+}
@@ -0,0 +1,1365 @@
+
+#include "astc.hpp"
+#include "bc.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#define MAX_TEXELS          64
+#define PARTITION_SEEDS     1024
+#define WEIGHT_RANGES       12
+#define COLOR_RANGES        21
+#define MIN_WEIGHT_BITS     24
+#define MAX_WEIGHT_BITS     96
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// integer sequence encoding, values
+// packed as bits with trits or quints
+//
+
+namespace
+{
+    struct quant_range
+    {
+        int         levels;
+        int         trits;
+        int         quints;
+        int         bits;
+    };
+
+    // color values use all of them, weights the first 12
+    const quant_range ranges[COLOR_RANGES] =
+    {
+        {   2, 0, 0, 1 }, {   3, 1, 0, 0 }, {   4, 0, 0, 2 }, {   5, 0, 1, 0 },
+        {   6, 1, 0, 1 }, {   8, 0, 0, 3 }, {  10, 0, 1, 1 }, {  12, 1, 0, 2 },
+        {  16, 0, 0, 4 }, {  20, 0, 1, 2 }, {  24, 1, 0, 3 }, {  32, 0, 0, 5 },
+        {  40, 0, 1, 3 }, {  48, 1, 0, 4 }, {  64, 0, 0, 6 }, {  80, 0, 1, 4 },
+        {  96, 1, 0, 5 }, { 128, 0, 0, 7 }, { 160, 0, 1, 5 }, { 192, 1, 0, 6 },
+        { 256, 0, 0, 8 },
+    };
+
+    inline int ise_bits(int count, int range)
+    {
+        const quant_range& q = ranges[range];
+        return count * q.bits + (q.trits ? (8 * count + 4) / 5 : 0) + (q.quints ? (7 * count + 2) / 3 : 0);
+    }
+
+    inline int bit(int value, int i)
+    {
+        return value >> i & 1;
+    }
+
+    // 5 trits packed in 8 bits, as the decoder unpacks them
+    void unpack_trits(int T, int t[5])
+    {
+        int c;
+        if ((T >> 2 & 7) == 7)
+        {
+            c = (T >> 5 & 7) << 2 | (T & 3);
+            t[4] = 2;
+            t[3] = 2;
+        }
+        else
+        {
+            c = T & 0x1f;
+            if ((T >> 5 & 3) == 3)
+            {
+                t[4] = 2;
+                t[3] = bit(T, 7);
+            }
+            else
+            {
+                t[4] = bit(T, 7);
+                t[3] = T >> 5 & 3;
+            }
+        }
+
+        if ((c & 3) == 3)
+        {
+            t[2] = 2;
+            t[1] = bit(c, 4);
+            t[0] = bit(c, 3) << 1 | (bit(c, 2) & ~bit(c, 3) & 1);
+        }
+        else if ((c >> 2 & 3) == 3)
+        {
+            t[2] = 2;
+            t[1] = 2;
+            t[0] = c & 3;
+        }
+        else
+        {
+            t[2] = bit(c, 4);
+            t[1] = c >> 2 & 3;
+            t[0] = bit(c, 1) << 1 | (bit(c, 0) & ~bit(c, 1) & 1);
+        }
+    }
+
+    // 3 quints packed in 7 bits, as the decoder unpacks them
+    void unpack_quints(int Q, int q[3])
+    {
+        if ((Q >> 1 & 3) == 3 && (Q >> 5 & 3) == 0)
+        {
+            q[2] = bit(Q, 0) << 2 | (bit(Q, 4) & ~bit(Q, 0) & 1) << 1 | (bit(Q, 3) & ~bit(Q, 0) & 1);
+            q[1] = 4;
+            q[0] = 4;
+            return;
+        }
+
+        int c;
+        if ((Q >> 1 & 3) == 3)
+        {
+            q[2] = 4;
+            c = (Q >> 3 & 3) << 3 | (~Q >> 5 & 3) << 1 | bit(Q, 0);
+        }
+        else
+        {
+            q[2] = Q >> 5 & 3;
+            c = Q & 0x1f;
+        }
+
+        if ((c & 7) == 5)
+        {
+            q[1] = 4;
+            q[0] = c >> 3 & 3;
+        }
+        else
+        {
+            q[1] = c >> 3 & 3;
+            q[0] = c & 7;
+        }
+    }
+
+    // packings of every combination of trits and quints, inverted from the
+    // decoder keeping the smallest, so the bits of trailing zeros are zero
+    // and a sequence can end part way through a pack
+    struct pack_tables
+    {
+        uint8_t     trits[243];
+        uint8_t     quints[125];
+    };
+
+    const pack_tables& packs()
+    {
+        static const pack_tables tables = []
+        {
+            pack_tables t;
+            bool seen[243] = {};
+            for (int T = 0; T < 256; T++)
+            {
+                int v[5];
+                unpack_trits(T, v);
+                int i = v[0] + 3 * v[1] + 9 * v[2] + 27 * v[3] + 81 * v[4];
+                if (!seen[i])
+                    t.trits[i] = T;
+                seen[i] = true;
+            }
+            bool seen_q[125] = {};
+            for (int Q = 0; Q < 128; Q++)
+            {
+                int v[3];
+                unpack_quints(Q, v);
+                int i = v[0] + 5 * v[1] + 25 * v[2];
+                if (!seen_q[i])
+                    t.quints[i] = Q;
+                seen_q[i] = true;
+            }
+            return t;
+        }();
+        return tables;
+    }
+
+    // writes bits from the least significant bit of byte 0 up
+    inline void put_bits(uint8_t* data, int pos, int count, uint32_t value)
+    {
+        for (int i = 0; i < count; i++, pos++)
+            data[pos >> 3] |= (value >> i & 1) << (pos & 7);
+    }
+
+    /**
+     * @brief           Packs a sequence of values of a range, each
+     *                  pack of trits or quints interleaved with the bits
+     *                  of its values, the last pack cut short
+     *
+     * @param values    Values of the range
+     * @param count     Number of values
+     * @param range     Index of the range
+     * @param data      Zeroed bits to write into
+     * @param pos       Position of the first bit
+     */
+    void put_sequence(const uint8_t* values, int count, int range, uint8_t* data, int pos)
+    {
+        const quant_range& q = ranges[range];
+        int n = q.bits;
+        int mask = (1 << n) - 1;
+
+        // whole packs go to a scratch buffer to be cut to length
+        uint8_t scratch[32] = {};
+        int at = 0;
+        if (q.trits)
+        {
+            for (int i = 0; i < count; i += 5)
+            {
+                int m[5] = {}, t[5] = {};
+                for (int j = 0; j < 5 && i + j < count; j++)
+                {
+                    m[j] = values[i + j] & mask;
+                    t[j] = values[i + j] >> n;
+                }
+                int T = packs().trits[t[0] + 3 * t[1] + 9 * t[2] + 27 * t[3] + 81 * t[4]];
+                put_bits(scratch, at, n, m[0]); at += n;
+                put_bits(scratch, at, 2, T & 3); at += 2;
+                put_bits(scratch, at, n, m[1]); at += n;
+                put_bits(scratch, at, 2, T >> 2 & 3); at += 2;
+                put_bits(scratch, at, n, m[2]); at += n;
+                put_bits(scratch, at, 1, T >> 4 & 1); at += 1;
+                put_bits(scratch, at, n, m[3]); at += n;
+                put_bits(scratch, at, 2, T >> 5 & 3); at += 2;
+                put_bits(scratch, at, n, m[4]); at += n;
+                put_bits(scratch, at, 1, T >> 7 & 1); at += 1;
+            }
+        }
+        else if (q.quints)
+        {
+            for (int i = 0; i < count; i += 3)
+            {
+                int m[3] = {}, v[3] = {};
+                for (int j = 0; j < 3 && i + j < count; j++)
+                {
+                    m[j] = values[i + j] & mask;
+                    v[j] = values[i + j] >> n;
+                }
+                int Q = packs().quints[v[0] + 5 * v[1] + 25 * v[2]];
+                put_bits(scratch, at, n, m[0]); at += n;
+                put_bits(scratch, at, 3, Q & 7); at += 3;
+                put_bits(scratch, at, n, m[1]); at += n;
+                put_bits(scratch, at, 2, Q >> 3 & 3); at += 2;
+                put_bits(scratch, at, n, m[2]); at += n;
+                put_bits(scratch, at, 2, Q >> 5 & 3); at += 2;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < count; i++, at += n)
+                put_bits(scratch, at, n, values[i]);
+        }
+
+        int bits = ise_bits(count, range);
+        for (int i = 0; i < bits; i++)
+            data[(pos + i) >> 3] |= (scratch[i >> 3] >> (i & 7) & 1) << ((pos + i) & 7);
+    }
+}
+
+////////////////////////////////////
+//
+// unquantized values of each range
+//
+
+namespace
+{
+    // repeats the bits of a value down to fill a wider value
+    inline int replicate(int value, int bits, int width)
+    {
+        int out = 0;
+        for (int shift = width - bits; shift > -bits; shift -= bits)
+            out |= shift >= 0 ? value << shift : value >> -shift;
+        return out;
+    }
+
+    int unquantize_color(int range, int code)
+    {
+        const quant_range& q = ranges[range];
+        if (!q.trits && !q.quints)
+            return replicate(code, q.bits, 8);
+
+        int d = code >> q.bits;
+        int m = code & ((1 << q.bits) - 1);
+        if (q.bits == 0)
+        {
+            static const int trits[3]  = { 0, 128, 255 };
+            static const int quints[5] = { 0, 64, 128, 192, 255 };
+            return q.trits ? trits[d] : quints[d];
+        }
+
+        int a = m & 1 ? 0x1ff : 0;
+        int x = m >> 1;
+        int b = 0, c = 0;
+        if (q.trits)
+        {
+            switch (q.bits)
+            {
+            case 1: c = 204; break;
+            case 2: c = 93; b = x << 8 | x << 4 | x << 2 | x << 1; break;
+            case 3: c = 44; b = x << 7 | x << 2 | x; break;
+            case 4: c = 22; b = x << 6 | x; break;
+            case 5: c = 11; b = x << 5 | x >> 2; break;
+            case 6: c = 5;  b = x << 4 | x >> 4; break;
+            }
+        }
+        else
+        {
+            switch (q.bits)
+            {
+            case 1: c = 113; break;
+            case 2: c = 54; b = x << 8 | x << 3 | x << 2; break;
+            case 3: c = 26; b = x << 7 | x << 1 | x >> 1; break;
+            case 4: c = 13; b = x << 6 | x >> 1; break;
+            case 5: c = 6;  b = x << 5 | x >> 3; break;
+            }
+        }
+        int t = (d * c + b) ^ a;
+        return (a & 0x80) | t >> 2;
+    }
+
+    int unquantize_weight(int range, int code)
+    {
+        const quant_range& q = ranges[range];
+        int value;
+        if (!q.trits && !q.quints)
+            value = replicate(code, q.bits, 6);
+        else if (q.bits == 0)
+        {
+            static const int trits[3]  = { 0, 32, 63 };
+            static const int quints[5] = { 0, 16, 32, 47, 63 };
+            value = q.trits ? trits[code] : quints[code];
+        }
+        else
+        {
+            int d = code >> q.bits;
+            int m = code & ((1 << q.bits) - 1);
+            int a = m & 1 ? 0x7f : 0;
+            int x = m >> 1;
+            int b = 0, c = 0;
+            if (q.trits)
+            {
+                switch (q.bits)
+                {
+                case 1: c = 50; break;
+                case 2: c = 23; b = x << 6 | x << 2 | x; break;
+                case 3: c = 11; b = x << 5 | x; break;
+                }
+            }
+            else
+            {
+                switch (q.bits)
+                {
+                case 1: c = 28; break;
+                case 2: c = 13; b = x << 6 | x << 1; break;
+                }
+            }
+            int t = (d * c + b) ^ a;
+            value = (a & 0x20) | t >> 2;
+        }
+        return value > 32 ? value + 1 : value;
+    }
+
+    // codes of each range mapped to and from the values they decode to
+    struct quant_tables
+    {
+        uint8_t     color_value[COLOR_RANGES][256];
+        uint8_t     color_code[COLOR_RANGES][256];
+        uint8_t     weight_value[WEIGHT_RANGES][32];
+        uint8_t     weight_code[WEIGHT_RANGES][65];
+
+        // codes of the next lower and higher weight values
+        uint8_t     weight_down[WEIGHT_RANGES][32];
+        uint8_t     weight_up[WEIGHT_RANGES][32];
+    };
+
+    const quant_tables& quants()
+    {
+        static const quant_tables tables = []
+        {
+            quant_tables t;
+            for (int r = 0; r < COLOR_RANGES; r++)
+            {
+                int levels = ranges[r].levels;
+                for (int code = 0; code < levels; code++)
+                    t.color_value[r][code] = unquantize_color(r, code);
+                for (int v = 0; v < 256; v++)
+                {
+                    int best = INT_MAX;
+                    for (int code = 0; code < levels; code++)
+                    {
+                        int d = std::abs(t.color_value[r][code] - v);
+                        if (d < best)
+                        {
+                            best = d;
+                            t.color_code[r][v] = code;
+                        }
+                    }
+                }
+            }
+            for (int r = 0; r < WEIGHT_RANGES; r++)
+            {
+                int levels = ranges[r].levels;
+                for (int code = 0; code < levels; code++)
+                    t.weight_value[r][code] = unquantize_weight(r, code);
+                for (int v = 0; v <= 64; v++)
+                {
+                    int best = INT_MAX;
+                    for (int code = 0; code < levels; code++)
+                    {
+                        int d = std::abs(t.weight_value[r][code] - v);
+                        if (d < best)
+                        {
+                            best = d;
+                            t.weight_code[r][v] = code;
+                        }
+                    }
+                }
+                for (int code = 0; code < levels; code++)
+                {
+                    int value = t.weight_value[r][code];
+                    int down = -1, up = 65;
+                    t.weight_down[r][code] = t.weight_up[r][code] = code;
+                    for (int other = 0; other < levels; other++)
+                    {
+                        int v = t.weight_value[r][other];
+                        if (v < value && v > down)
+                        {
+                            down = v;
+                            t.weight_down[r][code] = other;
+                        }
+                        if (v > value && v < up)
+                        {
+                            up = v;
+                            t.weight_up[r][code] = other;
+                        }
+                    }
+                }
+            }
+            return t;
+        }();
+        return tables;
+    }
+}
+
+////////////////////////////////////
+//
+// block modes, partitions and
+// weight grids of a footprint
+//
+
+namespace
+{
+    /**
+     * @brief           Decodes the weight grid and range of a 2d block
+     *                  mode, single plane modes only
+     *
+     * @return true     If the mode is a valid single plane mode
+     */
+    bool decode_mode(int mode, int& x_weights, int& y_weights, int& range)
+    {
+        int r = bit(mode, 4);
+        int h = bit(mode, 9);
+        int d = bit(mode, 10);
+        int a = mode >> 5 & 3;
+
+        if ((mode & 3) != 0)
+        {
+            r |= (mode & 3) << 1;
+            int b = mode >> 7 & 3;
+            switch (mode >> 2 & 3)
+            {
+            case 0: x_weights = b + 4; y_weights = a + 2; break;
+            case 1: x_weights = b + 8; y_weights = a + 2; break;
+            case 2: x_weights = a + 2; y_weights = b + 8; break;
+            default:
+                if (mode & 0x100)
+                {
+                    x_weights = (b & 1) + 2;
+                    y_weights = a + 2;
+                }
+                else
+                {
+                    x_weights = a + 2;
+                    y_weights = (b & 1) + 6;
+                }
+                break;
+            }
+        }
+        else
+        {
+            r |= (mode >> 2 & 3) << 1;
+            if ((mode >> 2 & 3) == 0)
+                return false;
+
+            int b = mode >> 9 & 3;
+            switch (mode >> 7 & 3)
+            {
+            case 0: x_weights = 12; y_weights = a + 2; break;
+            case 1: x_weights = a + 2; y_weights = 12; break;
+            case 2: x_weights = a + 6; y_weights = b + 6; d = 0; h = 0; break;
+            default:
+                if ((mode >> 5 & 3) == 0)
+                {
+                    x_weights = 6;
+                    y_weights = 10;
+                }
+                else if ((mode >> 5 & 3) == 1)
+                {
+                    x_weights = 10;
+                    y_weights = 6;
+                }
+                else
+                    return false;
+                break;
+            }
+        }
+
+        range = r - 2 + 6 * h;
+        return d == 0;
+    }
+
+    uint32_t hash52(uint32_t p)
+    {
+        p ^= p >> 15;
+        p -= p << 17;
+        p += p << 7;
+        p += p << 4;
+        p ^= p >> 5;
+        p += p << 16;
+        p ^= p >> 7;
+        p ^= p >> 3;
+        p ^= p << 6;
+        p ^= p >> 17;
+        return p;
+    }
+
+    // partition of a texel, the hash of the block's seed and its position
+    int select_partition(int seed, int x, int y, int count, bool small)
+    {
+        if (small)
+        {
+            x <<= 1;
+            y <<= 1;
+        }
+        seed += (count - 1) * 1024;
+        uint32_t rnum = hash52(seed);
+
+        int s[8];
+        for (int i = 0; i < 8; i++)
+        {
+            int v = rnum >> (4 * i) & 0xf;
+            s[i] = v * v;
+        }
+
+        int sh1, sh2;
+        if (seed & 1)
+        {
+            sh1 = seed & 2 ? 4 : 5;
+            sh2 = count == 3 ? 6 : 5;
+        }
+        else
+        {
+            sh1 = count == 3 ? 6 : 5;
+            sh2 = seed & 2 ? 4 : 5;
+        }
+        for (int i = 0; i < 8; i++)
+            s[i] >>= i & 1 ? sh2 : sh1;
+
+        // the z terms are zero for 2d blocks
+        int a = (s[0] * x + s[1] * y + (rnum >> 14)) & 0x3f;
+        int b = (s[2] * x + s[3] * y + (rnum >> 10)) & 0x3f;
+        int c = (s[4] * x + s[5] * y + (rnum >> 6)) & 0x3f;
+        int d = (s[6] * x + s[7] * y + (rnum >> 2)) & 0x3f;
+        if (count <= 3) d = 0;
+        if (count <= 2) c = 0;
+
+        if (a >= b && a >= c && a >= d) return 0;
+        if (b >= c && b >= d) return 1;
+        if (c >= d) return 2;
+        return 3;
+    }
+
+    // texels blend the 4 nearest weights of the grid by these factors
+    struct infill
+    {
+        uint8_t     index[MAX_TEXELS][4];
+        uint8_t     factor[MAX_TEXELS][4];
+    };
+
+    struct grid_mode
+    {
+        int         x_weights;
+        int         y_weights;
+        int         range;
+        int         mode;
+        int         weight_bits;
+        const infill* grid;
+    };
+
+    // a weight grid with the color range the bits left over allow
+    struct config
+    {
+        const grid_mode* grid;
+        int         color_range;
+    };
+
+    // layout of a block, one per partition count and endpoint mode
+    enum Layout
+    {
+        RGB_1,
+        RGBA_1,
+        RGB_2,
+        RGBA_2,
+        LAYOUTS,
+    };
+
+    const int layout_partitions[LAYOUTS] = { 1, 1, 2, 2 };
+    const int layout_cem[LAYOUTS]        = { 8, 12, 8, 12 };
+
+    struct footprint_tables
+    {
+        int         w;
+        int         h;
+        int         texels;
+        std::vector<grid_mode> modes;
+        std::map<int, infill> grids;
+        std::vector<config> configs[LAYOUTS];
+
+        // texels of the second partition of each seed, 0 for
+        // seeds that leave a partition empty
+        uint64_t    partitions[PARTITION_SEEDS];
+    };
+
+    void build_infill(int w, int h, int x_weights, int y_weights, infill& grid)
+    {
+        int ds = (1024 + w / 2) / (w - 1);
+        int dt = (1024 + h / 2) / (h - 1);
+        int last = x_weights * y_weights - 1;
+        for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int gs = (ds * x * (x_weights - 1) + 32) >> 6;
+            int gt = (dt * y * (y_weights - 1) + 32) >> 6;
+            int fs = gs & 0xf;
+            int ft = gt & 0xf;
+            int v0 = (gs >> 4) + (gt >> 4) * x_weights;
+
+            int w11 = (fs * ft + 8) >> 4;
+            int t = y * w + x;
+            const int index[4]  = { v0, v0 + 1, v0 + x_weights, v0 + x_weights + 1 };
+            const int factor[4] = { 16 - fs - ft + w11, fs - w11, ft - w11, w11 };
+            for (int k = 0; k < 4; k++)
+            {
+                grid.factor[t][k] = factor[k];
+                grid.index[t][k] = factor[k] ? index[k] : std::min(index[k], last);
+            }
+        }
+    }
+
+    /**
+     * @brief           Builds the single plane block modes, weight grids and
+     *                  2 partition layouts of a footprint, and for each layout
+     *                  the grids that leave bits for a usable color range
+     */
+    void build_footprint(footprint_tables& t)
+    {
+        t.texels = t.w * t.h;
+
+        for (int mode = 0; mode < 2048; mode++)
+        {
+            int xw, yw, range;
+            if (!decode_mode(mode, xw, yw, range) || xw > t.w || yw > t.h)
+                continue;
+            int bits = ise_bits(xw * yw, range);
+            if (xw * yw > MAX_TEXELS || bits < MIN_WEIGHT_BITS || bits > MAX_WEIGHT_BITS)
+                continue;
+
+            // several modes can describe the same grid
+            bool seen = false;
+            for (const auto& m : t.modes)
+                seen |= m.x_weights == xw && m.y_weights == yw && m.range == range;
+            if (seen)
+                continue;
+
+            infill& grid = t.grids[xw * 16 + yw];
+            build_infill(t.w, t.h, xw, yw, grid);
+            t.modes.push_back({ xw, yw, range, mode, bits, &grid });
+        }
+
+        for (int layout = 0; layout < LAYOUTS; layout++)
+        {
+            int partitions = layout_partitions[layout];
+            int values = partitions * (layout_cem[layout] / 4 + 1) * 2;
+            int header = partitions == 1 ? 17 : 29;
+            for (const auto& m : t.modes)
+            {
+                int available = 128 - header - m.weight_bits;
+                int range = COLOR_RANGES - 1;
+                while (range >= 0 && ise_bits(values, range) > available)
+                    range--;
+
+                // too coarse to be worth trying
+                if (range >= 7)
+                    t.configs[layout].push_back({ &m, range });
+            }
+        }
+
+        bool small = t.texels < 31;
+        for (int seed = 0; seed < PARTITION_SEEDS; seed++)
+        {
+            uint64_t mask = 0;
+            for (int y = 0; y < t.h; y++)
+            for (int x = 0; x < t.w; x++)
+                if (select_partition(seed, x, y, 2, small))
+                    mask |= 1ULL << (y * t.w + x);
+
+            uint64_t all = t.texels == 64 ? ~0ULL : (1ULL << t.texels) - 1;
+            t.partitions[seed] = mask == all ? 0 : mask;
+        }
+    }
+
+    const footprint_tables& tables_of(const footprint& block)
+    {
+        // blocks of the same footprint come in long runs on each thread
+        thread_local const footprint_tables* last = nullptr;
+        if (last && last->w == block.w && last->h == block.h)
+            return *last;
+
+        static std::mutex mutex;
+        static std::map<int, std::unique_ptr<footprint_tables>> all;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& t = all[block.w * 16 + block.h];
+        if (!t)
+        {
+            t = std::make_unique<footprint_tables>();
+            t->w = block.w;
+            t->h = block.h;
+            build_footprint(*t);
+        }
+        last = t.get();
+        return *t;
+    }
+}
+
+////////////////////////////////////
+//
+// endpoint and weight fitting
+//
+
+namespace
+{
+    struct texels
+    {
+        float       c[4][MAX_TEXELS];
+        int         count;
+    };
+
+    struct endpoints
+    {
+        uint8_t     codes[2][4];
+        int         values[2][4];
+    };
+
+    /**
+     * @brief           Fits a line through the texels of a partition, the
+     *                  extremes of their projections onto its principal axis
+     *
+     * @param block     Texels of the block
+     * @param mask      Texels of the partition
+     * @param channels  3 for rgb, 4 for rgba
+     * @param e         Endpoints
+     */
+    void fit_line(const texels& block, uint64_t mask, int channels, float e[2][4])
+    {
+        float mean[4] = {};
+        int n = 0;
+        for (int t = 0; t < block.count; t++)
+        {
+            if (!(mask >> t & 1))
+                continue;
+            for (int c = 0; c < 4; c++)
+                mean[c] += block.c[c][t];
+            n++;
+        }
+        for (int c = 0; c < 4; c++)
+            mean[c] /= std::max(n, 1);
+
+        float cov[4][4] = {};
+        for (int t = 0; t < block.count; t++)
+        {
+            if (!(mask >> t & 1))
+                continue;
+            float d[4];
+            for (int c = 0; c < 4; c++)
+                d[c] = block.c[c][t] - mean[c];
+            for (int i = 0; i < channels; i++)
+            for (int j = 0; j < channels; j++)
+                cov[i][j] += d[i] * d[j];
+        }
+
+        // power iteration from the widest channel
+        float axis[4] = {};
+        int widest = 0;
+        for (int c = 1; c < channels; c++)
+            if (cov[c][c] > cov[widest][widest])
+                widest = c;
+        axis[widest] = 1;
+        for (int iter = 0; iter < 8; iter++)
+        {
+            float next[4] = {};
+            for (int i = 0; i < channels; i++)
+            for (int j = 0; j < channels; j++)
+                next[i] += cov[i][j] * axis[j];
+            float len = 0;
+            for (int c = 0; c < channels; c++)
+                len = std::max(len, std::fabs(next[c]));
+            if (len == 0)
+                break;
+            for (int c = 0; c < channels; c++)
+                axis[c] = next[c] / len;
+        }
+
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (int t = 0; t < block.count; t++)
+        {
+            if (!(mask >> t & 1))
+                continue;
+            float p = 0;
+            for (int c = 0; c < channels; c++)
+                p += (block.c[c][t] - mean[c]) * axis[c];
+            lo = std::min(lo, p);
+            hi = std::max(hi, p);
+        }
+        if (n == 0)
+            lo = hi = 0;
+
+        for (int c = 0; c < 4; c++)
+        {
+            e[0][c] = std::min(std::max(mean[c] + lo * axis[c], 0.0f), 255.0f);
+            e[1][c] = std::min(std::max(mean[c] + hi * axis[c], 0.0f), 255.0f);
+        }
+        if (channels == 3)
+            e[0][3] = e[1][3] = 255;
+    }
+
+    /**
+     * @brief           Quantizes a pair of endpoints to a color range, in
+     *                  the order the direct modes expect (the decoder swaps
+     *                  endpoints whose second color sums lower than the first)
+     */
+    void quantize_endpoints(const float e[2][4], int range, endpoints& out)
+    {
+        for (int i = 0; i < 2; i++)
+        for (int c = 0; c < 4; c++)
+        {
+            int v = (int)std::lround(e[i][c]);
+            out.codes[i][c] = quants().color_code[range][v];
+            out.values[i][c] = quants().color_value[range][out.codes[i][c]];
+        }
+
+        int s0 = out.values[0][0] + out.values[0][1] + out.values[0][2];
+        int s1 = out.values[1][0] + out.values[1][1] + out.values[1][2];
+        if (s1 < s0)
+        {
+            std::swap(out.codes[0], out.codes[1]);
+            std::swap(out.values[0], out.values[1]);
+        }
+    }
+
+    // weights from 0 to 64 that project each texel onto its partition's line
+    void ideal_weights(const texels& block, const uint8_t* partition, const endpoints* e, int channels, float* weights)
+    {
+        for (int t = 0; t < block.count; t++)
+        {
+            const endpoints& p = e[partition[t]];
+            float dot = 0, len = 0;
+            for (int c = 0; c < channels; c++)
+            {
+                float d = (float)(p.values[1][c] - p.values[0][c]);
+                dot += (block.c[c][t] - p.values[0][c]) * d;
+                len += d * d;
+            }
+            weights[t] = len > 0 ? std::min(std::max(dot / len * 64, 0.0f), 64.0f) : 0;
+        }
+    }
+
+    // texel weights of the grid, as the decoder infills them
+    inline void infill_weights(const infill& grid, const uint8_t* values, int count, int* weights)
+    {
+        for (int t = 0; t < count; t++)
+        {
+            const uint8_t* i = grid.index[t];
+            const uint8_t* f = grid.factor[t];
+            weights[t] = (values[i[0]] * f[0] + values[i[1]] * f[1] + values[i[2]] * f[2] + values[i[3]] * f[3] + 8) >> 4;
+        }
+    }
+
+    /**
+     * @brief           Squared error of the decoded block, each channel
+     *                  blended between its partition's endpoints at the
+     *                  texel's weight
+     */
+    float block_error_scalar(const texels& block, const uint8_t* partition, const endpoints* e, const int* weights)
+    {
+        float error = 0;
+        for (int t = 0; t < block.count; t++)
+        {
+            const endpoints& p = e[partition[t]];
+            float w = weights[t] / 64.0f;
+            for (int c = 0; c < 4; c++)
+            {
+                float d = p.values[0][c] + (p.values[1][c] - p.values[0][c]) * w - block.c[c][t];
+                error += d * d;
+            }
+        }
+        return error;
+    }
+
+#if defined(BLOCS_X86)
+    TARGET("sse2")
+    float block_error_sse2(const texels& block, const uint8_t* partition, const endpoints* e, const int* weights)
+    {
+        __m128 sum = _mm_setzero_ps();
+        const __m128 scale = _mm_set1_ps(1 / 64.0f);
+        int t = 0;
+        for (; t + 4 <= block.count; t += 4)
+        {
+            __m128 w = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(weights + t))), scale);
+            for (int c = 0; c < 4; c++)
+            {
+                float lo[4], hi[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    const endpoints& p = e[partition[t + k]];
+                    lo[k] = (float)p.values[0][c];
+                    hi[k] = (float)p.values[1][c];
+                }
+                __m128 a = _mm_loadu_ps(lo);
+                __m128 b = _mm_loadu_ps(hi);
+                __m128 v = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), w));
+                __m128 d = _mm_sub_ps(v, _mm_loadu_ps(block.c[c] + t));
+                sum = _mm_add_ps(sum, _mm_mul_ps(d, d));
+            }
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, sum);
+        float error = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (; t < block.count; t++)
+        {
+            const endpoints& p = e[partition[t]];
+            float w = weights[t] / 64.0f;
+            for (int c = 0; c < 4; c++)
+            {
+                float d = p.values[0][c] + (p.values[1][c] - p.values[0][c]) * w - block.c[c][t];
+                error += d * d;
+            }
+        }
+        return error;
+    }
+#endif
+
+    using error_fn = float (*)(const texels&, const uint8_t*, const endpoints*, const int*);
+
+    const error_fn block_error = []() -> error_fn
+    {
+#if defined(BLOCS_X86)
+        if (cpu().sse2)
+            return block_error_sse2;
+#endif
+        return block_error_scalar;
+    }();
+
+    /**
+     * @brief           Quantizes ideal texel weights onto a weight grid,
+     *                  each grid weight the average of the texels it
+     *                  reaches, weighted by how much it reaches them
+     */
+    void fit_grid(const grid_mode& m, const float* ideal, int count, uint8_t* codes, uint8_t* values)
+    {
+        int weights = m.x_weights * m.y_weights;
+        float sum[MAX_TEXELS] = {}, total[MAX_TEXELS] = {};
+        for (int t = 0; t < count; t++)
+        for (int k = 0; k < 4; k++)
+        {
+            int f = m.grid->factor[t][k];
+            sum[m.grid->index[t][k]] += ideal[t] * f;
+            total[m.grid->index[t][k]] += f;
+        }
+
+        for (int i = 0; i < weights; i++)
+        {
+            int v = total[i] > 0 ? (int)std::lround(sum[i] / total[i]) : 0;
+            codes[i] = quants().weight_code[m.range][v];
+            values[i] = quants().weight_value[m.range][codes[i]];
+        }
+    }
+
+    /**
+     * @brief           Refits the endpoints of each partition by least
+     *                  squares to the weights the texels decode with
+     */
+    void refit_endpoints(const texels& block, const uint8_t* partition, int partitions, const int* weights, int channels, float e[][2][4])
+    {
+        for (int p = 0; p < partitions; p++)
+        {
+            float aa = 0, ab = 0, bb = 0;
+            float ax[4] = {}, bx[4] = {};
+            for (int t = 0; t < block.count; t++)
+            {
+                if (partition[t] != p)
+                    continue;
+                float b = weights[t] / 64.0f;
+                float a = 1 - b;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 4; c++)
+                {
+                    ax[c] += a * block.c[c][t];
+                    bx[c] += b * block.c[c][t];
+                }
+            }
+
+            float det = aa * bb - ab * ab;
+            if (std::fabs(det) < 1e-6f)
+                continue;
+            for (int c = 0; c < channels; c++)
+            {
+                e[p][0][c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / det, 0.0f), 255.0f);
+                e[p][1][c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / det, 0.0f), 255.0f);
+            }
+        }
+    }
+}
+
+////////////////////////////////////
+//
+// block search and bits
+//
+
+namespace
+{
+    struct candidate
+    {
+        float       error = FLT_MAX;
+        Layout      layout;
+        config      cfg;
+        int         seed;
+        endpoints   e[2];
+        uint8_t     weights[MAX_TEXELS];
+    };
+
+    struct search
+    {
+        int         configs;
+        int         seeds;
+        int         iterations;
+        bool        descend;
+    };
+
+    search search_of(Quality quality, int partitions)
+    {
+        switch (quality)
+        {
+        case Quality::FAST:   return { partitions == 1 ? 1 : 0, 0, 0, false };
+        case Quality::NORMAL: return { partitions == 1 ? 3 : 2, 4, 1, false };
+        default:              return { partitions == 1 ? 8 : 4, 16, 2, true };
+        }
+    }
+
+    /**
+     * @brief           Estimates the error of a weight grid and color range
+     *                  for a block whose colors span a distance, from the
+     *                  step sizes of the weights and colors and the share
+     *                  of texels without a weight of their own
+     */
+    float estimate(const config& cfg, int texels, float span)
+    {
+        const grid_mode& m = *cfg.grid;
+        float weight_step = span / (ranges[m.range].levels - 1);
+        float color_step = 255.0f / (ranges[cfg.color_range].levels - 1);
+        float decimation = 1 - (float)(m.x_weights * m.y_weights) / texels;
+        return weight_step * weight_step / 12 + color_step * color_step / 24 + span * span * decimation / 16;
+    }
+
+    /**
+     * @brief           Encodes the block with one layout, weight grid and
+     *                  partitioning, keeping it if it beats the best so far
+     */
+    void try_config(const texels& block, const footprint_tables& t, Layout layout, const config& cfg, int seed,
+        const search& s, candidate& best)
+    {
+        int partitions = layout_partitions[layout];
+        int channels = layout_cem[layout] == 12 ? 4 : 3;
+        const grid_mode& m = *cfg.grid;
+
+        uint8_t partition[MAX_TEXELS];
+        uint64_t masks[2] = { ~0ULL, 0 };
+        if (partitions == 2)
+        {
+            masks[1] = t.partitions[seed];
+            masks[0] = ~masks[1];
+        }
+        for (int i = 0; i < block.count; i++)
+            partition[i] = masks[1] >> i & 1;
+
+        float e[2][2][4];
+        for (int p = 0; p < partitions; p++)
+            fit_line(block, masks[p], channels, e[p]);
+
+        endpoints q[2];
+        float ideal[MAX_TEXELS];
+        uint8_t codes[MAX_TEXELS], values[MAX_TEXELS];
+        int weights[MAX_TEXELS];
+        float error = FLT_MAX;
+        for (int iter = 0; ; iter++)
+        {
+            for (int p = 0; p < partitions; p++)
+                quantize_endpoints(e[p], cfg.color_range, q[p]);
+            ideal_weights(block, partition, q, channels, ideal);
+            fit_grid(m, ideal, block.count, codes, values);
+            infill_weights(*m.grid, values, block.count, weights);
+            error = block_error(block, partition, q, weights);
+            if (iter == s.iterations)
+                break;
+            refit_endpoints(block, partition, partitions, weights, channels, e);
+        }
+
+        // nudges each grid weight a step either way while that helps
+        if (s.descend)
+        {
+            int count = m.x_weights * m.y_weights;
+            for (int i = 0; i < count; i++)
+            {
+                uint8_t original = codes[i];
+                for (uint8_t next : { quants().weight_down[m.range][original], quants().weight_up[m.range][original] })
+                {
+                    if (next == codes[i])
+                        continue;
+                    uint8_t keep = codes[i];
+                    codes[i] = next;
+                    values[i] = quants().weight_value[m.range][next];
+                    infill_weights(*m.grid, values, block.count, weights);
+                    float e2 = block_error(block, partition, q, weights);
+                    if (e2 < error)
+                        error = e2;
+                    else
+                    {
+                        codes[i] = keep;
+                        values[i] = quants().weight_value[m.range][keep];
+                    }
+                }
+            }
+        }
+
+        if (error < best.error)
+        {
+            best.error = error;
+            best.layout = layout;
+            best.cfg = cfg;
+            best.seed = seed;
+            best.e[0] = q[0];
+            best.e[1] = q[1];
+            memcpy(best.weights, codes, m.x_weights * m.y_weights);
+        }
+    }
+
+    /**
+     * @brief           Ranks the partitionings of a block against a split of
+     *                  its texels into two clusters, counting the texels each
+     *                  seed places on the other side of the split
+     */
+    int rank_partitions(const texels& block, const footprint_tables& t, int channels, int count, int* seeds)
+    {
+        float e[2][4];
+        fit_line(block, ~0ULL, channels, e);
+
+        // two clusters grown from the ends of the block's principal line
+        uint64_t split = 0;
+        for (int iter = 0; iter < 3; iter++)
+        {
+            split = 0;
+            for (int i = 0; i < block.count; i++)
+            {
+                float d0 = 0, d1 = 0;
+                for (int c = 0; c < channels; c++)
+                {
+                    d0 += (block.c[c][i] - e[0][c]) * (block.c[c][i] - e[0][c]);
+                    d1 += (block.c[c][i] - e[1][c]) * (block.c[c][i] - e[1][c]);
+                }
+                if (d1 < d0)
+                    split |= 1ULL << i;
+            }
+            for (int p = 0; p < 2; p++)
+            {
+                float sum[4] = {};
+                int n = 0;
+                for (int i = 0; i < block.count; i++)
+                {
+                    if ((split >> i & 1) != (uint64_t)p)
+                        continue;
+                    for (int c = 0; c < channels; c++)
+                        sum[c] += block.c[c][i];
+                    n++;
+                }
+                for (int c = 0; c < channels && n > 0; c++)
+                    e[p][c] = sum[c] / n;
+            }
+        }
+
+        std::pair<int, int> ranked[PARTITION_SEEDS];
+        int n = 0;
+        for (int seed = 0; seed < PARTITION_SEEDS; seed++)
+        {
+            if (!t.partitions[seed])
+                continue;
+            int miss = __builtin_popcountll(t.partitions[seed] ^ split);
+            ranked[n++] = { std::min(miss, block.count - miss), seed };
+        }
+        count = std::min(count, n);
+        std::partial_sort(ranked, ranked + count, ranked + n);
+        for (int i = 0; i < count; i++)
+            seeds[i] = ranked[i].second;
+        return count;
+    }
+
+    void write_block(const candidate& best, uint8_t* out)
+    {
+        const grid_mode& m = *best.cfg.grid;
+        int partitions = layout_partitions[best.layout];
+        int cem = layout_cem[best.layout];
+        int channels = cem == 12 ? 4 : 3;
+
+        memset(out, 0, 16);
+        put_bits(out, 0, 11, m.mode);
+        put_bits(out, 11, 2, partitions - 1);
+
+        int pos;
+        if (partitions == 1)
+        {
+            put_bits(out, 13, 4, cem);
+            pos = 17;
+        }
+        else
+        {
+            put_bits(out, 13, 10, best.seed);
+            put_bits(out, 23, 6, cem << 2);
+            pos = 29;
+        }
+
+        // each endpoint pair interleaves its channels, r0 r1 g0 g1 ...
+        uint8_t colors[16];
+        int n = 0;
+        for (int p = 0; p < partitions; p++)
+        for (int c = 0; c < channels; c++)
+        {
+            colors[n++] = best.e[p].codes[0][c];
+            colors[n++] = best.e[p].codes[1][c];
+        }
+        put_sequence(colors, n, best.cfg.color_range, out, pos);
+
+        // weights fill the block from its last bit down
+        uint8_t weights[16] = {};
+        put_sequence(best.weights, m.x_weights * m.y_weights, m.range, weights, 0);
+        for (int i = 0; i < m.weight_bits; i++)
+            out[(127 - i) >> 3] |= (weights[i >> 3] >> (i & 7) & 1) << ((127 - i) & 7);
+    }
+
+    // one color for the whole block
+    void write_void_extent(const uint8_t* color, uint8_t* out)
+    {
+        const uint8_t head[8] = { 0xfc, 0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+        memcpy(out, head, 8);
+        for (int c = 0; c < 4; c++)
+        {
+            out[8 + 2 * c] = color[c];
+            out[9 + 2 * c] = color[c];
+        }
+    }
+}
+
+////////////////////////////////////
+//
+// astc api
+//
+
+bool blocs__atlas::valid_footprint(const footprint& block)
+{
+    static const int sizes[][2] = { { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 }, { 8, 8 } };
+    for (const auto& size : sizes)
+        if (block.w == size[0] && block.h == size[1])
+            return true;
+    return false;
+}
+
+void blocs__atlas::encode_astc(const uint8_t* pixels, const footprint& block, uint8_t* out, Quality quality)
+{
+    const footprint_tables& t = tables_of(block);
+
+    texels b;
+    b.count = t.texels;
+    bool opaque = true, flat = true;
+    for (int i = 0; i < b.count; i++)
+    {
+        for (int c = 0; c < 4; c++)
+            b.c[c][i] = pixels[i * CHANNELS + c];
+        opaque &= pixels[i * CHANNELS + 3] == 255;
+        flat &= memcmp(pixels + i * CHANNELS, pixels, CHANNELS) == 0;
+    }
+
+    if (flat)
+    {
+        write_void_extent(pixels, out);
+        return;
+    }
+
+    int channels = opaque ? 3 : 4;
+    float lo[4], hi[4];
+    for (int c = 0; c < 4; c++)
+    {
+        lo[c] = *std::min_element(b.c[c], b.c[c] + b.count);
+        hi[c] = *std::max_element(b.c[c], b.c[c] + b.count);
+    }
+    float span = 0;
+    for (int c = 0; c < channels; c++)
+        span += (hi[c] - lo[c]) * (hi[c] - lo[c]);
+    span = std::sqrt(span);
+
+    candidate best;
+    for (int partitions = 1; partitions <= 2; partitions++)
+    {
+        search s = search_of(quality, partitions);
+        if (s.configs == 0)
+            continue;
+
+        Layout layout = (Layout)((partitions - 1) * 2 + (opaque ? 0 : 1));
+        const std::vector<config>& configs = t.configs[layout];
+        if (configs.empty())
+            continue;
+
+        // grids are tried from the most to the least promising estimate
+        std::vector<std::pair<float, int>> ranked(configs.size());
+        for (std::size_t i = 0; i < configs.size(); i++)
+            ranked[i] = { estimate(configs[i], b.count, span), (int)i };
+        int tries = std::min<int>(s.configs, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + tries, ranked.end());
+
+        int seeds[PARTITION_SEEDS] = { 0 };
+        int seed_count = 1;
+        if (partitions == 2)
+        {
+            seed_count = rank_partitions(b, t, channels, s.seeds, seeds);
+        }
+
+        for (int i = 0; i < tries; i++)
+        for (int j = 0; j < seed_count; j++)
+            try_config(b, t, layout, configs[ranked[i].second], seeds[j], s, best);
+    }
+
+    write_block(best, out);
+}
@@ -0,0 +1,45 @@
+
+#pragma once
+
+#include <cstdint>
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // astc ldr compression of blocks
+    // from 4x4 up to 8x8 pixels
+    //
+
+    // width and height of the pixels a block covers
+    struct footprint
+    {
+        int         w = 4;
+        int         h = 4;
+    };
+
+    enum class Quality;
+
+    /**
+     * @brief           Checks a footprint is one of the 2d sizes astc
+     *                  defines, from 4x4 up to 8x8
+     *
+     * @param block     Footprint
+     * @return true     If the footprint can be encoded
+     */
+    bool valid_footprint(const footprint& block);
+
+    /**
+     * @brief           Encodes the RGBA pixels of a block (row major) as a
+     *                  128 bit ASTC block, FAST fits one partition on the
+     *                  likeliest weight grid, NORMAL also tries the best two
+     *                  partition layouts and more grids, FULL searches wider
+     *                  and refines the weights one by one
+     *
+     * @param pixels    Pixels of the block, block.w * block.h of them
+     * @param block     Footprint of the block
+     * @param out       16 byte block
+     * @param quality   How many partitions and weight grids are searched
+     */
+    void encode_astc(const uint8_t* pixels, const footprint& block, uint8_t* out, Quality quality);
+}
@@ -0,0 +1,1128 @@
+
+#include "atlas.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "dat.hpp"
+#include "mph.hpp"
+#include "qoi.hpp"
+#include "raw.hpp"
+
+namespace
+{
+    // arena of the image being decoded by stb_image
+    thread_local blocs__atlas::arena* decode_arena;
+}
+
+#define STBI_MALLOC(sz)                     decode_arena->allocate(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) decode_arena->reallocate(p, newsz)
+#define STBI_FREE(p)                        decode_arena->free(p)
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// image loading, unloading, saving
+// and pixel data manipulation
+//
+
+/**
+ * @brief           Creates an image with no pixel data
+ * 
+ * @param allocator Arena that pixel data will be allocated from
+ */
+image::image(arena& allocator)
+    : name(0), w(0), h(0), data(nullptr), allocator(&allocator) {}
+
+/**
+ * @brief           Creates an empty image of a size
+ *                  to have pixels added later
+ * 
+ * @param w         Image width
+ * @param h         Image height
+ * @param allocator Arena that pixel data is allocated from
+ */
+image::image(int32_t w, int32_t h, arena& allocator)
+    : name(0), w(w), h(h), allocator(&allocator)
+{
+    data = (uint8_t*)allocator.allocate((std::size_t)w * h * CHANNELS, 64);
+}
+
+/**
+ * @brief           Takes ownership of another image's pixel data
+ */
+image::image(image&& other) noexcept
+    : name(other.name), w(other.w), h(other.h), data(other.data), allocator(other.allocator)
+{
+    other.data = nullptr;
+}
+
+/**
+ * @brief           Frees this image's pixel data and takes
+ *                  ownership of another image's instead
+ */
+image& image::operator=(image&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (data)
+            unload();
+        name = other.name;
+        w = other.w;
+        h = other.h;
+        data = other.data;
+        allocator = other.allocator;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+image::~image()
+{
+    if (data)
+        unload();
+}
+
+/**
+ * @brief       Decodes RGBA pixel data from the bytes of an image
+ *              file, qoi and rgba8 raw files are told apart by their
+ *              magic and read in-tree, and anything else by stb_image
+ * 
+ * @param file  Contents of the image file
+ * @param size  Length of the contents
+ * @return      true false 
+ */
+bool image::load(const uint8_t* file, std::size_t size)
+{
+    if (data)
+        unload();
+
+    if (qoi_size(file, size, w, h))
+    {
+        data = (uint8_t*)allocator->allocate((std::size_t)w * h * CHANNELS, 64);
+        if (!qoi_decode(file, size, data))
+            unload();
+        return data != nullptr;
+    }
+
+    if (const uint8_t* pixels = raw_pixels(file, size, w, h))
+    {
+        data = (uint8_t*)allocator->allocate((std::size_t)w * h * CHANNELS, 64);
+        memcpy(data, pixels, (std::size_t)w * h * CHANNELS);
+        return true;
+    }
+
+    if (size > INT32_MAX)
+        return false;
+
+    int bpp;
+    decode_arena = allocator;
+    data = stbi_load_from_memory(file, (int)size, &w, &h, &bpp, CHANNELS);
+    decode_arena = nullptr;
+    return data != nullptr;
+}
+
+/**
+ * @brief       Frees bitmaps data from memory, if any is loaded
+ */
+void image::unload()
+{
+    if (data == nullptr)
+        return;
+    allocator->free(data);
+    data = nullptr;
+}
+
+/**
+ * @brief       Fills a bitmap's pixel data with transparent
+ *              empty pixels (RGBA of 0U)
+ */
+void image::clear()
+{
+    memset(data, 0U, (std::size_t)w * h * CHANNELS * sizeof(uint8_t));
+}
+
+/**
+ * @brief       Blits pixel data onto a portion on a bitmap
+ * 
+ * @param pxls  New pixel data
+ * @param dst   Destination rect on the image
+ * @return true If the rect lies within the image
+ */
+bool image::set_pixels(const uint8_t* pxls, const rect& dst)
+{
+    if (data == nullptr || dst.x < 0 || dst.y < 0 || dst.x + dst.w > w || dst.y + dst.h > h)
+        return false;
+
+    for (int y = 0; y < dst.h; y++)
+    {
+        int from = y * dst.w;
+        int to = dst.x + (dst.y + y) * w;
+        memcpy(
+            data + to * CHANNELS,
+            pxls + from * CHANNELS,
+            dst.w * CHANNELS * sizeof(uint8_t)
+        );
+    }
+    return true;
+}
+
+/**
+ * @brief         Writes all rows of the bitmap to an output format
+ * 
+ * @param writer  Writer of the output, sized to the image
+ * @return true   If there were pixels to write and the file was written
+ */
+bool image::save(row_writer& writer) const
+{
+    if (data == nullptr || w <= 0 || h <= 0)
+        return false;
+
+    return writer.write_rows(data, h) && writer.finish();
+}
+
+/**
+ * @brief       Generates a unique hash based on
+ *              the pixels of a loaded bitmap
+ */
+std::size_t image::generate_hash() const
+{
+    std::size_t hash = 0;
+    int len = w * h * 4;
+    std::string str;
+    str.reserve(len);
+    for (int i = 0; i < len; i++)
+        str += std::to_string(data[i]);
+    hash ^= std::hash<std::string>{}(str) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+bool blocs__atlas::zlib_decode(const uint8_t* data, std::size_t len, uint8_t* out, std::size_t size, arena& scratch)
+{
+    if (len > INT32_MAX || size > INT32_MAX)
+        return false;
+
+    decode_arena = &scratch;
+    int decoded = stbi_zlib_decode_buffer((char*)out, (int)size, (const char*)data, (int)len);
+    decode_arena = nullptr;
+    return decoded == (int)size;
+}
+
+////////////////////////////////////
+//
+// texture atlas generation
+//
+
+/**
+ * @brief               Creates a new atlas object
+ * 
+ * @param n             Number of expected textures to be added
+ * @param size          Size of final atlas
+ * @param expand        Amount of pixels to repeat on edges
+ * @param border        Amount of empty space between bitmaps
+ * @param expand_mode   Default method used to fill the expanded edges
+ */
+atlas::atlas(std::size_t n, int size, int expand, int border, Expand expand_mode)
+    : m_size(size), m_expand(expand), m_border(border), m_expand_mode(expand_mode), m_align{ 1, 1 }, m_bitmap(m_pixels)
+{
+    m_images.reserve(n);
+    m_textures.reserve(n);
+}
+
+/**
+ * @brief               Adds a texture to the list of textures to be packed,
+ *                      taking ownership of its pixel data without copying,
+ *                      its name must be interned in m_names
+ * 
+ * @param image         Image to be packed
+ * @return true         If the texture was added, false if it had no
+ *                      pixels or was larger than the atlas
+ */
+bool atlas::add_texture(image&& image)
+{
+    return add_texture(std::move(image), m_expand_mode);
+}
+
+/**
+ * @brief               Adds a texture to the list of textures to be packed
+ *                      with its own method of filling the expanded edges
+ * 
+ * @param image         Image to be packed
+ * @param expand        Extrusion mode overriding the atlas default
+ * @return true         If the texture was added
+ */
+bool atlas::add_texture(image&& image, Expand expand)
+{
+    // left with the caller when it cannot be added
+    if (image.data == nullptr || image.w > m_size || image.h > m_size)
+        return false;
+
+    m_textures.push_back({
+        image.name,
+        { 0, 0, image.w, image.h },
+        (uint32_t)m_images.size(),
+        expand
+    });
+    m_images.emplace_back(std::move(image));
+    return true;
+}
+
+/**
+ * @brief               Adds a texture copied from pixels in memory, so
+ *                      callers need no files and keep their own buffer
+ * 
+ * @param name          Name of the texture
+ * @param pixels        RGBA pixel data
+ * @param w             Width of the pixels
+ * @param h             Height of the pixels
+ * @param stride        Bytes from one row to the next, 0 if rows are packed
+ * @return true         If the texture was added, false if it was empty
+ *                      or larger than the atlas
+ */
+bool atlas::add_texture(std::string_view name, const uint8_t* pixels, int w, int h, std::size_t stride)
+{
+    return add_texture(name, pixels, w, h, stride, m_expand_mode);
+}
+
+/**
+ * @brief               Adds a texture copied from pixels in memory
+ *                      with its own method of filling the expanded edges
+ * 
+ * @param name          Name of the texture
+ * @param pixels        RGBA pixel data
+ * @param w             Width of the pixels
+ * @param h             Height of the pixels
+ * @param stride        Bytes from one row to the next, 0 if rows are packed
+ * @param expand        Extrusion mode overriding the atlas default
+ * @return true         If the texture was added
+ */
+bool atlas::add_texture(std::string_view name, const uint8_t* pixels, int w, int h, std::size_t stride, Expand expand)
+{
+    if (pixels == nullptr || w <= 0 || h <= 0 || w > m_size || h > m_size)
+        return false;
+    if (m_names.size() + name.size() >= UINT32_MAX)
+        return false;
+    std::size_t row = (std::size_t)w * CHANNELS;
+    if (stride == 0)
+        stride = row;
+
+    image bmp(w, h, m_pixels);
+    bmp.name = m_names.intern(name);
+    for (int y = 0; y < h; y++)
+        memcpy(bmp.data + y * row, pixels + y * stride, row);
+    return add_texture(std::move(bmp), expand);
+}
+
+/**
+ * @brief               Rounds the space each texture takes up to whole
+ *                      blocks of a compressed format, so no two textures
+ *                      ever share a block
+ * 
+ * @param block         Pixels a block covers
+ */
+void atlas::align_to(const footprint& block)
+{
+    m_align = block;
+}
+
+/**
+ * @brief               Packs bitmap rects into smallest possible
+ *                      configuration and updates texture positions
+ * 
+ * @return true         If every texture found a place in the atlas
+ */
+bool atlas::pack()
+{
+    int area  = 0;
+    int max_w = 0;
+    int max_h = 0;
+    int padding = m_expand * 2 + m_border;
+
+    // space taken up by a texture, whole blocks of it when aligned
+    auto box = [&](const rect& rect, int& w, int& h)
+    {
+        w = (rect.w + padding + m_align.w - 1) / m_align.w * m_align.w;
+        h = (rect.h + padding + m_align.h - 1) / m_align.h * m_align.h;
+    };
+
+    for (int i = 0; i < m_textures.size(); i++)
+    {
+        int w, h;
+        box(m_textures[i].rect, w, h);
+        area += w * h;
+        max_w = std::max(max_w, w);
+        max_h = std::max(max_h, h);
+    }
+    double suboptimal_coefficient = 0.85; // assumes sub-100% space utilization
+
+    if (max_w > m_size || max_h > m_size || area > m_size * m_size * suboptimal_coefficient)
+        return false;
+
+    std::vector<rect> spaces = { { 0, 0, m_size, m_size } };
+
+    std::sort(m_textures.begin(), m_textures.end(), [](const texture& a, const texture& b)
+    {
+        return a.rect.h > b.rect.h;
+    });
+
+    for (auto& texture : m_textures)
+    {
+        auto& rect = texture.rect;
+        bool placed = false;
+
+        for (int i = spaces.size() - 1; i >= 0; i--)
+        {
+            auto space = spaces[i];
+
+            int w, h;
+            box(rect, w, h);
+
+            // check if image too large for space
+            if (w > space.w || h > space.h)
+                continue;
+
+            // add image to space's top-left
+            // |-------|-------|
+            // |  box  |       |
+            // |_______|       |
+            // |         space |
+            // |_______________|
+            rect.x = space.x + m_expand;
+            rect.y = space.y + m_expand;
+
+            if (w == space.w && h == space.h)
+            {
+                // remove space if perfect fit
+                // |---------------|
+                // |               |
+                // |      box      |
+                // |               |
+                // |_______________|
+                auto last = spaces.back();
+                spaces.pop_back();
+                
+                if (i < spaces.size())
+                    spaces[i] = last;
+            }
+            else if (h == space.h)
+            {
+                // space matches image height
+                // move space right and cut off width
+                // |-------|---------------|
+                // |  box  | updated space |
+                // |_______|_______________|
+                space.x += w;
+                space.w -= w;
+                spaces[i] = space;
+            }
+            else if (w == space.w)
+            {
+                // space matches image width
+                // move space down and cut off height
+                // |---------------|
+                // |      box      |
+                // |_______________|
+                // | updated space |
+                // |_______________|
+                space.y += h;
+                space.h -= h;
+                spaces[i] = space;
+            }
+            else
+            {
+                // split width and height
+                // difference into two new spaces
+                // |-------|-----------|
+                // |  box  | new space |
+                // |_______|___________|
+                // | updated space     |
+                // |___________________|
+                spaces.push_back({
+                    space.x + w,
+                    space.y,
+                    space.w - w,
+                    h
+                });
+                space.y += h;
+                space.h -= h;
+                spaces[i] = space;
+            }
+
+            placed = true;
+            break;
+        }
+
+        // left where it was, over other textures, so the atlas is unusable
+        if (!placed)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief               Gets where each texture was packed, in the order the
+ *                      textures were added rather than the order packed in
+ * 
+ * @return std::vector<texture> 
+ */
+std::vector<texture> atlas::layout() const
+{
+    std::vector<texture> textures(m_textures.size());
+    for (const auto& texture : m_textures)
+        textures[texture.image_index] = texture;
+    return textures;
+}
+
+namespace
+{
+    /**
+     * @brief       Maps a pixel index that may lie outside of [0, n)
+     *              back onto the source following an extrusion mode
+     * 
+     * @param i     Pixel index along a row or column
+     * @param n     Number of pixels along that row or column
+     * @return int 
+     */
+    template <Expand mode>
+    inline int expand_index(int i, int n)
+    {
+        if constexpr (mode == Expand::WRAP)
+            return (i % n + n) % n;
+        else if constexpr (mode == Expand::MIRROR)
+        {
+            int m = (i % (n * 2) + n * 2) % (n * 2);
+            return m < n ? m : n * 2 - 1 - m;
+        }
+        else
+            return std::clamp(i, 0, n - 1);
+    }
+
+    /**
+     * @brief       Copies a row of pixels and fills the expanded
+     *              pixels on either side of it
+     * 
+     * @param dst   First pixel of the row in the atlas
+     * @param src   First pixel of the row in the texture
+     * @param w     Width of the texture
+     * @param e     Amount of pixels to expand on either side
+     */
+    template <Expand mode>
+    void expand_row(uint8_t* dst, const uint8_t* src, int w, int e)
+    {
+        memcpy(dst, src, w * CHANNELS * sizeof(uint8_t));
+        if constexpr (mode == Expand::NONE)
+            return;
+
+        for (int x = -e; x < 0; x++)
+            memcpy(dst + x * CHANNELS, src + expand_index<mode>(x, w) * CHANNELS, CHANNELS);
+        for (int x = w; x < w + e; x++)
+            memcpy(dst + x * CHANNELS, src + expand_index<mode>(x, w) * CHANNELS, CHANNELS);
+    }
+
+    /**
+     * @brief       Blits the rows of a texture and its expanded edges
+     *              that fall within a horizontal band of the atlas
+     * 
+     * @param dst   Pixel data of the band
+     * @param stride Bytes from one row of the band to the next
+     * @param band  First atlas row of the band
+     * @param rows  Number of rows in the band
+     * @param src   Texture pixel data
+     * @param rect  Destination rect of the texture
+     * @param e     Amount of pixels to expand on each edge
+     */
+    template <Expand mode>
+    void expand_blit(uint8_t* dst, std::size_t stride, int band, int rows, const uint8_t* src, const rect& rect, int e)
+    {
+        int from = std::max(mode == Expand::NONE ? 0 : -e, band - rect.y);
+        int to   = std::min(mode == Expand::NONE ? rect.h : rect.h + e, band + rows - rect.y);
+        for (int y = from; y < to; y++)
+        {
+            expand_row<mode>(
+                dst + (rect.y + y - band) * stride + rect.x * CHANNELS,
+                src + expand_index<mode>(y, rect.h) * rect.w * CHANNELS,
+                rect.w,
+                e
+            );
+        }
+    }
+
+    using expand_blit_fn = void (*)(uint8_t*, std::size_t, int, int, const uint8_t*, const rect&, int);
+
+    // indexed by Expand
+    constexpr expand_blit_fn expand_blits[] = {
+        expand_blit<Expand::CLAMP>,
+        expand_blit<Expand::WRAP>,
+        expand_blit<Expand::MIRROR>,
+        expand_blit<Expand::NONE>,
+    };
+}
+
+/**
+ * @brief               Blits a texture onto the rows of the atlas
+ *                      held by a band of pixel data
+ * 
+ * @param texture       Packed texture
+ * @param band          Pixel data of the band
+ * @param stride        Bytes from one row of the band to the next
+ * @param y             First atlas row of the band
+ * @param h             Number of rows in the band
+ */
+void atlas::blit_texture(const texture& texture, uint8_t* band, std::size_t stride, int y, int h) const
+{
+    expand_blits[static_cast<int>(texture.expand)](
+        band,
+        stride,
+        y,
+        h,
+        m_images[texture.image_index].data,
+        texture.rect,
+        m_expand
+    );
+}
+
+/**
+ * @brief               Generates atlas texture data based on packed
+ *                      rects using the buffer of pixels
+ */
+const image& atlas::generate_bitmap()
+{
+    m_bitmap = image(m_size, m_size, m_pixels);
+    composite(m_bitmap.data);
+    return m_bitmap;
+}
+
+/**
+ * @brief               Composites the packed textures into a buffer of the
+ *                      caller's, clearing the space between them
+ * 
+ * @param pixels        RGBA pixel data as large as the atlas
+ * @param stride        Bytes from one row to the next, 0 if rows are packed
+ */
+void atlas::composite(uint8_t* pixels, std::size_t stride) const
+{
+    std::size_t row = (std::size_t)m_size * CHANNELS;
+    if (stride == 0)
+        stride = row;
+    for (int y = 0; y < m_size; y++)
+        memset(pixels + y * stride, 0U, row);
+
+    for (const auto& texture : m_textures)
+        blit_texture(texture, pixels, stride, 0, m_size);
+}
+
+/**
+ * @brief               Composites the atlas one band of rows at a time
+ *                      and streams each band into the output file, so the
+ *                      full atlas is never held in memory
+ * 
+ * @param writer        Writer of the output file, sized to the atlas
+ * @param band_rows     Number of rows composited per band
+ * @return true         If every band was written and the file closed whole
+ */
+bool atlas::save_stream(row_writer& writer, int band_rows)
+{
+    // visit textures from top to bottom, keeping only the
+    // ones that overlap the current band
+    std::vector<uint32_t> order(m_textures.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+    {
+        return m_textures[a].rect.y < m_textures[b].rect.y;
+    });
+
+    std::vector<uint32_t> active;
+    std::size_t next = 0;
+
+    std::vector<uint8_t> band((std::size_t)m_size * band_rows * CHANNELS);
+
+    for (int y = 0; y < m_size; y += band_rows)
+    {
+        int h = std::min(band_rows, m_size - y);
+        memset(band.data(), 0U, (std::size_t)m_size * h * CHANNELS);
+
+        active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t i)
+        {
+            return m_textures[i].rect.y + m_textures[i].rect.h + m_expand <= y;
+        }), active.end());
+        while (next < order.size() && m_textures[order[next]].rect.y - m_expand < y + h)
+            active.push_back(order[next++]);
+
+        for (auto i : active)
+            blit_texture(m_textures[i], band.data(), (std::size_t)m_size * CHANNELS, y, h);
+
+        if (!writer.write_rows(band.data(), h))
+            return false;
+    }
+
+    return writer.finish();
+}
+
+// longest a number or an escaped character can be written
+#define JSON_NUMBER 20
+#define JSON_ESCAPE 6
+
+namespace
+{
+    // writes json into a buffer already sized for the longest output
+    struct json_cursor
+    {
+        char*       p;
+
+        void put(char c)
+        {
+            *p++ = c;
+        }
+
+        void put(std::string_view text)
+        {
+            memcpy(p, text.data(), text.size());
+            p += text.size();
+        }
+
+        void number(int64_t value)
+        {
+            p = std::to_chars(p, p + JSON_NUMBER, value).ptr;
+        }
+
+        /**
+         * @brief       Writes a quoted string, escaping quotes, backslashes
+         *              and control characters, the rest copied in runs
+         * 
+         * @param value String to quote
+         */
+        void string(std::string_view value)
+        {
+            static const char hex[] = "0123456789abcdef";
+            put('"');
+            std::size_t run = 0;
+            for (std::size_t i = 0; i < value.size(); i++)
+            {
+                unsigned char c = value[i];
+                if (c >= 0x20 && c != '"' && c != '\\')
+                    continue;
+
+                put(value.substr(run, i - run));
+                run = i + 1;
+                put('\\');
+                switch (c)
+                {
+                case '"':  put('"'); break;
+                case '\\': put('\\'); break;
+                case '\b': put('b'); break;
+                case '\f': put('f'); break;
+                case '\n': put('n'); break;
+                case '\r': put('r'); break;
+                case '\t': put('t'); break;
+                default:
+                    put("u00");
+                    put(hex[c >> 4]);
+                    put(hex[c & 15]);
+                }
+            }
+            put(value.substr(run));
+            put('"');
+        }
+    };
+
+    // text between the values, laid out with tabs or with no whitespace
+    struct json_layout
+    {
+        std::string_view begin, h, n, textures;
+        std::string_view texture, x, y, w, th, end_texture, next;
+        std::string_view end;
+    };
+
+    constexpr json_layout pretty_layout = {
+        "{\n\t\"w\": ", ",\n\t\"h\": ", ",\n\t\"n\": ", ",\n\t\"textures\": [\n",
+        "\t\t{\n\t\t\t\"n\": ", ",\n\t\t\t\"x\": ", ",\n\t\t\t\"y\": ", ",\n\t\t\t\"w\": ", ",\n\t\t\t\"h\": ", "\n\t\t}", ",\n",
+        "\n\t]\n}",
+    };
+
+    constexpr json_layout compact_layout = {
+        "{\"w\":", ",\"h\":", ",\"n\":", ",\"textures\":[",
+        "{\"n\":", ",\"x\":", ",\"y\":", ",\"w\":", ",\"h\":", "}", ",",
+        "]}",
+    };
+}
+
+/**
+ * @brief           Saves atlas data in JSON format, written into a
+ *                  single buffer sized for the longest output
+ * 
+ * @param compact   Leave out all whitespace
+ * @return          The JSON text
+ */
+std::string atlas::save_json(bool compact) const
+{
+    const json_layout& layout = compact ? compact_layout : pretty_layout;
+
+    // every name escaped at its longest
+    std::size_t names = 0;
+    for (const auto& texture : m_textures)
+        names += m_names.view(texture.name).size() * JSON_ESCAPE;
+    std::size_t per_texture = layout.texture.size() + layout.x.size() + layout.y.size() + layout.w.size() +
+        layout.th.size() + layout.end_texture.size() + layout.next.size() + 2 + 4 * JSON_NUMBER;
+
+    // cut down to what was written at the end
+    std::string out(256 + names + m_textures.size() * per_texture, '\0');
+    json_cursor cursor = { out.data() };
+
+    cursor.put(layout.begin);
+    cursor.number(m_size);
+    cursor.put(layout.h);
+    cursor.number(m_size);
+    cursor.put(layout.n);
+    cursor.number(m_textures.size());
+    cursor.put(layout.textures);
+    for (std::size_t i = 0; i < m_textures.size(); i++)
+    {
+        const auto& texture = m_textures[i];
+        const auto& rect = texture.rect;
+
+        if (i > 0)
+            cursor.put(layout.next);
+        cursor.put(layout.texture);
+        cursor.string(m_names.view(texture.name));
+        cursor.put(layout.x);
+        cursor.number(rect.x);
+        cursor.put(layout.y);
+        cursor.number(rect.y);
+        cursor.put(layout.w);
+        cursor.number(rect.w);
+        cursor.put(layout.th);
+        cursor.number(rect.h);
+        cursor.put(layout.end_texture);
+    }
+    cursor.put(layout.end);
+
+    out.resize(cursor.p - out.data());
+    return out;
+}
+
+namespace
+{
+    inline uint64_t dat_align(uint64_t offset)
+    {
+        return (offset + DAT_ALIGN - 1) / DAT_ALIGN * DAT_ALIGN;
+    }
+
+    // a texel edge as a rounded fraction of the atlas, 65535 being 1.0
+    inline uint16_t unorm16(int32_t x, int32_t size)
+    {
+        return (uint16_t)(((int64_t)x * 65535 + size / 2) / size);
+    }
+}
+
+/**
+ * @brief           Saves atlas data in binary format, fixed size
+ *                  records pointing into a pool of names, a perfect
+ *                  hash of the names and the quads of the textures,
+ *                  found through the index of sections after the header
+ * 
+ * @param out       Buffer receiving the file
+ * @param quads     How the uvs and offsets of quads are stored, if at all
+ * @return true     If the atlas could be written, false if it is too large
+ *                  for unorm16 quads or its names could not be hashed
+ */
+bool atlas::save_binary(std::vector<uint8_t>& out, Quads quads) const
+{
+    if (quads == Quads::UNORM16 && m_size > UINT16_MAX)
+        return false;
+
+    // the string table holds only the names of these textures, each
+    // once and nul ended, whatever else the pool has interned since
+    const string_pool& pool = m_names;
+    std::vector<char> strings(1, '\0');
+    std::unordered_map<name_id, uint32_t> offsets;
+    std::vector<dat_texture> records(m_textures.size());
+    std::vector<std::string_view> names(m_textures.size());
+    std::vector<uint32_t> values(m_textures.size());
+    for (std::size_t i = 0; i < m_textures.size(); i++)
+    {
+        const auto& texture = m_textures[i];
+        const auto& rect = texture.rect;
+        names[i] = pool.view(texture.name);
+        values[i] = i;
+
+        auto added = offsets.emplace(texture.name, (uint32_t)strings.size());
+        if (added.second)
+        {
+            strings.insert(strings.end(), names[i].begin(), names[i].end());
+            strings.push_back('\0');
+        }
+
+        records[i] = {
+            added.first->second,
+            (uint32_t)names[i].size(),
+            rect.x,
+            rect.y,
+            rect.w,
+            rect.h,
+            static_cast<uint32_t>(texture.expand),
+            0
+        };
+    }
+
+    // names looked up through a perfect hash, of the first
+    // texture with each name when several share one
+    perfect_hash hash;
+    if (!build_perfect_hash(names, values, hash))
+        return false;
+
+    std::vector<uint8_t> hash_tables(sizeof(dat_hash) + sizeof(uint32_t) * (hash.pilots.size() + hash.slots.size()));
+    memcpy(hash_tables.data(), &hash.header, sizeof(dat_hash));
+    memcpy(hash_tables.data() + sizeof(dat_hash), hash.pilots.data(), sizeof(uint32_t) * hash.pilots.size());
+    memcpy(hash_tables.data() + sizeof(dat_hash) + sizeof(uint32_t) * hash.pilots.size(), hash.slots.data(), sizeof(uint32_t) * hash.slots.size());
+
+    // uvs and offsets ready to copy into a buffer as they are, the
+    // unorm16 uvs land within half a 65535th of the texel edges
+    std::vector<dat_quad> quads32;
+    std::vector<dat_quad16> quads16;
+    if (quads == Quads::FLOAT)
+    {
+        quads32.resize(m_textures.size());
+        float scale = 1.0f / m_size;
+        for (std::size_t i = 0; i < m_textures.size(); i++)
+        {
+            const auto& rect = m_textures[i].rect;
+            quads32[i] = {
+                rect.x * scale,
+                rect.y * scale,
+                (rect.x + rect.w) * scale,
+                (rect.y + rect.h) * scale,
+                0.0f,
+                0.0f,
+                (float)rect.w,
+                (float)rect.h
+            };
+        }
+    }
+    else if (quads == Quads::UNORM16)
+    {
+        quads16.resize(m_textures.size());
+        for (std::size_t i = 0; i < m_textures.size(); i++)
+        {
+            const auto& rect = m_textures[i].rect;
+            quads16[i] = {
+                unorm16(rect.x, m_size),
+                unorm16(rect.y, m_size),
+                unorm16(rect.x + rect.w, m_size),
+                unorm16(rect.y + rect.h, m_size),
+                0,
+                0,
+                (uint16_t)rect.w,
+                (uint16_t)rect.h
+            };
+        }
+    }
+
+    std::vector<dat_section> sections;
+    std::vector<const void*> contents;
+    auto add_section = [&](Section type, std::size_t count, const void* data, std::size_t size)
+    {
+        sections.push_back({ static_cast<uint32_t>(type), (uint32_t)count, 0, size });
+        contents.push_back(data);
+    };
+    add_section(Section::TEXTURES, records.size(), records.data(), sizeof(dat_texture) * records.size());
+    add_section(Section::STRINGS, strings.size(), strings.data(), strings.size());
+    add_section(Section::HASH, hash.header.slots, hash_tables.data(), hash_tables.size());
+    if (quads == Quads::FLOAT)
+        add_section(Section::QUADS, quads32.size(), quads32.data(), sizeof(dat_quad) * quads32.size());
+    else if (quads == Quads::UNORM16)
+        add_section(Section::QUADS16, quads16.size(), quads16.data(), sizeof(dat_quad16) * quads16.size());
+
+    uint64_t offset = dat_align(sizeof(dat_header) + sizeof(dat_section) * sections.size());
+    for (auto& section : sections)
+    {
+        section.offset = offset;
+        offset = dat_align(offset + section.size);
+    }
+
+    dat_header header = {
+        DAT_MAGIC,
+        DAT_VERSION,
+        (uint32_t)m_size,
+        (uint32_t)m_size,
+        (uint32_t)m_textures.size(),
+        (uint32_t)sections.size(),
+        offset
+    };
+
+    // laid out in memory, padding zeroed
+    out.assign(offset, 0);
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + sizeof(header), sections.data(), sizeof(dat_section) * sections.size());
+    for (std::size_t i = 0; i < sections.size(); i++)
+        if (sections[i].size > 0)
+            memcpy(out.data() + sections[i].offset, contents[i], sections[i].size);
+    return true;
+}
+
+namespace
+{
+    const std::unordered_set<std::string_view> cpp_keywords = {
+        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case",
+        "catch", "char", "char16_t", "char32_t", "class", "compl", "const", "constexpr", "const_cast",
+        "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+        "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int",
+        "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+        "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "return", "short",
+        "signed", "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template",
+        "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename", "union",
+        "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq",
+    };
+
+    /**
+     * @brief       Turns a name into a C++ identifier, runs of anything but
+     *              letters and digits become a single underscore, and names
+     *              not starting with a letter or taken by a keyword get a prefix
+     * 
+     * @param name  Sprite or file name
+     * @return std::string 
+     */
+    std::string cpp_identifier(std::string_view name)
+    {
+        std::string id;
+        for (char c : name)
+        {
+            if (isalnum((unsigned char)c))
+                id += c;
+            else if (!id.empty() && id.back() != '_')
+                id += '_';
+        }
+        if (id.empty() || !isalpha((unsigned char)id[0]) || cpp_keywords.count(id))
+            id = "s_" + id;
+        return id;
+    }
+
+    // quoted for a C++ string literal, bytes outside printable
+    // ascii as octal escapes, which never run into what follows
+    std::string cpp_literal(std::string_view value)
+    {
+        std::string literal = "\"";
+        for (char c : value)
+        {
+            unsigned char u = c;
+            if (u == '"' || u == '\\' || u == '?')
+                literal += '\\';
+            if (u >= 0x20 && u < 0x7f)
+                literal += c;
+            else
+            {
+                char octal[5];
+                snprintf(octal, sizeof(octal), "\\%03o", u);
+                literal += octal;
+            }
+        }
+        return literal + '"';
+    }
+
+    // shortest float literal that reads back as the same float
+    std::string cpp_float(float value)
+    {
+        char digits[32];
+        snprintf(digits, sizeof(digits), "%.9g", value);
+        std::string literal = digits;
+        if (literal.find_first_of(".e") == std::string::npos)
+            literal += ".0";
+        return literal + 'f';
+    }
+}
+
+/**
+ * @brief           Saves a C++ header describing the atlas: an enum class of
+ *                  sprite IDs in packed order, constexpr tables of their rects,
+ *                  UVs and names, and a constexpr lookup from name to ID
+ * 
+ * @param space     Name of the namespace, made a valid identifier
+ * @return          The header's source
+ */
+std::string atlas::save_header(std::string_view space) const
+{
+    uint32_t count = m_textures.size();
+    std::vector<std::string> ids(count);
+    std::unordered_set<std::string> taken;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // names that end up the same are told apart by a suffix
+        std::string id = cpp_identifier(m_names.view(m_textures[i].name));
+        for (int n = 2; !taken.insert(ids[i] = id).second; n++)
+            id = cpp_identifier(m_names.view(m_textures[i].name)) + '_' + std::to_string(n);
+    }
+
+    std::vector<uint32_t> by_name(count);
+    for (uint32_t i = 0; i < count; i++)
+        by_name[i] = i;
+    std::stable_sort(by_name.begin(), by_name.end(), [this](uint32_t a, uint32_t b)
+    {
+        return m_names.view(m_textures[a].name) < m_names.view(m_textures[b].name);
+    });
+
+    std::string out;
+    out += "\n// generated by blocs__atlas, do not edit\n\n";
+    out += "#pragma once\n\n";
+    out += "#include <array>\n#include <cstdint>\n#include <optional>\n#include <string_view>\n\n";
+    out += "namespace " + cpp_identifier(space) + "\n{\n";
+    out += "    inline constexpr int32_t  width  = " + std::to_string(m_size) + ";\n";
+    out += "    inline constexpr int32_t  height = " + std::to_string(m_size) + ";\n";
+    out += "    inline constexpr uint32_t count  = " + std::to_string(count) + ";\n\n";
+
+    out += "    enum class sprite : uint32_t\n    {\n";
+    for (uint32_t i = 0; i < count; i++)
+        out += "        " + ids[i] + ",\n";
+    out += "    };\n\n";
+
+    out += "    struct sprite_rect\n    {\n";
+    out += "        int32_t     x;\n        int32_t     y;\n        int32_t     w;\n        int32_t     h;\n";
+    out += "        float       u0;             // edges in normalized texture coordinates\n";
+    out += "        float       v0;\n        float       u1;\n        float       v1;\n    };\n\n";
+
+    // std::array rather than plain arrays, which may not be
+    // empty, so an atlas of no sprites still compiles
+    out += "    // indexed by sprite\n";
+    out += "    inline constexpr std::array<sprite_rect, count> rects = {{\n";
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const auto& rect = m_textures[i].rect;
+        out += "        { " + std::to_string(rect.x) + ", " + std::to_string(rect.y) + ", " +
+            std::to_string(rect.w) + ", " + std::to_string(rect.h) + ", " +
+            cpp_float((float)rect.x / m_size) + ", " + cpp_float((float)rect.y / m_size) + ", " +
+            cpp_float((float)(rect.x + rect.w) / m_size) + ", " + cpp_float((float)(rect.y + rect.h) / m_size) + " },\n";
+    }
+    out += "    }};\n\n";
+
+    out += "    inline constexpr std::array<std::string_view, count> names = {{\n";
+    for (uint32_t i = 0; i < count; i++)
+        out += "        " + cpp_literal(m_names.view(m_textures[i].name)) + ",\n";
+    out += "    }};\n\n";
+
+    out += "    // sprites in order of their names, for the binary search of find\n";
+    out += "    inline constexpr std::array<sprite, count> sorted = {{\n";
+    for (uint32_t i = 0; i < count; i++)
+        out += "        sprite::" + ids[by_name[i]] + ",\n";
+    out += "    }};\n\n";
+
+    out += "    constexpr const sprite_rect& rect(sprite id) { return rects[static_cast<uint32_t>(id)]; }\n";
+    out += "    constexpr std::string_view name(sprite id) { return names[static_cast<uint32_t>(id)]; }\n\n";
+    out += "    constexpr std::optional<sprite> find(std::string_view key)\n    {\n";
+    out += "        uint32_t lo = 0;\n        uint32_t hi = count;\n";
+    out += "        while (lo < hi)\n        {\n";
+    out += "            uint32_t mid = lo + (hi - lo) / 2;\n";
+    out += "            if (name(sorted[mid]) < key)\n                lo = mid + 1;\n";
+    out += "            else\n                hi = mid;\n        }\n";
+    out += "        if (lo < count && name(sorted[lo]) == key)\n            return sorted[lo];\n";
+    out += "        return std::nullopt;\n    }\n";
+    out += "}\n";
+    return out;
+}
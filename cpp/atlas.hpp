@@ -0,0 +1,160 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "astc.hpp"
+#include "names.hpp"
+#include "writer.hpp"
+
+#define BAND_ROWS 64
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // image loading, unloading, saving
+    // and pixel data manipulation
+    //
+
+    struct rect;
+
+    struct image
+    {
+        name_id     name;
+        int32_t     w;
+        int32_t     h;
+        uint8_t*    data;
+        arena*      allocator;
+        
+        image(arena& allocator);
+        image(int32_t w, int32_t h, arena& allocator);
+
+        image(const image&) = delete;
+        image& operator=(const image&) = delete;
+        image(image&& other) noexcept;
+        image& operator=(image&& other) noexcept;
+
+        ~image();
+
+        bool load(const uint8_t* file, std::size_t size);
+        void unload();
+        void clear();
+        bool set_pixels(const uint8_t* data, const rect& dst);
+        bool save(row_writer& writer) const;
+        std::size_t generate_hash() const;
+    };
+
+    /**
+     * @brief           Inflates a zlib stream with the decoder images load
+     *                  with, into a buffer of the exact size it inflates to
+     *
+     * @param data      Zlib stream
+     * @param len       Length of the stream
+     * @param out       Inflated bytes
+     * @param size      Size of the output buffer
+     * @param scratch   Arena of anything the decoder allocates
+     * @return true     If the stream inflated to exactly size bytes
+     */
+    bool zlib_decode(const uint8_t* data, std::size_t len, uint8_t* out, std::size_t size, arena& scratch);
+
+    ////////////////////////////////////
+    //
+    // texture atlas generation
+    //
+
+    enum class Expand
+    {
+        CLAMP,
+        WRAP,
+        MIRROR,
+        NONE,
+    };
+
+    // how save_binary writes the uvs and offsets of each quad
+    enum class Quads
+    {
+        FLOAT,
+        UNORM16,
+        NONE,
+    };
+
+    struct rect
+    {
+        int32_t     x;
+        int32_t     y;
+        int32_t     w;
+        int32_t     h;
+    };
+
+    struct texture
+    {
+        name_id     name;
+        blocs__atlas::rect rect;
+        uint32_t    image_index;
+        Expand      expand;
+    };
+    
+    /**
+     * @brief           Packs textures into a square atlas. Each atlas owns the
+     *                  names and pixels of its textures, so several can pack
+     *                  at once, and nothing is read from or written to files
+     *                  or the console, every step returns how it went instead
+     */
+    class atlas
+    {
+    public:
+        int         m_size;
+        int         m_expand;
+        int         m_border;
+        Expand      m_expand_mode;
+        footprint   m_align;
+
+        atlas() = delete;
+        atlas(std::size_t n, int size, int expand, int border, Expand expand_mode = Expand::CLAMP);
+
+        atlas(const atlas&) = delete;
+        atlas& operator=(const atlas&) = delete;
+
+        bool add_texture(image&& image);
+        bool add_texture(image&& image, Expand expand);
+        bool add_texture(std::string_view name, const uint8_t* pixels, int w, int h, std::size_t stride = 0);
+        bool add_texture(std::string_view name, const uint8_t* pixels, int w, int h, std::size_t stride, Expand expand);
+        void align_to(const footprint& block);
+        bool pack();
+        std::vector<texture> layout() const;
+        std::string_view name(const texture& texture) const { return m_names.view(texture.name); }
+        void composite(uint8_t* pixels, std::size_t stride = 0) const;
+        std::string save_json(bool compact = false) const;
+        bool save_binary(std::vector<uint8_t>& out, Quads quads = Quads::FLOAT) const;
+        std::string save_header(std::string_view space) const;
+        const image& generate_bitmap();
+        bool save_stream(row_writer& writer, int band_rows = BAND_ROWS);
+
+        // images to add are loaded into the atlas's own pixels and named
+        // from its own pool, everything else is only there to be read
+        string_pool& names() { return m_names; }
+        arena& pixels() { return m_pixels; }
+        const string_pool& names() const { return m_names; }
+        const arena& pixels() const { return m_pixels; }
+        const std::vector<image>& images() const { return m_images; }
+        const std::vector<texture>& textures() const { return m_textures; }
+
+    private:
+        // declared before the images, so they outlive them
+        string_pool m_names;
+        arena       m_pixels;
+
+        std::vector<image>   m_images;
+        image       m_bitmap;
+
+        std::vector<texture> m_textures;
+
+        void blit_texture(const texture& texture, uint8_t* band, std::size_t stride, int y, int h) const;
+    };
+}
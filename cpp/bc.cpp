@@ -0,0 +1,638 @@
+
+#include "bc.hpp"
+#include "cpu.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#define BLOCK_PIXELS        16
+#define BLOCK_JOB           256
+#define MAX_BLOCK_PIXELS    64
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// rgb565 color endpoints
+//
+
+namespace
+{
+    struct color
+    {
+        float       r;
+        float       g;
+        float       b;
+    };
+
+    inline uint16_t pack_565(const color& c)
+    {
+        auto quantize = [](float v, int max)
+        {
+            return (int)std::lround(std::min(std::max(v, 0.0f), 255.0f) * max / 255.0f);
+        };
+        return quantize(c.r, 31) << 11 | quantize(c.g, 63) << 5 | quantize(c.b, 31);
+    }
+
+    inline color unpack_565(uint16_t v)
+    {
+        int r = v >> 11;
+        int g = (v >> 5) & 63;
+        int b = v & 31;
+        return { (float)(r << 3 | r >> 2), (float)(g << 2 | g >> 4), (float)(b << 3 | b >> 2) };
+    }
+
+    // nearest color the endpoint can hold
+    inline color snap_565(const color& c)
+    {
+        return unpack_565(pack_565(c));
+    }
+
+    /**
+     * @brief           Builds the colors a block's indices select between
+     *
+     * @param c0        First endpoint
+     * @param c1        Second endpoint
+     * @param count     4 for interpolants at thirds, 3 for a
+     *                  midpoint (the fourth index is transparent)
+     * @param palette   Palette colors
+     */
+    void build_palette(uint16_t c0, uint16_t c1, int count, color palette[4])
+    {
+        palette[0] = unpack_565(c0);
+        palette[1] = unpack_565(c1);
+        const color& a = palette[0];
+        const color& b = palette[1];
+        if (count == 4)
+        {
+            palette[2] = { std::floor((2 * a.r + b.r) / 3), std::floor((2 * a.g + b.g) / 3), std::floor((2 * a.b + b.b) / 3) };
+            palette[3] = { std::floor((a.r + 2 * b.r) / 3), std::floor((a.g + 2 * b.g) / 3), std::floor((a.b + 2 * b.b) / 3) };
+        }
+        else
+        {
+            palette[2] = { std::floor((a.r + b.r) / 2), std::floor((a.g + b.g) / 2), std::floor((a.b + b.b) / 2) };
+            palette[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        }
+    }
+}
+
+////////////////////////////////////
+//
+// color block fitting
+//
+
+namespace
+{
+    // colors of a block's pixels in structure of arrays order, weighted
+    // by how much they show, 0 for pixels left out of the fit entirely
+    struct block_colors
+    {
+        float       r[BLOCK_PIXELS];
+        float       g[BLOCK_PIXELS];
+        float       b[BLOCK_PIXELS];
+        float       weight[BLOCK_PIXELS];
+    };
+
+    struct color_fit
+    {
+        uint16_t    c0;
+        uint16_t    c1;
+        uint8_t     indices[BLOCK_PIXELS];
+        float       error;
+    };
+
+    /**
+     * @brief           Gives every pixel the index of its nearest palette
+     *                  color and sums the squared error of the weighted ones
+     */
+    float assign_scalar(const block_colors& colors, const color palette[4], int count, uint8_t* indices)
+    {
+        float error = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            float best = FLT_MAX;
+            for (int p = 0; p < count; p++)
+            {
+                float dr = colors.r[i] - palette[p].r;
+                float dg = colors.g[i] - palette[p].g;
+                float db = colors.b[i] - palette[p].b;
+                float d  = dr * dr + dg * dg + db * db;
+                if (d < best)
+                {
+                    best = d;
+                    indices[i] = p;
+                }
+            }
+            error += best * colors.weight[i];
+        }
+        return error;
+    }
+
+#if defined(BLOCS_X86)
+    TARGET("sse2") float assign_sse2(const block_colors& colors, const color palette[4], int count, uint8_t* indices)
+    {
+        __m128 error = _mm_setzero_ps();
+        for (int i = 0; i < BLOCK_PIXELS; i += 4)
+        {
+            __m128 r = _mm_loadu_ps(colors.r + i);
+            __m128 g = _mm_loadu_ps(colors.g + i);
+            __m128 b = _mm_loadu_ps(colors.b + i);
+
+            __m128  best  = _mm_set1_ps(FLT_MAX);
+            __m128i index = _mm_setzero_si128();
+            for (int p = 0; p < count; p++)
+            {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p].r));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p].g));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p].b));
+                __m128 d  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+                index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, index));
+                best  = _mm_min_ps(d, best);
+            }
+            error = _mm_add_ps(error, _mm_mul_ps(best, _mm_loadu_ps(colors.weight + i)));
+
+            int32_t lanes[4];
+            _mm_storeu_si128((__m128i*)lanes, index);
+            for (int k = 0; k < 4; k++)
+                indices[i + k] = lanes[k];
+        }
+
+        float sums[4];
+        _mm_storeu_ps(sums, error);
+        return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+#endif
+
+    using assign_fn = float (*)(const block_colors& colors, const color palette[4], int count, uint8_t* indices);
+
+    const assign_fn assign = []
+    {
+#if defined(BLOCS_X86)
+        if (cpu().sse2)
+            return assign_sse2;
+#endif
+        return assign_scalar;
+    }();
+
+    /**
+     * @brief           Finds the direction the weighted colors vary
+     *                  along most by power iteration on their covariance
+     */
+    color principal_axis(const block_colors& colors)
+    {
+        float total = 0;
+        color mean = { 0, 0, 0 };
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            float w = colors.weight[i];
+            mean.r += colors.r[i] * w;
+            mean.g += colors.g[i] * w;
+            mean.b += colors.b[i] * w;
+            total  += w;
+        }
+        mean = { mean.r / total, mean.g / total, mean.b / total };
+
+        float cov[6] = {};
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            float w  = colors.weight[i];
+            float dr = colors.r[i] - mean.r;
+            float dg = colors.g[i] - mean.g;
+            float db = colors.b[i] - mean.b;
+            cov[0] += dr * dr * w;
+            cov[1] += dr * dg * w;
+            cov[2] += dr * db * w;
+            cov[3] += dg * dg * w;
+            cov[4] += dg * db * w;
+            cov[5] += db * db * w;
+        }
+
+        // start from the row of the largest variance
+        color axis = { cov[0], cov[1], cov[2] };
+        if (cov[3] > cov[0] && cov[3] >= cov[5])
+            axis = { cov[1], cov[3], cov[4] };
+        else if (cov[5] > cov[0] && cov[5] > cov[3])
+            axis = { cov[2], cov[4], cov[5] };
+
+        for (int k = 0; k < 8; k++)
+        {
+            color next = {
+                cov[0] * axis.r + cov[1] * axis.g + cov[2] * axis.b,
+                cov[1] * axis.r + cov[3] * axis.g + cov[4] * axis.b,
+                cov[2] * axis.r + cov[4] * axis.g + cov[5] * axis.b,
+            };
+            float len = std::max({ std::fabs(next.r), std::fabs(next.g), std::fabs(next.b) });
+            if (len <= 0)
+                break;
+            axis = { next.r / len, next.g / len, next.b / len };
+        }
+        return axis;
+    }
+
+    /**
+     * @brief           Puts endpoints in the order that selects the palette
+     *                  size, c0 > c1 for 4 colors and c0 <= c1 for 3
+     */
+    void order_endpoints(color_fit& fit, int count)
+    {
+        if (count == 4 && fit.c0 < fit.c1)
+        {
+            std::swap(fit.c0, fit.c1);
+            for (auto& index : fit.indices)
+                index ^= 1;
+        }
+        else if (count == 4 && fit.c0 == fit.c1)
+        {
+            // the palette would read as 3 colors, so only use the endpoint
+            for (auto& index : fit.indices)
+                index = 0;
+        }
+        else if (count == 3 && fit.c0 > fit.c1)
+        {
+            std::swap(fit.c0, fit.c1);
+            for (auto& index : fit.indices)
+                if (index < 2)
+                    index ^= 1;
+        }
+    }
+
+    color_fit evaluate(const block_colors& colors, color a, color b, int count)
+    {
+        color_fit fit;
+        fit.c0 = pack_565(a);
+        fit.c1 = pack_565(b);
+
+        color palette[4];
+        build_palette(fit.c0, fit.c1, count, palette);
+        fit.error = assign(colors, palette, count, fit.indices);
+        return fit;
+    }
+
+    /**
+     * @brief           Uses the weighted colors furthest apart along
+     *                  the principal axis as the endpoints
+     */
+    color_fit range_fit(const block_colors& colors, const color& axis, int count)
+    {
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        int lo_index = 0, hi_index = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            if (colors.weight[i] <= 0)
+                continue;
+            float d = colors.r[i] * axis.r + colors.g[i] * axis.g + colors.b[i] * axis.b;
+            if (d < lo) { lo = d; lo_index = i; }
+            if (d > hi) { hi = d; hi_index = i; }
+        }
+
+        color a = { colors.r[hi_index], colors.g[hi_index], colors.b[hi_index] };
+        color b = { colors.r[lo_index], colors.g[lo_index], colors.b[lo_index] };
+        return evaluate(colors, a, b, count);
+    }
+
+    /**
+     * @brief           Tries every split of the colors, sorted along the principal
+     *                  axis, into count consecutive clusters mapped to the palette
+     *                  in order, solves the least squares endpoints of each split
+     *                  and keeps the one with the lowest error once snapped to 565
+     *                  (as in Simon Brown's squish)
+     */
+    color_fit cluster_fit(const block_colors& colors, const color& axis, int count)
+    {
+        // weighted pixels sorted by their projection on the axis
+        int order[BLOCK_PIXELS];
+        float dots[BLOCK_PIXELS];
+        int n = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            if (colors.weight[i] <= 0)
+                continue;
+            dots[i] = colors.r[i] * axis.r + colors.g[i] * axis.g + colors.b[i] * axis.b;
+            order[n++] = i;
+        }
+        std::sort(order, order + n, [&](int a, int b) { return dots[a] < dots[b]; });
+
+        // prefix sums of the weighted colors and of the weights,
+        // so every cluster's sum is a subtraction
+        color sums[BLOCK_PIXELS + 1] = {};
+        float weights[BLOCK_PIXELS + 1] = {};
+        for (int i = 0; i < n; i++)
+        {
+            int p = order[i];
+            float w = colors.weight[p];
+            sums[i + 1] = { sums[i].r + colors.r[p] * w, sums[i].g + colors.g[p] * w, sums[i].b + colors.b[p] * w };
+            weights[i + 1] = weights[i] + w;
+        }
+        auto span = [&](int begin, int end)
+        {
+            return color { sums[end].r - sums[begin].r, sums[end].g - sums[begin].g, sums[end].b - sums[begin].b };
+        };
+
+        // weight of the first endpoint in each palette entry
+        const float thirds[4] = { 1.0f, 2.0f / 3.0f, 1.0f / 3.0f, 0.0f };
+        const float halves[4] = { 1.0f, 0.5f, 0.0f, 0.0f };
+        const float* alpha = count == 4 ? thirds : halves;
+
+        float best_error = FLT_MAX;
+        color best_a = {}, best_b = {};
+        for (int i = 0; i <= n; i++)
+        for (int j = i; j <= n; j++)
+        for (int k = count == 4 ? j : n; k <= n; k++)
+        {
+            // with 3 clusters the last bound stays at n
+            int   bounds[5] = { 0, i, j, k, n };
+            float aa = 0, bb = 0, ab = 0;
+            color ax = {}, bx = {};
+            for (int c = 0; c < count; c++)
+            {
+                int begin = bounds[c], end = bounds[c + 1];
+                if (end <= begin)
+                    continue;
+                float cluster = weights[end] - weights[begin];
+                float wa = alpha[c], wb = 1.0f - alpha[c];
+                color s  = span(begin, end);
+                aa += wa * wa * cluster;
+                bb += wb * wb * cluster;
+                ab += wa * wb * cluster;
+                ax = { ax.r + wa * s.r, ax.g + wa * s.g, ax.b + wa * s.b };
+                bx = { bx.r + wb * s.r, bx.g + wb * s.g, bx.b + wb * s.b };
+            }
+
+            float det = aa * bb - ab * ab;
+            if (std::fabs(det) < 1e-6f)
+                continue;
+            float f = 1.0f / det;
+            color a = snap_565({ (ax.r * bb - bx.r * ab) * f, (ax.g * bb - bx.g * ab) * f, (ax.b * bb - bx.b * ab) * f });
+            color b = snap_565({ (bx.r * aa - ax.r * ab) * f, (bx.g * aa - ax.g * ab) * f, (bx.b * aa - ax.b * ab) * f });
+
+            // squared error of the split less the constant sum of x^2
+            float error =
+                (a.r * a.r + a.g * a.g + a.b * a.b) * aa +
+                (b.r * b.r + b.g * b.g + b.b * b.b) * bb +
+                2 * (a.r * b.r + a.g * b.g + a.b * b.b) * ab -
+                2 * (a.r * ax.r + a.g * ax.g + a.b * ax.b) -
+                2 * (b.r * bx.r + b.g * bx.g + b.b * bx.b);
+            if (error < best_error)
+            {
+                best_error = error;
+                best_a = a;
+                best_b = b;
+            }
+        }
+
+        color_fit fit = range_fit(colors, axis, count);
+        if (best_error < FLT_MAX)
+        {
+            color_fit clustered = evaluate(colors, best_a, best_b, count);
+            if (clustered.error < fit.error)
+                fit = clustered;
+        }
+        return fit;
+    }
+
+    /**
+     * @brief           Encodes the color half of a block
+     *
+     * @param pixels    16 RGBA pixels
+     * @param out       8 bytes of endpoints and 2 bit indices
+     * @param fit       Endpoint fitting method
+     * @param punch     Whether pixels with alpha below 128 become the
+     *                  transparent fourth palette entry (BC1 only),
+     *                  otherwise colors count as much as they show,
+     *                  weighted by their alpha
+     */
+    void encode_colors(const uint8_t* pixels, uint8_t* out, Fit fit, bool punch)
+    {
+        block_colors colors;
+        int  first = -1;
+        bool solid = true;
+        bool transparent = false;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            const uint8_t* p = pixels + i * CHANNELS;
+            colors.r[i] = p[0];
+            colors.g[i] = p[1];
+            colors.b[i] = p[2];
+            if (punch)
+                colors.weight[i] = p[3] < 128 ? 0.0f : 1.0f;
+            else
+                colors.weight[i] = p[3] / 255.0f;
+            if (colors.weight[i] <= 0)
+            {
+                transparent = punch;
+                continue;
+            }
+
+            if (first < 0)
+                first = i;
+            else if (memcmp(p, pixels + first * CHANNELS, 3) != 0)
+                solid = false;
+        }
+
+        color_fit result;
+        int count = transparent ? 3 : 4;
+        if (first < 0)
+        {
+            result.c0 = result.c1 = 0;
+            memset(result.indices, 3, sizeof(result.indices));
+        }
+        else
+        {
+            color axis = principal_axis(colors);
+            color c = { colors.r[first], colors.g[first], colors.b[first] };
+            if (solid)
+                result = evaluate(colors, c, c, count);
+            else if (fit == Fit::CLUSTER)
+                result = cluster_fit(colors, axis, count);
+            else
+                result = range_fit(colors, axis, count);
+
+            order_endpoints(result, count);
+            for (int i = 0; i < BLOCK_PIXELS; i++)
+                if (punch && colors.weight[i] <= 0)
+                    result.indices[i] = 3;
+        }
+
+        uint32_t bits = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+            bits |= (uint32_t)result.indices[i] << (i * 2);
+
+        out[0] = result.c0;
+        out[1] = result.c0 >> 8;
+        out[2] = result.c1;
+        out[3] = result.c1 >> 8;
+        out[4] = bits;
+        out[5] = bits >> 8;
+        out[6] = bits >> 16;
+        out[7] = bits >> 24;
+    }
+}
+
+////////////////////////////////////
+//
+// alpha block fitting
+//
+
+namespace
+{
+    /**
+     * @brief           Picks each alpha's nearest of the 8 values
+     *                  and returns the sum of squared errors
+     */
+    int assign_alpha(const uint8_t* alphas, const int values[8], uint8_t* indices)
+    {
+        int error = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            int best = INT32_MAX;
+            for (int v = 0; v < 8; v++)
+            {
+                int d = (alphas[i] - values[v]) * (alphas[i] - values[v]);
+                if (d < best)
+                {
+                    best = d;
+                    indices[i] = v;
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+    /**
+     * @brief           Encodes the alpha half of a BC3 block, trying both the
+     *                  8 value palette and the 6 value palette with explicit
+     *                  0 and 255, and keeping whichever fits closer
+     *
+     * @param pixels    16 RGBA pixels
+     * @param out       8 bytes of endpoints and 3 bit indices
+     */
+    void encode_alpha(const uint8_t* pixels, uint8_t* out)
+    {
+        uint8_t alphas[BLOCK_PIXELS];
+        int lo = 255, hi = 0, inner_lo = 255, inner_hi = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            int a = alphas[i] = pixels[i * CHANNELS + 3];
+            lo = std::min(lo, a);
+            hi = std::max(hi, a);
+            if (a != 0 && a != 255)
+            {
+                inner_lo = std::min(inner_lo, a);
+                inner_hi = std::max(inner_hi, a);
+            }
+        }
+
+        // a0 > a1 interpolates 6 values between them
+        int values[8] = { hi, lo };
+        for (int i = 1; i < 7; i++)
+            values[i + 1] = ((7 - i) * hi + i * lo + 3) / 7;
+        uint8_t indices[BLOCK_PIXELS];
+        int error = assign_alpha(alphas, values, indices);
+        int a0 = hi, a1 = lo;
+
+        // a0 <= a1 interpolates 4 and adds 0 and 255
+        if (inner_lo > inner_hi)
+            inner_lo = inner_hi = lo == 0 ? 255 : 0;
+        int six[8] = { inner_lo, inner_hi, 0, 0, 0, 0, 0, 255 };
+        for (int i = 1; i < 5; i++)
+            six[i + 1] = ((5 - i) * inner_lo + i * inner_hi + 2) / 5;
+        uint8_t six_indices[BLOCK_PIXELS];
+        if (error > 0 && assign_alpha(alphas, six, six_indices) < error)
+        {
+            a0 = inner_lo;
+            a1 = inner_hi;
+            memcpy(indices, six_indices, sizeof(indices));
+        }
+        else if (hi == lo)
+            memset(indices, 0, sizeof(indices));
+
+        uint64_t bits = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+            bits |= (uint64_t)indices[i] << (i * 3);
+
+        out[0] = a0;
+        out[1] = a1;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = bits >> (i * 8);
+    }
+}
+
+////////////////////////////////////
+//
+// block encoding
+//
+
+std::size_t blocs__atlas::block_bytes(Format format)
+{
+    switch (format)
+    {
+    case Format::BC1: return 8;
+    case Format::BC3: return 16;
+    case Format::BC7: return 16;
+    case Format::ETC2: return 16;
+    case Format::ASTC: return 16;
+    default:   return 0;
+    }
+}
+
+footprint blocs__atlas::block_footprint(Format format, const bc_options& options)
+{
+    return format == Format::ASTC ? options.astc : footprint{};
+}
+
+void blocs__atlas::encode_bc1(const uint8_t* pixels, uint8_t* out, Fit fit)
+{
+    encode_colors(pixels, out, fit, true);
+}
+
+void blocs__atlas::encode_bc3(const uint8_t* pixels, uint8_t* out, Fit fit)
+{
+    encode_alpha(pixels, out);
+    encode_colors(pixels, out + 8, fit, false);
+}
+
+void blocs__atlas::encode_blocks(Format format, const uint8_t* pixels, int w, int rows, uint8_t* out, const bc_options& options)
+{
+    footprint size = block_footprint(format, options);
+    int columns = (w + size.w - 1) / size.w;
+    int blocks  = columns * ((rows + size.h - 1) / size.h);
+    std::size_t bytes = block_bytes(format);
+
+    int jobs = (blocks + BLOCK_JOB - 1) / BLOCK_JOB;
+    parallel_for(jobs, options.threads, [&](int job, int)
+    {
+        int end = std::min(blocks, (job + 1) * BLOCK_JOB);
+        for (int i = job * BLOCK_JOB; i < end; i++)
+        {
+            int bx = (i % columns) * size.w;
+            int by = (i / columns) * size.h;
+
+            // pixels past the right and bottom edges repeat the last ones
+            uint8_t block[MAX_BLOCK_PIXELS * CHANNELS];
+            for (int y = 0; y < size.h; y++)
+            for (int x = 0; x < size.w; x++)
+            {
+                int sx = std::min(bx + x, w - 1);
+                int sy = std::min(by + y, rows - 1);
+                memcpy(block + (y * size.w + x) * CHANNELS, pixels + ((std::size_t)sy * w + sx) * CHANNELS, CHANNELS);
+            }
+
+            if (format == Format::BC1)
+                encode_bc1(block, out + i * bytes, options.fit);
+            else if (format == Format::BC3)
+                encode_bc3(block, out + i * bytes, options.fit);
+            else if (format == Format::BC7)
+                encode_bc7(block, out + i * bytes, options.quality);
+            else if (format == Format::ETC2)
+                encode_etc2(block, out + i * bytes, options.effort);
+            else
+                encode_astc(block, size, out + i * bytes, options.astc_quality);
+        }
+    });
+}
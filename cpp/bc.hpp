@@ -0,0 +1,108 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "astc.hpp"
+#include "etc.hpp"
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // bc1, bc3 (dxt1 and dxt5) and bc7
+    // compression of 4x4 pixel blocks
+    //
+
+    // how color endpoints are chosen, RANGE takes the extremes along the
+    // principal axis of the block's colors, CLUSTER searches every ordered
+    // split of the colors along that axis for the least squares best fit
+    enum class Fit
+    {
+        RANGE,
+        CLUSTER,
+    };
+
+    // how hard the bc7 encoder searches, FAST only uses mode 6, NORMAL adds
+    // modes 4 and 5 and the likeliest partitions of the 2 subset modes, FULL
+    // tries every mode, rotation and partition, the astc encoder's presets
+    // widen its search in the same steps
+    enum class Quality
+    {
+        FAST,
+        NORMAL,
+        FULL,
+    };
+
+    struct bc_options
+    {
+        Fit         fit     = Fit::RANGE;
+        Quality     quality = Quality::NORMAL;
+        Effort      effort  = Effort::FAST;
+        footprint   astc;
+        Quality     astc_quality = Quality::NORMAL;
+        int         threads = 1;
+    };
+
+    /**
+     * @brief           Gets the number of bytes one 4x4 block encodes to
+     *
+     * @param format    Block compressed format
+     * @return std::size_t 0 if the format is not block compressed
+     */
+    std::size_t block_bytes(Format format);
+
+    /**
+     * @brief           Gets the pixels one block covers, 4x4 for
+     *                  all but astc, which is set in the options
+     *
+     * @param format    Block compressed format
+     * @param options   Options holding the astc footprint
+     * @return footprint
+     */
+    footprint block_footprint(Format format, const bc_options& options);
+
+    /**
+     * @brief           Encodes 16 RGBA pixels (row major) as a BC1 block,
+     *                  pixels with alpha below 128 become transparent
+     *
+     * @param pixels    Pixels of the block
+     * @param out       8 byte block
+     * @param fit       Endpoint fitting method
+     */
+    void encode_bc1(const uint8_t* pixels, uint8_t* out, Fit fit);
+
+    /**
+     * @brief           Encodes 16 RGBA pixels (row major) as a BC3 block
+     *
+     * @param pixels    Pixels of the block
+     * @param out       16 byte block
+     * @param fit       Endpoint fitting method
+     */
+    void encode_bc3(const uint8_t* pixels, uint8_t* out, Fit fit);
+
+    /**
+     * @brief           Encodes 16 RGBA pixels (row major) as a BC7 block
+     *
+     * @param pixels    Pixels of the block
+     * @param out       16 byte block
+     * @param quality   How many modes and partitions are searched
+     */
+    void encode_bc7(const uint8_t* pixels, uint8_t* out, Quality quality);
+
+    /**
+     * @brief           Encodes rows of an image as a row of blocks, in
+     *                  parallel across blocks, clamping at the image edges
+     *
+     * @param format    Block compressed format
+     * @param pixels    RGBA pixels of the rows
+     * @param w         Image width
+     * @param rows      Number of rows
+     * @param out       Blocks, left to right then top to bottom
+     * @param options   Endpoint fitting method, bc7 and astc quality, etc2
+     *                  effort, astc footprint and thread count
+     */
+    void encode_blocks(Format format, const uint8_t* pixels, int w, int rows, uint8_t* out, const bc_options& options);
+}
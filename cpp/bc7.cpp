@@ -0,0 +1,784 @@
+
+#include "bc.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#define BLOCK_PIXELS    16
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// bc7 mode and partition tables
+//
+
+namespace
+{
+    struct mode_info
+    {
+        int         subsets;
+        int         partition_bits;
+        int         rotation_bits;
+        int         selector_bits;
+        int         color_bits;
+        int         alpha_bits;
+        int         pbits;          // 0 none, 1 shared per subset, 2 per endpoint
+        int         index_bits;
+        int         alpha_index_bits;
+    };
+
+    const mode_info modes[8] = {
+        { 3, 4, 0, 0, 4, 0, 2, 3, 0 },
+        { 2, 6, 0, 0, 6, 0, 1, 3, 0 },
+        { 3, 6, 0, 0, 5, 0, 0, 2, 0 },
+        { 2, 6, 0, 0, 7, 0, 2, 2, 0 },
+        { 1, 0, 2, 1, 5, 6, 0, 2, 3 },
+        { 1, 0, 2, 0, 7, 8, 0, 2, 2 },
+        { 1, 0, 0, 0, 7, 7, 2, 4, 0 },
+        { 2, 6, 0, 0, 5, 5, 2, 2, 0 },
+    };
+
+    // bit i is the subset of pixel i
+    const uint16_t partitions2[64] = {
+        0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+        0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+        0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+        0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+        0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+        0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+        0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+        0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+    };
+
+    // bits 2i and 2i+1 are the subset of pixel i
+    const uint32_t partitions3[64] = {
+        0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+        0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+        0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+        0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+        0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+        0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+        0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+        0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+    };
+
+    // pixel of each subset after the first whose index drops its top bit
+    const uint8_t anchors2[64] = {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+        15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+         6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+    };
+
+    const uint8_t anchors3[2][64] = {
+        {
+             3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+             3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+             8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+             3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+        },
+        {
+            15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+            15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+            15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+            15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+        },
+    };
+
+    const uint8_t weights2[4]  = { 0, 21, 43, 64 };
+    const uint8_t weights3[8]  = { 0, 9, 18, 27, 37, 46, 55, 64 };
+    const uint8_t weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    inline const uint8_t* weights(int bits)
+    {
+        return bits == 2 ? weights2 : bits == 3 ? weights3 : weights4;
+    }
+
+    inline int subset_of(int subsets, int partition, int pixel)
+    {
+        if (subsets == 2)
+            return (partitions2[partition] >> pixel) & 1;
+        if (subsets == 3)
+            return (partitions3[partition] >> (pixel * 2)) & 3;
+        return 0;
+    }
+
+    inline int anchor_of(int subsets, int partition, int subset)
+    {
+        if (subset == 0)
+            return 0;
+        if (subsets == 2)
+            return anchors2[partition];
+        return anchors3[subset - 1][partition];
+    }
+}
+
+////////////////////////////////////
+//
+// endpoint quantization
+//
+
+namespace
+{
+    // channel values of up to 16 pixels in structure of arrays order
+    struct pixel_set
+    {
+        float       c[4][BLOCK_PIXELS];
+        int         count;
+    };
+
+    // quantized endpoints of one subset, codes hold the
+    // channel bits without the p-bit
+    struct endpoints
+    {
+        int         code[2][4];
+        int         pbit[2];
+    };
+
+    inline int expand(int code, int pbit, int bits, bool has_pbit)
+    {
+        int v = has_pbit ? code << 1 | pbit : code;
+        int n = has_pbit ? bits + 1 : bits;
+        return n >= 8 ? v : v << (8 - n) | v >> (2 * n - 8);
+    }
+
+    /**
+     * @brief           Finds the code whose expansion with a
+     *                  given p-bit lands nearest to a value
+     */
+    inline int quantize(float value, int pbit, int bits, bool has_pbit, float& error)
+    {
+        int n = has_pbit ? bits + 1 : bits;
+        int max = (1 << bits) - 1;
+        int guess = (int)std::lround(std::min(std::max(value, 0.0f), 255.0f) * ((1 << n) - 1) / 255.0f);
+        if (has_pbit)
+            guess >>= 1;
+
+        int best = 0;
+        error = FLT_MAX;
+        for (int code = std::max(guess - 1, 0); code <= std::min(guess + 1, max); code++)
+        {
+            float d = expand(code, pbit, bits, has_pbit) - value;
+            if (d * d < error)
+            {
+                error = d * d;
+                best = code;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief           Quantizes a pair of endpoints for a mode, trying
+     *                  every p-bit combination the mode allows
+     *
+     * @param e         Unquantized endpoints
+     * @param mode      Mode layout
+     * @param channels  3 for rgb, 4 for rgba
+     * @param q         Quantized endpoints
+     */
+    void quantize_endpoints(const float e[2][4], const mode_info& mode, int channels, endpoints& q)
+    {
+        bool has_pbit = mode.pbits != 0;
+        int combos = mode.pbits == 2 ? 4 : mode.pbits == 1 ? 2 : 1;
+
+        // only a p-bit of 1 reaches alpha 255 and only 0 reaches alpha 0,
+        // so opaque and clear endpoints keep theirs however the colors
+        // would rather round, or opaque sprites decode as 254
+        int exact[2] = { -1, -1 };
+        if (channels == 4 && has_pbit)
+            for (int i = 0; i < 2; i++)
+                exact[i] = e[i][3] >= 254.5f ? 1 : e[i][3] <= 0.5f ? 0 : -1;
+
+        float best = FLT_MAX;
+        for (int pass = 0; pass < 2 && best == FLT_MAX; pass++)
+        for (int combo = 0; combo < combos; combo++)
+        {
+            endpoints candidate = {};
+            candidate.pbit[0] = combo & 1;
+            candidate.pbit[1] = mode.pbits == 2 ? combo >> 1 : combo & 1;
+
+            // a shared p-bit may not suit both, then any is taken
+            if (pass == 0 && ((exact[0] >= 0 && candidate.pbit[0] != exact[0]) ||
+                              (exact[1] >= 0 && candidate.pbit[1] != exact[1])))
+                continue;
+
+            float total = 0;
+            for (int i = 0; i < 2; i++)
+            for (int c = 0; c < 4; c++)
+            {
+                if (c >= channels)
+                {
+                    candidate.code[i][c] = (1 << mode.color_bits) - 1;
+                    continue;
+                }
+                int bits = c == 3 && mode.alpha_bits ? mode.alpha_bits : mode.color_bits;
+                float error;
+                candidate.code[i][c] = quantize(e[i][c], candidate.pbit[i], bits, has_pbit, error);
+                total += error;
+            }
+
+            if (total < best)
+            {
+                best = total;
+                q = candidate;
+            }
+        }
+    }
+
+    inline void expand_endpoints(const endpoints& q, const mode_info& mode, int channels, int out[2][4])
+    {
+        for (int i = 0; i < 2; i++)
+        for (int c = 0; c < 4; c++)
+        {
+            int bits = c == 3 && mode.alpha_bits ? mode.alpha_bits : mode.color_bits;
+            out[i][c] = c < channels ? expand(q.code[i][c], q.pbit[i], bits, mode.pbits != 0) : 255;
+        }
+    }
+}
+
+////////////////////////////////////
+//
+// index assignment, vectorized over
+// 4 pixels when sse2 is available
+//
+
+namespace
+{
+    using assign_fn = float (*)(const pixel_set& set, const float palette[16][4], int count, int channels, uint8_t* indices);
+
+    float assign_scalar(const pixel_set& set, const float palette[16][4], int count, int channels, uint8_t* indices)
+    {
+        float error = 0;
+        for (int i = 0; i < set.count; i++)
+        {
+            float best = FLT_MAX;
+            for (int p = 0; p < count; p++)
+            {
+                float d = 0;
+                for (int c = 0; c < channels; c++)
+                    d += (set.c[c][i] - palette[p][c]) * (set.c[c][i] - palette[p][c]);
+                if (d < best)
+                {
+                    best = d;
+                    indices[i] = p;
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+#if defined(BLOCS_X86)
+    TARGET("sse2") float assign_sse2(const pixel_set& set, const float palette[16][4], int count, int channels, uint8_t* indices)
+    {
+        float error = 0;
+        for (int i = 0; i < set.count; i += 4)
+        {
+            __m128 v[4];
+            for (int c = 0; c < 4; c++)
+                v[c] = _mm_loadu_ps(set.c[c] + i);
+
+            __m128  best  = _mm_set1_ps(FLT_MAX);
+            __m128i index = _mm_setzero_si128();
+            for (int p = 0; p < count; p++)
+            {
+                __m128 d = _mm_setzero_ps();
+                for (int c = 0; c < channels; c++)
+                {
+                    __m128 diff = _mm_sub_ps(v[c], _mm_set1_ps(palette[p][c]));
+                    d = _mm_add_ps(d, _mm_mul_ps(diff, diff));
+                }
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+                index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, index));
+                best  = _mm_min_ps(d, best);
+            }
+
+            float   errors[4];
+            int32_t lanes[4];
+            _mm_storeu_ps(errors, best);
+            _mm_storeu_si128((__m128i*)lanes, index);
+            for (int k = 0; k < 4 && i + k < set.count; k++)
+            {
+                indices[i + k] = lanes[k];
+                error += errors[k];
+            }
+        }
+        return error;
+    }
+#endif
+
+    const assign_fn assign = []
+    {
+#if defined(BLOCS_X86)
+        if (cpu().sse2)
+            return assign_sse2;
+#endif
+        return assign_scalar;
+    }();
+}
+
+////////////////////////////////////
+//
+// subset fitting
+//
+
+namespace
+{
+    struct subset_fit
+    {
+        endpoints   q;
+        uint8_t     indices[BLOCK_PIXELS];
+        float       error;
+    };
+
+    /**
+     * @brief           Finds the mean and the direction the pixels vary
+     *                  along most, returns the variance left off that line
+     */
+    float principal_line(const pixel_set& set, int channels, float mean[4], float axis[4])
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            mean[c] = 0;
+            for (int i = 0; i < set.count; i++)
+                mean[c] += set.c[c][i];
+            mean[c] /= set.count;
+        }
+
+        float cov[4][4] = {};
+        for (int i = 0; i < set.count; i++)
+        for (int a = 0; a < channels; a++)
+        for (int b = a; b < channels; b++)
+            cov[a][b] += (set.c[a][i] - mean[a]) * (set.c[b][i] - mean[b]);
+
+        float trace = 0;
+        for (int a = 0; a < channels; a++)
+        {
+            trace += cov[a][a];
+            for (int b = 0; b < a; b++)
+                cov[a][b] = cov[b][a];
+        }
+
+        for (int c = 0; c < 4; c++)
+            axis[c] = c < channels ? 1.0f : 0.0f;
+        float eigen = 0;
+        for (int k = 0; k < 6; k++)
+        {
+            float next[4] = {};
+            for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                next[a] += cov[a][b] * axis[b];
+
+            float len = 0;
+            for (int c = 0; c < channels; c++)
+                len += next[c] * next[c];
+            if (len <= 0)
+                break;
+            len = std::sqrt(len);
+            for (int c = 0; c < channels; c++)
+                axis[c] = next[c] / len;
+            eigen = len;
+        }
+        return std::max(trace - eigen, 0.0f);
+    }
+
+    float evaluate(const pixel_set& set, const mode_info& mode, int channels, int index_bits, subset_fit& fit)
+    {
+        int e[2][4];
+        expand_endpoints(fit.q, mode, channels, e);
+
+        const uint8_t* w = weights(index_bits);
+        int count = 1 << index_bits;
+        float palette[16][4];
+        for (int p = 0; p < count; p++)
+        for (int c = 0; c < 4; c++)
+            palette[p][c] = (float)(((64 - w[p]) * e[0][c] + w[p] * e[1][c] + 32) >> 6);
+
+        fit.error = assign(set, palette, count, channels, fit.indices);
+        return fit.error;
+    }
+
+    /**
+     * @brief           Fits quantized endpoints and indices to a set of pixels,
+     *                  starting from the extent of the pixels along their principal
+     *                  axis and then refining the endpoints by least squares
+     *
+     * @param set       Pixels of the subset
+     * @param mode      Mode layout
+     * @param channels  3 for rgb, 4 for rgba
+     * @param index_bits Bits per index
+     * @param iterations Rounds of least squares refinement
+     * @return subset_fit
+     */
+    subset_fit fit_subset(const pixel_set& set, const mode_info& mode, int channels, int index_bits, int iterations)
+    {
+        float mean[4], axis[4];
+        principal_line(set, channels, mean, axis);
+
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (int i = 0; i < set.count; i++)
+        {
+            float t = 0;
+            for (int c = 0; c < channels; c++)
+                t += (set.c[c][i] - mean[c]) * axis[c];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+
+        float e[2][4];
+        for (int c = 0; c < 4; c++)
+        {
+            e[0][c] = mean[c] + axis[c] * lo;
+            e[1][c] = mean[c] + axis[c] * hi;
+        }
+
+        subset_fit best;
+        quantize_endpoints(e, mode, channels, best.q);
+        evaluate(set, mode, channels, index_bits, best);
+
+        const uint8_t* w = weights(index_bits);
+        for (int k = 0; k < iterations && best.error > 0; k++)
+        {
+            // least squares endpoints for the current indices
+            float aa = 0, ab = 0, bb = 0, ax[4] = {}, bx[4] = {};
+            for (int i = 0; i < set.count; i++)
+            {
+                float t = w[best.indices[i]] / 64.0f, s = 1.0f - t;
+                aa += s * s;
+                ab += s * t;
+                bb += t * t;
+                for (int c = 0; c < channels; c++)
+                {
+                    ax[c] += s * set.c[c][i];
+                    bx[c] += t * set.c[c][i];
+                }
+            }
+
+            float det = aa * bb - ab * ab;
+            if (std::fabs(det) < 1e-6f)
+                break;
+            for (int c = 0; c < channels; c++)
+            {
+                e[0][c] = (ax[c] * bb - bx[c] * ab) / det;
+                e[1][c] = (bx[c] * aa - ax[c] * ab) / det;
+            }
+
+            subset_fit refined;
+            quantize_endpoints(e, mode, channels, refined.q);
+            if (evaluate(set, mode, channels, index_bits, refined) >= best.error)
+                break;
+            best = refined;
+        }
+        return best;
+    }
+
+    /**
+     * @brief           Swaps a subset's endpoints when its anchor pixel's
+     *                  index has the top bit set, which cannot be stored
+     */
+    void fix_anchor(subset_fit& fit, int anchor, int index_bits, int channels_begin, int channels_end)
+    {
+        int max = (1 << index_bits) - 1;
+        if (fit.indices[anchor] <= max >> 1)
+            return;
+        for (int c = channels_begin; c < channels_end; c++)
+            std::swap(fit.q.code[0][c], fit.q.code[1][c]);
+        std::swap(fit.q.pbit[0], fit.q.pbit[1]);
+        for (auto& index : fit.indices)
+            index = max - index;
+    }
+}
+
+////////////////////////////////////
+//
+// block encoding
+//
+
+namespace
+{
+    struct block_pixels
+    {
+        float       c[4][BLOCK_PIXELS];
+        bool        opaque;
+    };
+
+    struct bit_writer
+    {
+        uint8_t*    out;
+        int         pos;
+
+        void put(uint32_t value, int bits)
+        {
+            for (int i = 0; i < bits; i++, pos++)
+                out[pos >> 3] |= ((value >> i) & 1) << (pos & 7);
+        }
+    };
+
+    // a candidate encoding of the whole block
+    struct block_fit
+    {
+        int         mode;
+        int         partition;
+        int         rotation;
+        int         selector;
+        subset_fit  subsets[3];
+        subset_fit  alpha;
+        float       error;
+    };
+
+    /**
+     * @brief           Gathers the pixels of one subset of a partition
+     *
+     * @param members   Receives the block position of each gathered pixel
+     */
+    void gather(const block_pixels& block, int subsets, int partition, int subset, int rotation, pixel_set& set, int* members)
+    {
+        set.count = 0;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            if (subset_of(subsets, partition, i) != subset)
+                continue;
+            for (int c = 0; c < 4; c++)
+            {
+                // rotation swaps alpha with one of the colors
+                int from = rotation && (c == 3 || c == rotation - 1) ? (c == 3 ? rotation - 1 : 3) : c;
+                set.c[c][set.count] = block.c[from][i];
+            }
+            members[set.count++] = i;
+        }
+    }
+
+    /**
+     * @brief           Scores a partition by the variance of its subsets
+     *                  off their principal lines, before any quantization
+     */
+    float estimate_partition(const block_pixels& block, int subsets, int partition, int channels)
+    {
+        float total = 0;
+        for (int s = 0; s < subsets; s++)
+        {
+            pixel_set set;
+            int members[BLOCK_PIXELS];
+            gather(block, subsets, partition, s, 0, set, members);
+            if (set.count == 0)
+                continue;
+            float mean[4], axis[4];
+            total += principal_line(set, channels, mean, axis);
+        }
+        return total;
+    }
+
+    /**
+     * @brief           Encodes a block with one of the modes sharing one
+     *                  set of indices between color and alpha (0-3, 6, 7)
+     */
+    block_fit fit_shared(const block_pixels& block, int m, int partition, int iterations)
+    {
+        const mode_info& mode = modes[m];
+        int channels = mode.alpha_bits ? 4 : 3;
+
+        block_fit fit = {};
+        fit.mode = m;
+        fit.partition = partition;
+        for (int s = 0; s < mode.subsets; s++)
+        {
+            pixel_set set;
+            int members[BLOCK_PIXELS];
+            gather(block, mode.subsets, partition, s, 0, set, members);
+
+            subset_fit local = fit_subset(set, mode, channels, mode.index_bits, iterations);
+
+            // scatter indices back to block positions
+            subset_fit& dst = fit.subsets[s];
+            dst.q = local.q;
+            dst.error = local.error;
+            memset(dst.indices, 0, sizeof(dst.indices));
+            for (int i = 0; i < set.count; i++)
+                dst.indices[members[i]] = local.indices[i];
+
+            // pixels outside the subset count as 0 so never trip the anchor swap
+            subset_fit anchor = dst;
+            for (int i = 0; i < BLOCK_PIXELS; i++)
+                if (subset_of(mode.subsets, partition, i) != s)
+                    anchor.indices[i] = 0;
+            fix_anchor(anchor, anchor_of(mode.subsets, partition, s), mode.index_bits, 0, 4);
+            for (int i = 0; i < BLOCK_PIXELS; i++)
+                if (subset_of(mode.subsets, partition, i) == s)
+                    dst.indices[i] = anchor.indices[i];
+            dst.q = anchor.q;
+
+            fit.error += local.error;
+        }
+        return fit;
+    }
+
+    /**
+     * @brief           Encodes a block with mode 4 or 5, which have
+     *                  separate indices for color and alpha
+     */
+    block_fit fit_separate(const block_pixels& block, int m, int rotation, int selector, int iterations)
+    {
+        const mode_info& mode = modes[m];
+        int color_bits = selector ? mode.alpha_index_bits : mode.index_bits;
+        int alpha_bits = selector ? mode.index_bits : mode.alpha_index_bits;
+
+        pixel_set set;
+        int members[BLOCK_PIXELS];
+        gather(block, 1, 0, 0, rotation, set, members);
+
+        block_fit fit = {};
+        fit.mode = m;
+        fit.rotation = rotation;
+        fit.selector = selector;
+        fit.subsets[0] = fit_subset(set, mode, 3, color_bits, iterations);
+
+        // alpha fitted on its own as a single channel
+        pixel_set alpha;
+        alpha.count = BLOCK_PIXELS;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            alpha.c[0][i] = set.c[3][i];
+            alpha.c[1][i] = alpha.c[2][i] = alpha.c[3][i] = 0;
+        }
+        mode_info alpha_mode = mode;
+        alpha_mode.color_bits = mode.alpha_bits;
+        fit.alpha = fit_subset(alpha, alpha_mode, 1, alpha_bits, iterations);
+
+        fix_anchor(fit.subsets[0], 0, color_bits, 0, 3);
+        fix_anchor(fit.alpha, 0, alpha_bits, 0, 1);
+        fit.error = fit.subsets[0].error + fit.alpha.error;
+        return fit;
+    }
+
+    void write_block(const block_fit& fit, uint8_t* out)
+    {
+        const mode_info& mode = modes[fit.mode];
+        memset(out, 0, 16);
+        bit_writer bits = { out, 0 };
+
+        bits.put(1U << fit.mode, fit.mode + 1);
+        bits.put(fit.partition, mode.partition_bits);
+        bits.put(fit.rotation, mode.rotation_bits);
+        bits.put(fit.selector, mode.selector_bits);
+
+        if (mode.subsets == 1 && mode.alpha_index_bits)
+        {
+            // modes 4 and 5, alpha endpoints come from their own fit
+            for (int c = 0; c < 3; c++)
+                for (int i = 0; i < 2; i++)
+                    bits.put(fit.subsets[0].q.code[i][c], mode.color_bits);
+            for (int i = 0; i < 2; i++)
+                bits.put(fit.alpha.q.code[i][0], mode.alpha_bits);
+
+            // the index set stored first is 2 bits wide
+            const subset_fit& first  = fit.selector ? fit.alpha : fit.subsets[0];
+            const subset_fit& second = fit.selector ? fit.subsets[0] : fit.alpha;
+            for (int i = 0; i < BLOCK_PIXELS; i++)
+                bits.put(first.indices[i], mode.index_bits - (i == 0));
+            for (int i = 0; i < BLOCK_PIXELS; i++)
+                bits.put(second.indices[i], mode.alpha_index_bits - (i == 0));
+            return;
+        }
+
+        int channels = mode.alpha_bits ? 4 : 3;
+        for (int c = 0; c < channels; c++)
+            for (int s = 0; s < mode.subsets; s++)
+                for (int i = 0; i < 2; i++)
+                    bits.put(fit.subsets[s].q.code[i][c], c == 3 ? mode.alpha_bits : mode.color_bits);
+
+        if (mode.pbits == 2)
+            for (int s = 0; s < mode.subsets; s++)
+                for (int i = 0; i < 2; i++)
+                    bits.put(fit.subsets[s].q.pbit[i], 1);
+        else if (mode.pbits == 1)
+            for (int s = 0; s < mode.subsets; s++)
+                bits.put(fit.subsets[s].q.pbit[0], 1);
+
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+        {
+            int s = subset_of(mode.subsets, fit.partition, i);
+            bool anchor = i == anchor_of(mode.subsets, fit.partition, s);
+            bits.put(fit.subsets[s].indices[i], mode.index_bits - anchor);
+        }
+    }
+
+    /**
+     * @brief           Tries the partitions of a mode, either every one
+     *                  or only the few that estimate best
+     */
+    void search_partitions(const block_pixels& block, int m, int tries, int iterations, block_fit& best)
+    {
+        const mode_info& mode = modes[m];
+        int count = 1 << mode.partition_bits;
+        int channels = mode.alpha_bits ? 4 : 3;
+
+        int order[64];
+        float scores[64];
+        for (int p = 0; p < count; p++)
+        {
+            order[p] = p;
+            scores[p] = tries < count ? estimate_partition(block, mode.subsets, p, channels) : 0;
+        }
+        tries = std::min(tries, count);
+        std::partial_sort(order, order + tries, order + count, [&](int a, int b) { return scores[a] < scores[b]; });
+
+        for (int k = 0; k < tries && best.error > 0; k++)
+        {
+            block_fit fit = fit_shared(block, m, order[k], iterations);
+            if (fit.error < best.error)
+                best = fit;
+        }
+    }
+}
+
+void blocs__atlas::encode_bc7(const uint8_t* pixels, uint8_t* out, Quality quality)
+{
+    block_pixels block;
+    block.opaque = true;
+    for (int i = 0; i < BLOCK_PIXELS; i++)
+    {
+        for (int c = 0; c < 4; c++)
+            block.c[c][i] = pixels[i * CHANNELS + c];
+        block.opaque &= pixels[i * CHANNELS + 3] == 255;
+    }
+
+    int iterations = quality == Quality::FAST ? 1 : quality == Quality::NORMAL ? 2 : 4;
+
+    // mode 6 covers any block reasonably well so is always the baseline
+    block_fit best = fit_shared(block, 6, 0, iterations);
+
+    if (quality != Quality::FAST)
+    {
+        bool full = quality == Quality::FULL;
+
+        // separate alpha indices, rotations are only searched in full
+        for (int m = 4; m <= 5; m++)
+        for (int rotation = 0; rotation < (full ? 4 : 1) && best.error > 0; rotation++)
+        for (int selector = 0; selector < (m == 4 ? 2 : 1); selector++)
+        {
+            block_fit fit = fit_separate(block, m, rotation, selector, iterations);
+            if (fit.error < best.error)
+                best = fit;
+        }
+
+        if (block.opaque)
+        {
+            search_partitions(block, 1, full ? 64 : 4, iterations, best);
+            search_partitions(block, 3, full ? 64 : 4, iterations, best);
+            if (full)
+            {
+                search_partitions(block, 0, 16, iterations, best);
+                search_partitions(block, 2, 64, iterations, best);
+            }
+        }
+        else
+            search_partitions(block, 7, full ? 64 : 4, iterations, best);
+    }
+
+    write_block(best, out);
+}
@@ -0,0 +1,92 @@
+
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define BLOCS_X86 1
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+    #include <immintrin.h>
+#endif
+
+// lets single functions use instructions beyond the
+// baseline the rest of the program is compiled for
+#if defined(__GNUC__) || defined(__clang__)
+    #define TARGET(features) __attribute__((target(features)))
+#else
+    #define TARGET(features)
+#endif
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // runtime detection of instruction
+    // set extensions for simd dispatch
+    //
+
+    struct cpu_features
+    {
+        bool        sse2   = false;
+        bool        ssse3  = false;
+        bool        sse41  = false;
+        bool        pclmul = false;
+        bool        avx2   = false;
+    };
+
+    inline cpu_features detect_cpu()
+    {
+        cpu_features features;
+#if defined(BLOCS_X86)
+        unsigned int regs[4] = {};
+        auto cpuid = [&](unsigned int leaf)
+        {
+    #if defined(_MSC_VER) && !defined(__clang__)
+            __cpuidex((int*)regs, leaf, 0);
+    #else
+            __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+    #endif
+        };
+
+        cpuid(0);
+        unsigned int max_leaf = regs[0];
+
+        cpuid(1);
+        features.sse2   = regs[3] & (1U << 26);
+        features.ssse3  = regs[2] & (1U << 9);
+        features.sse41  = regs[2] & (1U << 19);
+        features.pclmul = regs[2] & (1U << 1);
+
+        // avx registers also need saving by the os
+        bool osxsave = regs[2] & (1U << 27);
+        bool avx     = regs[2] & (1U << 28);
+        if (osxsave && avx && max_leaf >= 7)
+        {
+    #if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long long xcr0 = _xgetbv(0);
+    #else
+            unsigned int lo, hi;
+            __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            unsigned long long xcr0 = ((unsigned long long)hi << 32) | lo;
+    #endif
+            cpuid(7);
+            features.avx2 = (xcr0 & 6) == 6 && (regs[1] & (1U << 5));
+        }
+#endif
+        return features;
+    }
+
+    /**
+     * @brief       Gets the instruction set extensions
+     *              supported by this machine
+     *
+     * @return const cpu_features&
+     */
+    inline const cpu_features& cpu()
+    {
+        static const cpu_features features = detect_cpu();
+        return features;
+    }
+}
@@ -0,0 +1,246 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#define DAT_MAGIC       0x54414442  // "BDAT"
+#define DAT_VERSION     2
+#define DAT_ALIGN       16
+
+#define RAW_MAGIC       0x57415242  // "BRAW"
+#define RAW_VERSION     1
+#define RAW_MAX_LEVELS  16
+#define RAW_ALIGN       64
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // binary atlas metadata, laid out
+    // to be mapped and read in place
+    //
+
+    // kinds of sections, as fourccs
+    enum class Section : uint32_t
+    {
+        TEXTURES = 0x52584554,  // "TEXR", a dat_texture per texture
+        STRINGS  = 0x53525453,  // "STRS", names, each ending in a nul
+        HASH     = 0x48534148,  // "HASH", a dat_hash then its pilots and slots
+        QUADS    = 0x44415551,  // "QUAD", a dat_quad per texture
+        QUADS16  = 0x36315551,  // "QU16", a dat_quad16 per texture
+    };
+
+    // the file begins with this header, little endian, followed by the
+    // index of its sections, then the sections, each DAT_ALIGN byte aligned
+    struct dat_header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint32_t    width;
+        uint32_t    height;
+        uint32_t    textures;
+        uint32_t    sections;
+        uint64_t    size;           // size of the whole file
+    };
+
+    struct dat_section
+    {
+        uint32_t    type;           // Section
+        uint32_t    count;          // records in the section, or bytes for strings
+        uint64_t    offset;         // from the start of the file
+        uint64_t    size;
+    };
+
+    // textures are in the order they were packed, entry i at offset + i * 32
+    struct dat_texture
+    {
+        uint32_t    name;           // offset of the name in the strings
+        uint32_t    name_size;      // length of the name, without its nul
+        int32_t     x;
+        int32_t     y;
+        int32_t     w;
+        int32_t     h;
+        uint32_t    expand;         // Expand mode of the edges
+        uint32_t    reserved;
+    };
+
+    // minimal perfect hash of the texture names, a name hashed with the seed
+    // picks a bucket, the bucket's pilot then picks the name's slot, and
+    // each slot holds the texture with that name, followed in the section
+    // by uint32_t pilots[buckets] and uint32_t textures[slots]
+    struct dat_hash
+    {
+        uint64_t    seed;
+        uint32_t    buckets;
+        uint32_t    slots;          // one per distinct name
+    };
+
+    // what a sprite's quad needs, in the order of the textures so the whole
+    // section can be copied into a vertex or constant buffer as it is,
+    // uvs are the edges of the texture and x, y offset the quad from the
+    // sprite's origin, zero while sprites are packed whole and untrimmed
+    struct dat_quad
+    {
+        float       u0;
+        float       v0;
+        float       u1;
+        float       v1;
+        float       x;
+        float       y;
+        float       w;
+        float       h;
+    };
+
+    // the same in half the space, uvs as unorm16 and offsets in pixels
+    struct dat_quad16
+    {
+        uint16_t    u0;
+        uint16_t    v0;
+        uint16_t    u1;
+        uint16_t    v1;
+        int16_t     x;
+        int16_t     y;
+        uint16_t    w;
+        uint16_t    h;
+    };
+
+    static_assert(sizeof(dat_header) == 32 && sizeof(dat_section) == 24 && sizeof(dat_texture) == 32 &&
+        sizeof(dat_hash) == 16 && sizeof(dat_quad) == 32 && sizeof(dat_quad16) == 16, "dat tables must not be padded");
+
+    ////////////////////////////////////
+    //
+    // raw textures laid out to be mapped
+    // and uploaded without any parsing
+    //
+
+    // where the pages of a level are, the first page starts at offset
+    // and each next one stride bytes later, all 64 byte aligned
+    struct raw_level
+    {
+        uint64_t    offset;
+        uint64_t    size;
+        uint64_t    stride;
+    };
+
+    // the file begins with this header, little endian, and it is
+    // also padded to 64 bytes so the first level follows aligned
+    struct raw_header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint32_t    width;
+        uint32_t    height;
+        uint32_t    format;         // Format of the pixels
+        uint32_t    vk_format;      // VkFormat to upload them as
+        uint32_t    block_w;        // pixels per block, 1x1 for rgba8
+        uint32_t    block_h;
+        uint32_t    block_bytes;
+        uint32_t    levels;
+        uint32_t    pages;
+        uint32_t    reserved;
+        raw_level   level[RAW_MAX_LEVELS];
+    };
+
+    static_assert(sizeof(raw_header) == 432, "raw header must not be padded");
+
+    ////////////////////////////////////
+    //
+    // reading in place, from a file already
+    // mapped or read into aligned memory
+    //
+
+    inline uint64_t dat_mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * @brief           Hashes a name eight bytes at a time, the
+     *                  same on every little endian machine
+     *
+     * @param name      Name, without its nul
+     * @param len       Length of the name
+     * @param seed      Seed of the hash
+     * @return uint64_t
+     */
+    inline uint64_t dat_hash_name(const char* name, std::size_t len, uint64_t seed)
+    {
+        uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+        for (; len >= 8; len -= 8, name += 8)
+        {
+            uint64_t v;
+            memcpy(&v, name, 8);
+            h = dat_mix(h ^ v);
+        }
+        uint64_t v = 0;
+        memcpy(&v, name, len);
+        return dat_mix(h ^ v ^ 0xff);
+    }
+
+    // 32 bits of hash scaled onto [0, n) with a multiply, not a divide
+    inline uint32_t dat_bucket(uint64_t hash, uint32_t buckets)
+    {
+        return (uint32_t)(((hash & 0xffffffff) * buckets) >> 32);
+    }
+
+    inline uint32_t dat_slot(uint64_t hash, uint32_t pilot, uint32_t slots)
+    {
+        return (uint32_t)(((dat_mix(hash ^ (pilot * 0x9e3779b97f4a7c15ULL)) >> 32) * slots) >> 32);
+    }
+
+    /**
+     * @brief           Finds a section of a file
+     *
+     * @param file      Start of the file
+     * @param type      Kind of section
+     * @return const dat_section* nullptr if the file has none
+     */
+    inline const dat_section* dat_find(const uint8_t* file, Section type)
+    {
+        const dat_header* header = reinterpret_cast<const dat_header*>(file);
+        const dat_section* sections = reinterpret_cast<const dat_section*>(file + sizeof(dat_header));
+        for (uint32_t i = 0; i < header->sections; i++)
+            if (sections[i].type == static_cast<uint32_t>(type))
+                return sections + i;
+        return nullptr;
+    }
+
+    /**
+     * @brief           Looks a texture up by name through the perfect hash,
+     *                  one hash, two table reads and a single compare
+     *
+     * @param file      Start of the file
+     * @param name      Name of the texture
+     * @return const dat_texture* nullptr if no texture has the name
+     */
+    inline const dat_texture* dat_lookup(const uint8_t* file, std::string_view name)
+    {
+        const dat_section* hash_section = dat_find(file, Section::HASH);
+        const dat_section* textures = dat_find(file, Section::TEXTURES);
+        const dat_section* strings = dat_find(file, Section::STRINGS);
+        if (!hash_section || !textures || !strings)
+            return nullptr;
+
+        const dat_hash* hash = reinterpret_cast<const dat_hash*>(file + hash_section->offset);
+        if (hash->slots == 0)
+            return nullptr;
+        const uint32_t* pilots = reinterpret_cast<const uint32_t*>(hash + 1);
+        const uint32_t* slots = pilots + hash->buckets;
+
+        uint64_t h = dat_hash_name(name.data(), name.size(), hash->seed);
+        uint32_t slot = dat_slot(h, pilots[dat_bucket(h, hash->buckets)], hash->slots);
+        const dat_texture* texture = reinterpret_cast<const dat_texture*>(file + textures->offset) + slots[slot];
+
+        const char* found = reinterpret_cast<const char*>(file + strings->offset) + texture->name;
+        if (texture->name_size != name.size() || memcmp(found, name.data(), name.size()) != 0)
+            return nullptr;
+        return texture;
+    }
+}
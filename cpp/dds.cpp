@@ -0,0 +1,97 @@
+
+#include "dds.hpp"
+
+#include <cstring>
+
+#define DDSD_CAPS           0x1
+#define DDSD_HEIGHT         0x2
+#define DDSD_WIDTH          0x4
+#define DDSD_PIXELFORMAT    0x1000
+#define DDSD_MIPMAPCOUNT    0x20000
+#define DDSD_LINEARSIZE     0x80000
+#define DDPF_FOURCC         0x4
+#define DDSCAPS_COMPLEX     0x8
+#define DDSCAPS_TEXTURE     0x1000
+#define DDSCAPS_MIPMAP      0x400000
+
+#define DXGI_FORMAT_BC7_UNORM       98
+#define D3D10_RESOURCE_TEXTURE2D    3
+
+using namespace blocs__atlas;
+
+namespace
+{
+    inline void put_u32le(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+        dst[3] = value >> 24;
+    }
+}
+
+////////////////////////////////////
+//
+// dds writer
+//
+
+/**
+ * @brief           Opens a dds file and writes its header, pixel
+ *                  rows are then streamed in with write_rows
+ *
+ * @param output    Output file
+ * @param w         Image width
+ * @param h         Image height
+ * @param format    Block compressed format
+ * @param options   Endpoint fitting method and thread count
+ * @param levels    Mip levels, each written after the one before
+ */
+dds_writer::dds_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels)
+    : block_writer(w, h, 4, levels), m_stream(output, std::ios::out | std::ios::binary | std::ios::trunc),
+      m_format(format), m_options(options)
+{
+    // etc2 and astc have no dds format, they only go in ktx2 files
+    m_good = m_good && block_bytes(format) > 0 && format != Format::ETC2 && format != Format::ASTC && m_stream.is_open();
+    if (!m_good)
+        return;
+
+    std::size_t size = (std::size_t)((w + 3) / 4) * ((h + 3) / 4) * block_bytes(format);
+
+    // magic followed by the 124 byte header, which holds a 32 byte
+    // pixel format, and for bc7 the 20 byte dx10 extension
+    uint8_t header[148] = { 'D', 'D', 'S', ' ' };
+    put_u32le(header + 4, 124);
+    put_u32le(header + 8, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | (levels > 1 ? DDSD_MIPMAPCOUNT : 0));
+    put_u32le(header + 12, h);
+    put_u32le(header + 16, w);
+    put_u32le(header + 20, size);
+    put_u32le(header + 28, levels);
+    put_u32le(header + 76, 32);
+    put_u32le(header + 80, DDPF_FOURCC);
+    memcpy(header + 84, format == Format::BC1 ? "DXT1" : format == Format::BC3 ? "DXT5" : "DX10", 4);
+    put_u32le(header + 108, DDSCAPS_TEXTURE | (levels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+
+    std::size_t header_size = 128;
+    if (format == Format::BC7)
+    {
+        put_u32le(header + 128, DXGI_FORMAT_BC7_UNORM);
+        put_u32le(header + 132, D3D10_RESOURCE_TEXTURE2D);
+        put_u32le(header + 140, 1);
+        header_size = sizeof(header);
+    }
+    m_stream.write((const char*)header, header_size);
+}
+
+// levels arrive largest first, the order dds stores them in
+void dds_writer::encode(int, int, const uint8_t* pixels, int w, int rows)
+{
+    m_blocks.resize((std::size_t)((w + 3) / 4) * ((rows + 3) / 4) * block_bytes(m_format));
+    encode_blocks(m_format, pixels, w, rows, m_blocks.data(), m_options);
+    m_stream.write((const char*)m_blocks.data(), m_blocks.size());
+}
+
+bool dds_writer::close()
+{
+    m_stream.close();
+    return !m_stream.fail();
+}
@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bc.hpp"
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // dds files of block compressed
+    // textures, encoded a band at a time
+    //
+
+    class dds_writer : public block_writer
+    {
+    public:
+        dds_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels = 1);
+
+    private:
+        std::ofstream m_stream;
+        Format      m_format;
+        bc_options  m_options;
+        std::vector<uint8_t> m_blocks;
+
+        void encode(int level, int layer, const uint8_t* pixels, int w, int rows) override;
+        bool close() override;
+    };
+}
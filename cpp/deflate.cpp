@@ -0,0 +1,1534 @@
+
+#include "deflate.hpp"
+#include "cpu.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define WINDOW_SIZE     32768
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define HASH_BITS       15
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define TOO_FAR         4096
+#define BLOCK_SYMBOLS   (1 << 15)
+#define STORED_BYTES    (1 << 16)
+#define SLIDE_BYTES     (1 << 18)
+#define CHUNK_BYTES     (1 << 18)
+#define ADLER_BASE      65521
+#define ADLER_MAX       5552
+#define OPTIMAL_SEGMENT (1 << 20)
+#define OPTIMAL_PASSES  8
+#define OPTIMAL_NICE    128
+#define OPTIMAL_CHUNK   (1 << 22)
+#define SPLIT_SYMBOLS   1024
+#define SPLIT_RUNS      64
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// static deflate tables and huffman
+// code construction
+//
+
+namespace
+{
+    const uint16_t len_base[29]   = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t  len_extra[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t dist_base[30]  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                      8193, 12289, 16385, 24577 };
+    const uint8_t  dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t  cl_order[19]   = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // good, lazy, nice and chain lengths for every
+    // compression level (same tuning as zlib), the
+    // optimal level only walks chains further
+    struct level_config
+    {
+        int good;
+        int lazy;
+        int nice;
+        int chain;
+    };
+
+    const level_config configs[OPTIMAL_LEVEL + 1] = {
+        {  0,   0,   0,    0 },
+        {  4,   4,   8,    4 },
+        {  4,   5,  16,    8 },
+        {  4,   6,  32,   32 },
+        {  4,   4,  16,   16 },
+        {  8,  16,  32,   32 },
+        {  8,  16, 128,  128 },
+        {  8,  32, 128,  256 },
+        { 32, 128, 258, 1024 },
+        { 32, 258, 258, 4096 },
+        { 258, 258, 258, 8192 },
+    };
+
+    /**
+     * @brief           Reverses the lowest bits of a huffman code, deflate
+     *                  packs codes starting from their most significant bit
+     */
+    inline uint32_t reverse_bits(uint32_t code, int len)
+    {
+        uint32_t result = 0;
+        for (int i = 0; i < len; i++, code >>= 1)
+            result = (result << 1) | (code & 1);
+        return result;
+    }
+
+    /**
+     * @brief           Assigns canonical (bit reversed) codes to code lengths
+     *
+     * @param lengths   Code length of every symbol
+     * @param n         Number of symbols
+     * @param codes     Output codes for every symbol
+     */
+    void build_codes(const uint8_t* lengths, int n, uint16_t* codes)
+    {
+        int count[16] = {};
+        for (int i = 0; i < n; i++)
+            count[lengths[i]]++;
+        count[0] = 0;
+
+        uint32_t next[16] = {};
+        uint32_t code = 0;
+        for (int len = 1; len < 16; len++)
+        {
+            code = (code + count[len - 1]) << 1;
+            next[len] = code;
+        }
+
+        for (int i = 0; i < n; i++)
+            codes[i] = lengths[i] ? reverse_bits(next[lengths[i]]++, lengths[i]) : 0;
+    }
+
+    /**
+     * @brief           Builds length limited huffman code lengths from
+     *                  symbol frequencies. Always yields at least two codes
+     *                  so that every alphabet forms a complete prefix code.
+     *
+     * @param freqs     Frequency of every symbol
+     * @param n         Number of symbols
+     * @param limit     Maximum code length
+     * @param lengths   Output code length of every symbol
+     */
+    void build_lengths(const uint32_t* freqs, int n, int limit, uint8_t* lengths)
+    {
+        std::vector<std::pair<uint32_t, int>> symbols;
+        for (int i = 0; i < n; i++)
+            if (freqs[i])
+                symbols.push_back({ freqs[i], i });
+        for (int i = 0; symbols.size() < 2; i++)
+            if (!freqs[i])
+                symbols.push_back({ 1, i });
+
+        std::sort(symbols.begin(), symbols.end());
+        memset(lengths, 0, n);
+
+        // minimum redundancy code lengths computed in place
+        // (moffat & katajainen), a[i] ends up as the depth of
+        // the i-th least frequent symbol
+        int m = symbols.size();
+        std::vector<uint32_t> a(m);
+        for (int i = 0; i < m; i++)
+            a[i] = symbols[i].first;
+
+        a[0] += a[1];
+        int root = 0, leaf = 2;
+        for (int next = 1; next < m - 1; next++)
+        {
+            if (leaf >= m || a[root] < a[leaf])
+            {
+                a[next] = a[root];
+                a[root++] = next;
+            }
+            else
+                a[next] = a[leaf++];
+
+            if (leaf >= m || (root < next && a[root] < a[leaf]))
+            {
+                a[next] += a[root];
+                a[root++] = next;
+            }
+            else
+                a[next] += a[leaf++];
+        }
+
+        a[m - 2] = 0;
+        for (int next = m - 3; next >= 0; next--)
+            a[next] = a[a[next]] + 1;
+
+        int avbl = 1, used = 0, depth = 0;
+        root = m - 2;
+        int next = m - 1;
+        while (avbl > 0)
+        {
+            while (root >= 0 && (int)a[root] == depth) { used++; root--; }
+            while (avbl > used) { a[next--] = depth; avbl--; }
+            avbl = 2 * used;
+            depth++;
+            used = 0;
+        }
+
+        // clamp lengths to the limit and rebalance the
+        // kraft sum by lengthening the shorter codes
+        int count[33] = {};
+        for (int i = 0; i < m; i++)
+            count[std::min<int>(a[i], limit)]++;
+
+        uint32_t total = 0;
+        for (int len = limit; len > 0; len--)
+            total += count[len] << (limit - len);
+        while (total != (1U << limit))
+        {
+            count[limit]--;
+            for (int len = limit - 1; len > 0; len--)
+            {
+                if (count[len])
+                {
+                    count[len]--;
+                    count[len + 1] += 2;
+                    break;
+                }
+            }
+            total--;
+        }
+
+        // shortest codes go to the most frequent symbols
+        int i = m - 1;
+        for (int len = 1; len <= limit; len++)
+            for (int c = count[len]; c > 0; c--)
+                lengths[symbols[i--].second] = len;
+    }
+
+    struct code_tables
+    {
+        uint8_t     len_code[MAX_MATCH + 1];
+        uint8_t     dist_code[512];
+        uint8_t     fixed_lit_len[288];
+        uint8_t     fixed_dist_len[30];
+        uint16_t    fixed_lit_codes[288];
+        uint16_t    fixed_dist_codes[30];
+
+        code_tables()
+        {
+            for (int code = 0; code < 29; code++)
+                for (int len = len_base[code]; len < len_base[code] + (1 << len_extra[code]) && len <= MAX_MATCH; len++)
+                    len_code[len] = code;
+
+            for (int code = 0; code < 30; code++)
+            {
+                for (int dist = dist_base[code]; dist < dist_base[code] + (1 << dist_extra[code]); dist++)
+                {
+                    if (dist <= 256)
+                        dist_code[dist - 1] = code;
+                    else
+                        dist_code[256 + ((dist - 1) >> 7)] = code;
+                }
+            }
+
+            for (int i = 0; i < 288; i++)
+                fixed_lit_len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            for (int i = 0; i < 30; i++)
+                fixed_dist_len[i] = 5;
+            build_codes(fixed_lit_len, 288, fixed_lit_codes);
+            build_codes(fixed_dist_len, 30, fixed_dist_codes);
+        }
+
+        int dist(int dist) const
+        {
+            return dist <= 256 ? dist_code[dist - 1] : dist_code[256 + ((dist - 1) >> 7)];
+        }
+    };
+
+    const code_tables tables;
+
+    inline uint32_t hash3(const uint8_t* p)
+    {
+        uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    /**
+     * @brief           Counts matching bytes between two positions
+     *                  eight bytes at a time
+     */
+    inline int match_length(const uint8_t* a, const uint8_t* b, int max_len)
+    {
+        int len = 0;
+        while (len + 8 <= max_len)
+        {
+            uint64_t x, y;
+            memcpy(&x, a + len, 8);
+            memcpy(&y, b + len, 8);
+            if (x != y)
+                return len + (__builtin_ctzll(x ^ y) >> 3);
+            len += 8;
+        }
+        while (len < max_len && a[len] == b[len])
+            len++;
+        return len;
+    }
+
+    template <typename S>
+    void count_symbols(const std::vector<S>& symbols, uint32_t* lit_freq, uint32_t* dist_freq)
+    {
+        for (auto s : symbols)
+        {
+            if (s.dist == 0)
+                lit_freq[s.litlen]++;
+            else
+            {
+                lit_freq[257 + tables.len_code[s.litlen]]++;
+                dist_freq[tables.dist(s.dist)]++;
+            }
+        }
+        lit_freq[256] = 1;
+    }
+
+    /**
+     * @brief           Counts the bits symbols of some frequencies take
+     *                  in a dynamic block, leaving out the block header
+     */
+    uint64_t block_bits(const uint32_t* lit_freq, const uint32_t* dist_freq)
+    {
+        uint8_t lit_len[286];
+        uint8_t dist_len[30];
+        build_lengths(lit_freq, 286, 15, lit_len);
+        build_lengths(dist_freq, 30, 15, dist_len);
+
+        uint64_t bits = 0;
+        for (int i = 0; i < 286; i++)
+            bits += (uint64_t)lit_freq[i] * lit_len[i];
+        for (int i = 0; i < 29; i++)
+            bits += (uint64_t)lit_freq[257 + i] * len_extra[i];
+        for (int i = 0; i < 30; i++)
+            bits += (uint64_t)dist_freq[i] * (dist_len[i] + dist_extra[i]);
+        return bits;
+    }
+
+    /**
+     * @brief           Sets the cost of every code to its entropy under
+     *                  some frequencies, unused codes cost as if used once
+     */
+    void entropy_costs(const uint32_t* freqs, int n, float* costs)
+    {
+        uint64_t total = 0;
+        for (int i = 0; i < n; i++)
+            total += freqs[i];
+        float log_total = std::log2((float)std::max<uint64_t>(total, 1));
+        for (int i = 0; i < n; i++)
+            costs[i] = log_total - (freqs[i] ? std::log2((float)freqs[i]) : 0.0f);
+    }
+
+    // code lengths of a dynamic block, the run length encoded code
+    // lengths making up its header, and the size of each block type
+    struct block_plan
+    {
+        uint8_t     lit_len[288];
+        uint8_t     dist_len[30];
+        uint8_t     cl_len[19];
+        uint8_t     cl_symbols[286 + 30][2];
+        int         cl_count;
+        int         hlit;
+        int         hdist;
+        int         hclen;
+        uint64_t    dynamic_bits;
+        uint64_t    fixed_bits;
+        uint64_t    stored_bits;
+
+        uint64_t smallest() const
+        {
+            return std::min(stored_bits, std::min(dynamic_bits, fixed_bits));
+        }
+    };
+
+    /**
+     * @brief           Builds the codes of a block from its symbol frequencies
+     *                  and counts the bits it takes stored, with the fixed
+     *                  codes and with its own codes, header included
+     *
+     * @param lit_freq  Frequency of every literal/length code
+     * @param dist_freq Frequency of every distance code
+     * @param raw_len   Bytes the block covers
+     * @param plan      Codes and sizes of the block
+     */
+    void plan_block(const uint32_t* lit_freq, const uint32_t* dist_freq, std::size_t raw_len, block_plan& plan)
+    {
+        build_lengths(lit_freq, 286, 15, plan.lit_len);
+        build_lengths(dist_freq, 30, 15, plan.dist_len);
+
+        plan.hlit = 286;
+        while (plan.hlit > 257 && !plan.lit_len[plan.hlit - 1])
+            plan.hlit--;
+        plan.hdist = 30;
+        while (plan.hdist > 1 && !plan.dist_len[plan.hdist - 1])
+            plan.hdist--;
+
+        // run length encode the code lengths of both alphabets
+        uint8_t lens[286 + 30];
+        memcpy(lens, plan.lit_len, plan.hlit);
+        memcpy(lens + plan.hlit, plan.dist_len, plan.hdist);
+
+        plan.cl_count = 0;
+        auto add = [&](int symbol, int extra)
+        {
+            plan.cl_symbols[plan.cl_count][0] = symbol;
+            plan.cl_symbols[plan.cl_count++][1] = extra;
+        };
+        for (int i = 0, n = plan.hlit + plan.hdist; i < n;)
+        {
+            uint8_t value = lens[i];
+            int run = 1;
+            while (i + run < n && lens[i + run] == value)
+                run++;
+            i += run;
+
+            if (value == 0)
+            {
+                while (run >= 11)
+                {
+                    int r = std::min(run, 138);
+                    add(18, r - 11);
+                    run -= r;
+                }
+                if (run >= 3)
+                {
+                    add(17, run - 3);
+                    run = 0;
+                }
+            }
+            else
+            {
+                add(value, 0);
+                run--;
+                while (run >= 3)
+                {
+                    int r = std::min(run, 6);
+                    add(16, r - 3);
+                    run -= r;
+                }
+            }
+            while (run-- > 0)
+                add(value, 0);
+        }
+
+        uint32_t cl_freq[19] = {};
+        for (int i = 0; i < plan.cl_count; i++)
+            cl_freq[plan.cl_symbols[i][0]]++;
+        build_lengths(cl_freq, 19, 7, plan.cl_len);
+
+        plan.hclen = 19;
+        while (plan.hclen > 4 && !plan.cl_len[cl_order[plan.hclen - 1]])
+            plan.hclen--;
+
+        // compare the cost of each block type in bits
+        uint64_t extra_bits = 0;
+        for (int i = 0; i < 29; i++)
+            extra_bits += (uint64_t)lit_freq[257 + i] * len_extra[i];
+        for (int i = 0; i < 30; i++)
+            extra_bits += (uint64_t)dist_freq[i] * dist_extra[i];
+
+        plan.dynamic_bits = 3 + 14 + 3 * plan.hclen + extra_bits;
+        for (int i = 0; i < 19; i++)
+            plan.dynamic_bits += (uint64_t)cl_freq[i] * plan.cl_len[i];
+        plan.dynamic_bits += 2 * cl_freq[16] + 3 * cl_freq[17] + 7 * cl_freq[18];
+
+        plan.fixed_bits = 3 + extra_bits;
+        for (int i = 0; i < 286; i++)
+        {
+            plan.dynamic_bits += (uint64_t)lit_freq[i] * plan.lit_len[i];
+            plan.fixed_bits += (uint64_t)lit_freq[i] * tables.fixed_lit_len[i];
+        }
+        for (int i = 0; i < 30; i++)
+        {
+            plan.dynamic_bits += (uint64_t)dist_freq[i] * plan.dist_len[i];
+            plan.fixed_bits += (uint64_t)dist_freq[i] * 5;
+        }
+
+        plan.stored_bits = raw_len * 8 + (raw_len / 65535 + 1) * 42;
+    }
+}
+
+////////////////////////////////////
+//
+// adler-32 checksum, vectorized with
+// ssse3 or avx2 when available
+//
+
+namespace
+{
+    using adler_fn = uint32_t (*)(uint32_t adler, const uint8_t* data, std::size_t len);
+
+    uint32_t adler_scalar(uint32_t adler, const uint8_t* data, std::size_t len)
+    {
+        uint32_t a = adler & 0xffff;
+        uint32_t b = adler >> 16;
+        while (len > 0)
+        {
+            // largest n such that b cannot overflow before the modulo
+            std::size_t n = std::min<std::size_t>(len, ADLER_MAX);
+            len -= n;
+            while (n--)
+            {
+                a += *data++;
+                b += a;
+            }
+            a %= ADLER_BASE;
+            b %= ADLER_BASE;
+        }
+        return (b << 16) | a;
+    }
+
+#if defined(BLOCS_X86)
+    // over a block of 32 bytes the first sum gains their total and the
+    // second gains 32 copies of the first sum from before the block plus
+    // each byte weighted by 32 down to 1, the copies are accumulated
+    // separately and multiplied out once the modulo is due
+
+    TARGET("ssse3") uint32_t adler_ssse3(uint32_t adler, const uint8_t* data, std::size_t len)
+    {
+        uint32_t a = adler & 0xffff;
+        uint32_t b = adler >> 16;
+
+        const __m128i zero  = _mm_setzero_si128();
+        const __m128i ones  = _mm_set1_epi16(1);
+        const __m128i taps1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+        const __m128i taps2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+
+        std::size_t blocks = len / 32;
+        len -= blocks * 32;
+        while (blocks > 0)
+        {
+            std::size_t n = std::min<std::size_t>(blocks, ADLER_MAX / 32);
+            blocks -= n;
+
+            __m128i prev_a = _mm_cvtsi32_si128(a * (uint32_t)n);
+            __m128i sum_a  = zero;
+            __m128i sum_b  = _mm_cvtsi32_si128(b);
+            for (; n > 0; n--, data += 32)
+            {
+                __m128i lo = _mm_loadu_si128((const __m128i*)data);
+                __m128i hi = _mm_loadu_si128((const __m128i*)(data + 16));
+                prev_a = _mm_add_epi32(prev_a, sum_a);
+                sum_a  = _mm_add_epi32(sum_a, _mm_add_epi32(_mm_sad_epu8(lo, zero), _mm_sad_epu8(hi, zero)));
+                sum_b  = _mm_add_epi32(sum_b, _mm_madd_epi16(_mm_maddubs_epi16(lo, taps1), ones));
+                sum_b  = _mm_add_epi32(sum_b, _mm_madd_epi16(_mm_maddubs_epi16(hi, taps2), ones));
+            }
+            sum_b = _mm_add_epi32(sum_b, _mm_slli_epi32(prev_a, 5));
+
+            sum_a = _mm_add_epi32(sum_a, _mm_shuffle_epi32(sum_a, _MM_SHUFFLE(1, 0, 3, 2)));
+            sum_b = _mm_add_epi32(sum_b, _mm_shuffle_epi32(sum_b, _MM_SHUFFLE(2, 3, 0, 1)));
+            sum_b = _mm_add_epi32(sum_b, _mm_shuffle_epi32(sum_b, _MM_SHUFFLE(1, 0, 3, 2)));
+            a = (a + (uint32_t)_mm_cvtsi128_si32(sum_a)) % ADLER_BASE;
+            b = (uint32_t)_mm_cvtsi128_si32(sum_b) % ADLER_BASE;
+        }
+        return adler_scalar((b << 16) | a, data, len);
+    }
+
+    TARGET("avx2") uint32_t adler_avx2(uint32_t adler, const uint8_t* data, std::size_t len)
+    {
+        uint32_t a = adler & 0xffff;
+        uint32_t b = adler >> 16;
+
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i ones = _mm256_set1_epi16(1);
+        const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                              16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+
+        std::size_t blocks = len / 32;
+        len -= blocks * 32;
+        while (blocks > 0)
+        {
+            std::size_t n = std::min<std::size_t>(blocks, ADLER_MAX / 32);
+            blocks -= n;
+
+            __m256i prev_a = _mm256_setr_epi32(a * (uint32_t)n, 0, 0, 0, 0, 0, 0, 0);
+            __m256i sum_a  = zero;
+            __m256i sum_b  = _mm256_setr_epi32(b, 0, 0, 0, 0, 0, 0, 0);
+            for (; n > 0; n--, data += 32)
+            {
+                __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+                prev_a = _mm256_add_epi32(prev_a, sum_a);
+                sum_a  = _mm256_add_epi32(sum_a, _mm256_sad_epu8(bytes, zero));
+                sum_b  = _mm256_add_epi32(sum_b, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, taps), ones));
+            }
+            sum_b = _mm256_add_epi32(sum_b, _mm256_slli_epi32(prev_a, 5));
+
+            __m128i lanes_a = _mm_add_epi32(_mm256_castsi256_si128(sum_a), _mm256_extracti128_si256(sum_a, 1));
+            __m128i lanes_b = _mm_add_epi32(_mm256_castsi256_si128(sum_b), _mm256_extracti128_si256(sum_b, 1));
+            lanes_a = _mm_add_epi32(lanes_a, _mm_shuffle_epi32(lanes_a, _MM_SHUFFLE(1, 0, 3, 2)));
+            lanes_b = _mm_add_epi32(lanes_b, _mm_shuffle_epi32(lanes_b, _MM_SHUFFLE(2, 3, 0, 1)));
+            lanes_b = _mm_add_epi32(lanes_b, _mm_shuffle_epi32(lanes_b, _MM_SHUFFLE(1, 0, 3, 2)));
+            a = (a + (uint32_t)_mm_cvtsi128_si32(lanes_a)) % ADLER_BASE;
+            b = (uint32_t)_mm_cvtsi128_si32(lanes_b) % ADLER_BASE;
+        }
+        return adler_scalar((b << 16) | a, data, len);
+    }
+#endif
+
+    adler_fn select_adler()
+    {
+#if defined(BLOCS_X86)
+        if (cpu().avx2)
+            return adler_avx2;
+        if (cpu().ssse3)
+            return adler_ssse3;
+#endif
+        return adler_scalar;
+    }
+
+    const adler_fn adler_kernel = select_adler();
+}
+
+uint32_t blocs__atlas::adler32(uint32_t adler, const uint8_t* data, std::size_t len)
+{
+    return adler_kernel(adler, data, len);
+}
+
+uint32_t blocs__atlas::adler32_combine(uint32_t adler1, uint32_t adler2, std::size_t len2)
+{
+    // the second sum gains len2 copies of the first
+    // piece's first sum (same derivation as zlib)
+    uint32_t rem = len2 % ADLER_BASE;
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint64_t)rem * sum1 % ADLER_BASE;
+    sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= ADLER_BASE * 2) sum2 -= ADLER_BASE * 2;
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return (sum2 << 16) | sum1;
+}
+
+////////////////////////////////////
+//
+// deflate encoder
+//
+
+/**
+ * @brief           Creates a deflate encoder
+ *
+ * @param level     Compression level from 0 (stored) to 9 (smallest),
+ *                  or OPTIMAL_LEVEL for the slow optimal parse
+ */
+deflate_encoder::deflate_encoder(int level)
+    : m_level(std::clamp(level, 0, OPTIMAL_LEVEL))
+{
+    m_good  = configs[m_level].good;
+    m_lazy  = configs[m_level].lazy;
+    m_nice  = configs[m_level].nice;
+    m_chain = configs[m_level].chain;
+    m_symbols.reserve(BLOCK_SYMBOLS);
+    reset();
+}
+
+/**
+ * @brief           Clears all state so the encoder can
+ *                  begin a new, independent stream
+ */
+void deflate_encoder::reset()
+{
+    m_window.clear();
+    m_base = m_pos = m_emitted = m_block_start = 0;
+    m_head.assign(1 << HASH_BITS, -1);
+    m_prev.assign(WINDOW_SIZE, -1);
+    m_symbols.clear();
+
+    // the cost model starts over too, so chunks handed to
+    // whichever worker is free always compress the same
+    m_matches.clear();
+    m_found = 0;
+    m_skip = 0;
+    m_lit_cost.clear();
+    m_dist_cost.clear();
+
+    m_match_available = false;
+    m_prev_len = MIN_MATCH - 1;
+    m_prev_dist = 0;
+
+    m_out = nullptr;
+    m_bits = 0;
+    m_bit_count = 0;
+}
+
+/**
+ * @brief           Primes a freshly reset encoder with data that
+ *                  matches may refer back to but which is not output
+ *
+ * @param data      Preceding data (only the last 32kb are used)
+ * @param len       Length of preceding data
+ */
+void deflate_encoder::set_dictionary(const uint8_t* data, std::size_t len)
+{
+    if (len > WINDOW_SIZE)
+    {
+        data += len - WINDOW_SIZE;
+        len = WINDOW_SIZE;
+    }
+
+    m_window.assign(data, data + len);
+    for (int64_t pos = 0; pos + MIN_MATCH <= (int64_t)len; pos++)
+        insert(pos);
+    m_pos = m_emitted = m_block_start = m_found = len;
+}
+
+/**
+ * @brief           Compresses the next piece of input. Output is appended
+ *                  in whole bytes, trailing bits are held until the next call.
+ *
+ * @param data      Input data
+ * @param len       Length of input data
+ * @param final     Whether this is the last piece of the stream
+ * @param out       Buffer receiving the compressed bytes
+ */
+void deflate_encoder::compress(const uint8_t* data, std::size_t len, bool final, std::vector<uint8_t>& out)
+{
+    m_out = &out;
+
+    // drop bytes that can no longer be matched or stored
+    int64_t keep = std::min(m_block_start, m_pos - WINDOW_SIZE);
+    if (keep - m_base >= SLIDE_BYTES)
+    {
+        m_window.erase(m_window.begin(), m_window.begin() + (keep - m_base));
+        m_base = keep;
+    }
+    m_window.insert(m_window.end(), data, data + len);
+    int64_t avail = m_base + (int64_t)m_window.size();
+
+    if (m_level == 0)
+    {
+        m_pos = m_emitted = avail;
+        if (final || m_emitted - m_block_start >= STORED_BYTES)
+            write_block(final);
+    }
+    else if (m_level == OPTIMAL_LEVEL)
+    {
+        // each segment waits for the lookahead of the matches
+        // parsed past its end, unless there is no more input coming
+        while (m_pos < avail && (final || avail - m_pos >= OPTIMAL_SEGMENT + 2 * MAX_MATCH))
+            deflate_optimal(avail);
+        if (final)
+            write_blocks(true, true);
+    }
+    else
+    {
+        // keep enough lookahead for a full length match
+        // unless there is no more input coming
+        int64_t end = final ? avail : avail - MAX_MATCH;
+        while (m_pos < end)
+        {
+            deflate(end);
+            if (m_symbols.size() >= BLOCK_SYMBOLS)
+                write_block(false);
+        }
+
+        if (final)
+        {
+            if (m_match_available)
+                literal(m_pos - 1);
+            m_match_available = false;
+            write_block(true);
+        }
+    }
+
+    flush_bits(final);
+    m_out = nullptr;
+}
+
+/**
+ * @brief           Compresses all input given so far and ends the block
+ *                  with an empty stored block, aligning the output to a
+ *                  byte boundary so that another stream can follow it
+ *
+ * @param out       Buffer receiving the compressed bytes
+ */
+void deflate_encoder::flush(std::vector<uint8_t>& out)
+{
+    m_out = &out;
+
+    int64_t avail = m_base + (int64_t)m_window.size();
+    if (m_level == 0)
+        m_pos = m_emitted = avail;
+    if (m_level == OPTIMAL_LEVEL)
+    {
+        while (m_pos < avail)
+            deflate_optimal(avail);
+        if (!m_symbols.empty())
+            write_blocks(true, false);
+    }
+    while (m_pos < avail)
+    {
+        deflate(avail);
+        if (m_symbols.size() >= BLOCK_SYMBOLS)
+            write_block(false);
+    }
+    if (m_match_available)
+        literal(m_pos - 1);
+    m_match_available = false;
+    m_prev_len = MIN_MATCH - 1;
+
+    if (m_emitted > m_block_start)
+        write_block(false);
+    write_stored(nullptr, 0, false);
+    m_out = nullptr;
+}
+
+int64_t deflate_encoder::insert(int64_t pos)
+{
+    uint32_t h = hash3(at(pos));
+    int64_t head = m_head[h];
+    m_prev[pos & WINDOW_MASK] = head;
+    m_head[h] = pos;
+    return head;
+}
+
+/**
+ * @brief           Walks the hash chain for the longest match
+ *                  that beats the previous match length
+ *
+ * @param pos       Position to match from
+ * @param cand      Most recent position with the same hash
+ * @param prev_len  Length that has to be beaten
+ * @param max_len   Longest match allowed by the remaining input
+ * @param dist      Distance of the longest match found
+ * @return int
+ */
+int deflate_encoder::longest_match(int64_t pos, int64_t cand, int prev_len, int max_len, int& dist)
+{
+    int best = prev_len;
+    if (best >= max_len)
+        return best;
+
+    int chain = prev_len >= m_good ? m_chain >> 2 : m_chain;
+    int nice  = std::min(m_nice, max_len);
+    int64_t limit = std::max(m_base, pos - WINDOW_SIZE);
+    const uint8_t* scan = at(pos);
+
+    while (cand >= limit && chain-- > 0)
+    {
+        const uint8_t* match = at(cand);
+        if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1])
+        {
+            int len = match_length(scan, match, max_len);
+            if (len > best)
+            {
+                best = len;
+                dist = pos - cand;
+                if (len >= nice)
+                    break;
+            }
+        }
+
+        int64_t next = m_prev[cand & WINDOW_MASK];
+        if (next >= cand)
+            break;
+        cand = next;
+    }
+
+    return best;
+}
+
+/**
+ * @brief           Finds matches up to a position, greedily for the
+ *                  fast levels and with lazy evaluation for the others
+ *
+ * @param end       Position to stop searching at
+ */
+void deflate_encoder::deflate(int64_t end)
+{
+    int64_t avail = m_base + (int64_t)m_window.size();
+    bool lazy = m_level > 3;
+
+    while (m_pos < end && m_symbols.size() < BLOCK_SYMBOLS)
+    {
+        int max_len = (int)std::min<int64_t>(MAX_MATCH, avail - m_pos);
+        int len = MIN_MATCH - 1;
+        int dist = 0;
+        if (max_len >= MIN_MATCH)
+        {
+            int64_t cand = insert(m_pos);
+            int prev_len = lazy ? m_prev_len : MIN_MATCH - 1;
+            if (prev_len < m_lazy || !lazy)
+                len = longest_match(m_pos, cand, prev_len, max_len, dist);
+            if (len == MIN_MATCH && dist > TOO_FAR)
+                len = MIN_MATCH - 1;
+            if (len <= prev_len && lazy)
+                len = MIN_MATCH - 1;
+        }
+
+        if (!lazy)
+        {
+            if (len >= MIN_MATCH)
+            {
+                match(len, dist);
+                // skip indexing the inside of long matches
+                if (len <= m_lazy)
+                    for (int64_t p = m_pos + 1; p < m_pos + len && p + MIN_MATCH <= avail; p++)
+                        insert(p);
+                m_pos += len;
+            }
+            else
+            {
+                literal(m_pos);
+                m_pos++;
+            }
+        }
+        else if (m_prev_len >= MIN_MATCH && len < MIN_MATCH)
+        {
+            // previous match was not beaten by one starting a byte later
+            int64_t match_end = m_pos - 1 + m_prev_len;
+            match(m_prev_len, m_prev_dist);
+            for (int64_t p = m_pos + 1; p < match_end && p + MIN_MATCH <= avail; p++)
+                insert(p);
+            m_pos = match_end;
+            m_match_available = false;
+            m_prev_len = MIN_MATCH - 1;
+        }
+        else
+        {
+            if (m_match_available)
+                literal(m_pos - 1);
+            m_match_available = true;
+            m_prev_len = len;
+            m_prev_dist = dist;
+            m_pos++;
+        }
+    }
+}
+
+/**
+ * @brief           Parses the next segment of input for the fewest bits,
+ *                  every match of every position is found once, then the
+ *                  cheapest path is taken through the costs of the codes,
+ *                  refitted to the previous path each pass. The parse runs
+ *                  on past the segment, so a match across its end is taken
+ *                  whole, and the segment ends where that match does.
+ *
+ * @param end       End of the input, the segment stops a full match short
+ *                  of it unless no more input is coming
+ */
+void deflate_encoder::deflate_optimal(int64_t end)
+{
+    int64_t start = m_pos;
+    int n   = (int)std::min<int64_t>(end - start, OPTIMAL_SEGMENT);
+    int ext = (int)std::min<int64_t>(end - start, n + MAX_MATCH);
+
+    // positions parsed past the end of the last segment kept their matches
+    m_match_index.resize(ext + 1);
+    match_entry found[MAX_MATCH];
+    for (int i = (int)(m_found - start); i < ext; i++)
+    {
+        int64_t pos = start + i;
+        m_match_index[i] = m_matches.size();
+        if (pos + MIN_MATCH > end)
+            continue;
+
+        int64_t cand = insert(pos);
+        if (m_skip > 0)
+        {
+            // inside a long match, which is as good as
+            // certain to be taken, so only literals are left
+            m_skip--;
+            continue;
+        }
+
+        int count = find_matches(pos, cand, (int)std::min<int64_t>(MAX_MATCH, end - pos), found);
+        m_matches.insert(m_matches.end(), found, found + count);
+        if (count > 0 && found[count - 1].len >= OPTIMAL_NICE)
+            m_skip = found[count - 1].len - 1;
+    }
+    m_match_index[ext] = m_matches.size();
+    m_found = start + ext;
+
+    // the first segment starts from the fixed codes
+    if (m_lit_cost.empty())
+    {
+        m_lit_cost.assign(tables.fixed_lit_len, tables.fixed_lit_len + 286);
+        m_dist_cost.assign(30, 5.0f);
+    }
+
+    std::vector<symbol> symbols, best;
+    uint64_t best_bits = UINT64_MAX;
+    for (int pass = 0; pass < OPTIMAL_PASSES; pass++)
+    {
+        parse(start, ext, symbols);
+
+        uint32_t lit_freq[288] = {};
+        uint32_t dist_freq[30] = {};
+        count_symbols(symbols, lit_freq, dist_freq);
+        uint64_t bits = block_bits(lit_freq, dist_freq);
+        if (bits >= best_bits)
+            break;
+
+        best_bits = bits;
+        best.swap(symbols);
+        entropy_costs(lit_freq, 286, m_lit_cost.data());
+        entropy_costs(dist_freq, 30, m_dist_cost.data());
+    }
+
+    // take the path up to the first position at or past the segment's
+    // end, or all of it when the input ends within the parse
+    std::size_t count = best.size();
+    int taken = ext;
+    if (start + ext < end)
+    {
+        count = 0;
+        taken = 0;
+        while (taken < n)
+            taken += best[count].dist ? best[count].litlen : 1, count++;
+    }
+    m_symbols.insert(m_symbols.end(), best.begin(), best.begin() + count);
+    m_pos = m_emitted = start + taken;
+
+    // matches of the positions past it are carried over
+    uint32_t carried = m_match_index[taken];
+    m_matches.erase(m_matches.begin(), m_matches.begin() + carried);
+    for (int i = taken; i <= ext; i++)
+        m_match_index[i - taken] = m_match_index[i] - carried;
+
+    write_blocks(false, false);
+}
+
+/**
+ * @brief           Writes the buffered symbols in blocks, ending a block
+ *                  wherever a new header pays for itself. Symbols are cut
+ *                  into runs and the cheapest way to end a block after
+ *                  each run is found from the blocks ending before it.
+ *
+ * @param last      Whether to write the last block too, otherwise it is
+ *                  kept to grow with the symbols of the next segment
+ * @param final     Whether the last block ends the stream
+ */
+void deflate_encoder::write_blocks(bool last, bool final)
+{
+    std::size_t count = m_symbols.size();
+    int runs = (int)((count + SPLIT_SYMBOLS - 1) / SPLIT_SYMBOLS);
+    if (runs == 0)
+    {
+        if (last)
+            write_block(final, 0);
+        return;
+    }
+
+    std::vector<uint32_t> lit_freqs((std::size_t)runs * 286, 0);
+    std::vector<uint32_t> dist_freqs((std::size_t)runs * 30, 0);
+    std::vector<std::size_t> raw(runs, 0);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        symbol s = m_symbols[i];
+        std::size_t run = i / SPLIT_SYMBOLS;
+        if (s.dist == 0)
+        {
+            lit_freqs[run * 286 + s.litlen]++;
+            raw[run]++;
+        }
+        else
+        {
+            lit_freqs[run * 286 + 257 + tables.len_code[s.litlen]]++;
+            dist_freqs[run * 30 + tables.dist(s.dist)]++;
+            raw[run] += s.litlen;
+        }
+    }
+
+    // fewest bits to end a block after each run, and where that block began
+    std::vector<uint64_t> bits(runs + 1, UINT64_MAX);
+    std::vector<int> begin(runs + 1, 0);
+    bits[0] = 0;
+    block_plan plan;
+    for (int j = 1; j <= runs; j++)
+    {
+        uint32_t lit_freq[288] = {};
+        uint32_t dist_freq[30] = {};
+        std::size_t raw_len = 0;
+        lit_freq[256] = 1;
+        for (int i = j - 1; i >= std::max(0, j - SPLIT_RUNS); i--)
+        {
+            for (int c = 0; c < 286; c++)
+                lit_freq[c] += lit_freqs[(std::size_t)i * 286 + c];
+            for (int c = 0; c < 30; c++)
+                dist_freq[c] += dist_freqs[(std::size_t)i * 30 + c];
+            raw_len += raw[i];
+
+            plan_block(lit_freq, dist_freq, raw_len, plan);
+            if (bits[i] + plan.smallest() < bits[j])
+            {
+                bits[j] = bits[i] + plan.smallest();
+                begin[j] = i;
+            }
+        }
+    }
+
+    std::vector<int> ends;
+    for (int j = runs; j > 0; j = begin[j])
+        ends.push_back(j);
+    std::reverse(ends.begin(), ends.end());
+
+    std::size_t written = 0;
+    for (std::size_t k = 0; k < ends.size(); k++)
+    {
+        bool is_last = k + 1 == ends.size();
+        if (is_last && !last)
+            break;
+        std::size_t end = std::min<std::size_t>((std::size_t)ends[k] * SPLIT_SYMBOLS, count);
+        write_block(final && is_last, end - written);
+        written = end;
+    }
+}
+
+/**
+ * @brief           Walks the hash chain for every match longer than
+ *                  those before it, nearer matches coming first
+ *
+ * @param pos       Position to match from
+ * @param cand      Most recent position with the same hash
+ * @param max_len   Longest match allowed by the block
+ * @param out       Matches in order of increasing length
+ * @return int      Number of matches
+ */
+int deflate_encoder::find_matches(int64_t pos, int64_t cand, int max_len, match_entry* out)
+{
+    int count = 0;
+    int best = MIN_MATCH - 1;
+    int chain = m_chain;
+    int64_t limit = std::max(m_base, pos - WINDOW_SIZE);
+    const uint8_t* scan = at(pos);
+
+    while (cand >= limit && chain-- > 0)
+    {
+        const uint8_t* match = at(cand);
+        if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1])
+        {
+            int len = match_length(scan, match, max_len);
+            if (len > best)
+            {
+                best = len;
+                out[count++] = { (uint16_t)len, (uint16_t)(pos - cand) };
+                if (len >= max_len)
+                    break;
+            }
+        }
+
+        int64_t next = m_prev[cand & WINDOW_MASK];
+        if (next >= cand)
+            break;
+        cand = next;
+    }
+
+    return count;
+}
+
+/**
+ * @brief           Finds the cheapest symbols for a segment under the current
+ *                  code costs, each position reached either by a literal or
+ *                  by any length of a match found before it
+ *
+ * @param start     Position of the segment
+ * @param n         Length of the segment, with the lookahead parsed past it
+ * @param symbols   Symbols of the cheapest path
+ */
+void deflate_encoder::parse(int64_t start, int n, std::vector<symbol>& symbols)
+{
+    float len_cost[MAX_MATCH + 1];
+    for (int len = MIN_MATCH; len <= MAX_MATCH; len++)
+    {
+        int lc = tables.len_code[len];
+        len_cost[len] = m_lit_cost[257 + lc] + len_extra[lc];
+    }
+    float dist_cost[30];
+    for (int dc = 0; dc < 30; dc++)
+        dist_cost[dc] = m_dist_cost[dc] + dist_extra[dc];
+
+    // cheapest cost to reach each position and the last step taken there
+    std::vector<float> cost(n + 1, INFINITY);
+    std::vector<match_entry> step(n + 1);
+    const uint8_t* data = at(start);
+    cost[0] = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        float base = cost[i];
+        float lit = base + m_lit_cost[data[i]];
+        if (lit < cost[i + 1])
+        {
+            cost[i + 1] = lit;
+            step[i + 1] = { 1, 0 };
+        }
+
+        // each length is reached through the nearest match long enough,
+        // up to the end of the parse
+        int len = MIN_MATCH;
+        for (uint32_t m = m_match_index[i]; m < m_match_index[i + 1]; m++)
+        {
+            match_entry e = m_matches[m];
+            float with_dist = base + dist_cost[tables.dist(e.dist)];
+            int longest = std::min<int>(e.len, n - i);
+            for (; len <= longest; len++)
+            {
+                float c = with_dist + len_cost[len];
+                if (c < cost[i + len])
+                {
+                    cost[i + len] = c;
+                    step[i + len] = { (uint16_t)len, e.dist };
+                }
+            }
+        }
+    }
+
+    symbols.clear();
+    for (int i = n; i > 0; i -= step[i].len)
+    {
+        if (step[i].dist == 0)
+            symbols.push_back({ data[i - 1], 0 });
+        else
+            symbols.push_back({ step[i].len, step[i].dist });
+    }
+    std::reverse(symbols.begin(), symbols.end());
+}
+
+void deflate_encoder::literal(int64_t pos)
+{
+    m_symbols.push_back({ *at(pos), 0 });
+    m_emitted++;
+}
+
+void deflate_encoder::match(int len, int dist)
+{
+    m_symbols.push_back({ (uint16_t)len, (uint16_t)dist });
+    m_emitted += len;
+}
+
+void deflate_encoder::put_bits(uint32_t value, int count)
+{
+    m_bits |= (uint64_t)value << m_bit_count;
+    m_bit_count += count;
+    if (m_bit_count >= 32)
+    {
+        uint8_t bytes[4] = {
+            (uint8_t)(m_bits), (uint8_t)(m_bits >> 8), (uint8_t)(m_bits >> 16), (uint8_t)(m_bits >> 24)
+        };
+        m_out->insert(m_out->end(), bytes, bytes + 4);
+        m_bits >>= 32;
+        m_bit_count -= 32;
+    }
+}
+
+/**
+ * @brief           Moves whole bytes from the bit buffer to the output
+ *
+ * @param align     Whether to pad the last partial byte with zeros
+ */
+void deflate_encoder::flush_bits(bool align)
+{
+    if (align)
+        m_bit_count = (m_bit_count + 7) & ~7;
+    while (m_bit_count >= 8)
+    {
+        m_out->push_back((uint8_t)m_bits);
+        m_bits >>= 8;
+        m_bit_count -= 8;
+    }
+}
+
+/**
+ * @brief           Writes input as uncompressed stored blocks
+ */
+void deflate_encoder::write_stored(const uint8_t* data, std::size_t len, bool final)
+{
+    do
+    {
+        std::size_t n = std::min<std::size_t>(len, 65535);
+        put_bits(final && n == len, 1);
+        put_bits(0, 2);
+        flush_bits(true);
+
+        uint8_t header[4] = {
+            (uint8_t)n, (uint8_t)(n >> 8), (uint8_t)~n, (uint8_t)(~n >> 8)
+        };
+        m_out->insert(m_out->end(), header, header + 4);
+        m_out->insert(m_out->end(), data, data + n);
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+/**
+ * @brief           Writes the buffered symbols as a single block using
+ *                  whichever of stored, fixed or dynamic codes is smallest
+ *
+ * @param final     Whether this is the last block in the stream
+ */
+void deflate_encoder::write_block(bool final)
+{
+    write_block(final, m_symbols.size());
+}
+
+/**
+ * @brief           Writes the first of the buffered symbols as a single
+ *                  block, the rest are kept for the blocks after it
+ *
+ * @param final     Whether this is the last block in the stream
+ * @param count     Number of symbols in the block
+ */
+void deflate_encoder::write_block(bool final, std::size_t count)
+{
+    const uint8_t* raw = at(m_block_start);
+    if (m_level == 0)
+    {
+        std::size_t raw_len = m_emitted - m_block_start;
+        m_block_start = m_emitted;
+        write_stored(raw, raw_len, final);
+        return;
+    }
+
+    std::size_t raw_len = 0;
+    uint32_t lit_freq[288] = {};
+    uint32_t dist_freq[30] = {};
+    for (std::size_t i = 0; i < count; i++)
+    {
+        symbol s = m_symbols[i];
+        if (s.dist == 0)
+        {
+            lit_freq[s.litlen]++;
+            raw_len++;
+        }
+        else
+        {
+            lit_freq[257 + tables.len_code[s.litlen]]++;
+            dist_freq[tables.dist(s.dist)]++;
+            raw_len += s.litlen;
+        }
+    }
+    lit_freq[256] = 1;
+    m_block_start += raw_len;
+
+    block_plan plan;
+    plan_block(lit_freq, dist_freq, raw_len, plan);
+
+    if (plan.stored_bits <= std::min(plan.dynamic_bits, plan.fixed_bits))
+    {
+        write_stored(raw, raw_len, final);
+        m_symbols.erase(m_symbols.begin(), m_symbols.begin() + count);
+        return;
+    }
+
+    uint16_t dynamic_lit_codes[288];
+    uint16_t dynamic_dist_codes[30];
+    const uint8_t*  lit_lens   = tables.fixed_lit_len;
+    const uint8_t*  dist_lens  = tables.fixed_dist_len;
+    const uint16_t* lit_codes  = tables.fixed_lit_codes;
+    const uint16_t* dist_codes = tables.fixed_dist_codes;
+
+    put_bits(final, 1);
+    if (plan.fixed_bits <= plan.dynamic_bits)
+        put_bits(1, 2);
+    else
+    {
+        uint16_t cl_codes[19];
+        build_codes(plan.cl_len, 19, cl_codes);
+        build_codes(plan.lit_len, 286, dynamic_lit_codes);
+        build_codes(plan.dist_len, 30, dynamic_dist_codes);
+        lit_lens   = plan.lit_len;
+        dist_lens  = plan.dist_len;
+        lit_codes  = dynamic_lit_codes;
+        dist_codes = dynamic_dist_codes;
+
+        put_bits(2, 2);
+        put_bits(plan.hlit - 257, 5);
+        put_bits(plan.hdist - 1, 5);
+        put_bits(plan.hclen - 4, 4);
+        for (int i = 0; i < plan.hclen; i++)
+            put_bits(plan.cl_len[cl_order[i]], 3);
+        for (int i = 0; i < plan.cl_count; i++)
+        {
+            int symbol = plan.cl_symbols[i][0];
+            int extra  = plan.cl_symbols[i][1];
+            put_bits(cl_codes[symbol], plan.cl_len[symbol]);
+            if (symbol == 16)      put_bits(extra, 2);
+            else if (symbol == 17) put_bits(extra, 3);
+            else if (symbol == 18) put_bits(extra, 7);
+        }
+    }
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        symbol s = m_symbols[i];
+        if (s.dist == 0)
+        {
+            put_bits(lit_codes[s.litlen], lit_lens[s.litlen]);
+            continue;
+        }
+
+        int lc = tables.len_code[s.litlen];
+        put_bits(lit_codes[257 + lc], lit_lens[257 + lc]);
+        if (len_extra[lc])
+            put_bits(s.litlen - len_base[lc], len_extra[lc]);
+
+        int dc = tables.dist(s.dist);
+        put_bits(dist_codes[dc], dist_lens[dc]);
+        if (dist_extra[dc])
+            put_bits(s.dist - dist_base[dc], dist_extra[dc]);
+    }
+    put_bits(lit_codes[256], lit_lens[256]);
+
+    m_symbols.erase(m_symbols.begin(), m_symbols.begin() + count);
+}
+
+////////////////////////////////////
+//
+// zlib stream
+//
+
+/**
+ * @brief           Creates a zlib stream
+ *
+ * @param level     Compression level from 0 (stored) to 9 (smallest)
+ * @param threads   Number of threads compressing chunks in parallel
+ */
+zlib_stream::zlib_stream(int level, int threads)
+    : m_level(level), m_threads(std::max(threads, 1)), m_adler(1), m_started(false)
+{
+    m_encoders.reserve(m_threads);
+    for (int i = 0; i < m_threads; i++)
+        m_encoders.emplace_back(level);
+}
+
+void zlib_stream::write_header(std::vector<uint8_t>& out)
+{
+    // 32kb window deflate, compression level hint
+    // and check bits making the header a multiple of 31
+    uint8_t cmf = 0x78;
+    uint8_t flg = (m_level < 2 ? 0 : m_level < 6 ? 1 : m_level == 6 ? 2 : 3) << 6;
+    flg += 31 - ((cmf << 8) | flg) % 31;
+    out.push_back(cmf);
+    out.push_back(flg);
+    m_started = true;
+}
+
+/**
+ * @brief           Compresses the next piece of the stream
+ *
+ * @param data      Input data
+ * @param len       Length of input data
+ * @param out       Buffer receiving the compressed bytes
+ */
+void zlib_stream::write(const uint8_t* data, std::size_t len, std::vector<uint8_t>& out)
+{
+    if (!m_started)
+        write_header(out);
+
+    if (m_threads == 1)
+    {
+        m_adler = adler32(m_adler, data, len);
+        m_encoders[0].compress(data, len, false, out);
+        return;
+    }
+
+    m_pending.insert(m_pending.end(), data, data + len);
+    if (m_pending.size() >= chunk_bytes(false) * m_threads)
+        compress_chunks(false, out);
+}
+
+/**
+ * @brief           Ends the stream with the last block and checksum
+ *
+ * @param out       Buffer receiving the compressed bytes
+ */
+void zlib_stream::finish(std::vector<uint8_t>& out)
+{
+    if (!m_started)
+        write_header(out);
+
+    if (m_threads == 1)
+        m_encoders[0].compress(nullptr, 0, true, out);
+    else
+        compress_chunks(true, out);
+
+    out.push_back((uint8_t)(m_adler >> 24));
+    out.push_back((uint8_t)(m_adler >> 16));
+    out.push_back((uint8_t)(m_adler >> 8));
+    out.push_back((uint8_t)(m_adler));
+}
+
+/**
+ * @brief           Size of the chunks pending input is split into. The
+ *                  optimal parse loses most of what it wins to the chunk
+ *                  boundaries at the usual size, so its chunks are larger,
+ *                  and the last ones share what is left between the threads.
+ *
+ * @param final     Whether the input ends with the pending chunks
+ * @return          Bytes per chunk
+ */
+std::size_t zlib_stream::chunk_bytes(bool final) const
+{
+    if (m_level != OPTIMAL_LEVEL)
+        return CHUNK_BYTES;
+    if (!final)
+        return OPTIMAL_CHUNK;
+
+    std::size_t share = (m_pending.size() + m_threads - 1) / m_threads;
+    return std::max<std::size_t>(CHUNK_BYTES, std::min<std::size_t>(OPTIMAL_CHUNK, share));
+}
+
+/**
+ * @brief           Compresses pending input as independent chunks in
+ *                  parallel (in the manner of pigz). Every chunk but the
+ *                  last ends byte aligned so the chunks can be concatenated,
+ *                  and their checksums are combined in order.
+ *
+ * @param final     Whether to compress the last, partial chunk as well
+ * @param out       Buffer receiving the compressed bytes
+ */
+void zlib_stream::compress_chunks(bool final, std::vector<uint8_t>& out)
+{
+    std::size_t pending = m_pending.size();
+    std::size_t size = chunk_bytes(final);
+    int chunks = final ? std::max<int>(1, (pending + size - 1) / size) : pending / size;
+    if (chunks == 0)
+        return;
+
+    std::vector<std::vector<uint8_t>> outputs(chunks);
+    std::vector<uint32_t> adlers(chunks);
+    parallel_for(chunks, m_threads, [&](int i, int worker)
+    {
+        const uint8_t* chunk = m_pending.data() + (std::size_t)i * size;
+        std::size_t len = std::min<std::size_t>(size, pending - (std::size_t)i * size);
+
+        auto& encoder = m_encoders[worker];
+        encoder.reset();
+        if (i == 0)
+            encoder.set_dictionary(m_dictionary.data(), m_dictionary.size());
+        else
+            encoder.set_dictionary(chunk - WINDOW_SIZE, WINDOW_SIZE);
+
+        if (final && i == chunks - 1)
+            encoder.compress(chunk, len, true, outputs[i]);
+        else
+        {
+            encoder.compress(chunk, len, false, outputs[i]);
+            encoder.flush(outputs[i]);
+        }
+        adlers[i] = adler32(1, chunk, len);
+    });
+
+    for (int i = 0; i < chunks; i++)
+    {
+        std::size_t len = std::min<std::size_t>(size, pending - (std::size_t)i * size);
+        m_adler = adler32_combine(m_adler, adlers[i], len);
+        out.insert(out.end(), outputs[i].begin(), outputs[i].end());
+    }
+
+    std::size_t consumed = std::min<std::size_t>((std::size_t)chunks * size, pending);
+    std::size_t keep = std::min<std::size_t>(consumed, WINDOW_SIZE);
+    m_dictionary.assign(m_pending.begin() + (consumed - keep), m_pending.begin() + consumed);
+    m_pending.erase(m_pending.begin(), m_pending.begin() + consumed);
+}
@@ -0,0 +1,150 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// past level 9, matches are chosen by a cost based optimal parse
+#define OPTIMAL_LEVEL   10
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // deflate (RFC 1951) compression of
+    // data fed in arbitrarily sized pieces
+    //
+
+    /**
+     * @brief           Updates a running Adler-32 checksum
+     *
+     * @param adler     Checksum of the data so far (1 to begin)
+     * @param data      New data
+     * @param len       Length of the new data
+     * @return uint32_t
+     */
+    uint32_t adler32(uint32_t adler, const uint8_t* data, std::size_t len);
+
+    /**
+     * @brief           Combines the Adler-32 checksums of two consecutive
+     *                  pieces of data into the checksum of both
+     *
+     * @param adler1    Checksum of the first piece
+     * @param adler2    Checksum of the second piece
+     * @param len2      Length of the second piece
+     * @return uint32_t
+     */
+    uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, std::size_t len2);
+
+    class deflate_encoder
+    {
+    public:
+        deflate_encoder(int level);
+
+        void reset();
+        void set_dictionary(const uint8_t* data, std::size_t len);
+        void compress(const uint8_t* data, std::size_t len, bool final, std::vector<uint8_t>& out);
+        void flush(std::vector<uint8_t>& out);
+
+    private:
+        struct symbol
+        {
+            uint16_t    litlen;
+            uint16_t    dist;
+        };
+
+        // a match of the optimal parse, matches found at
+        // a position are kept in order of increasing length
+        struct match_entry
+        {
+            uint16_t    len;
+            uint16_t    dist;
+        };
+
+        int         m_level;
+        int         m_good;
+        int         m_lazy;
+        int         m_nice;
+        int         m_chain;
+
+        // input not yet dropped out of the window,
+        // m_window[0] is at absolute position m_base
+        std::vector<uint8_t> m_window;
+        int64_t     m_base;
+        int64_t     m_pos;
+        int64_t     m_emitted;
+        int64_t     m_block_start;
+
+        std::vector<int64_t> m_head;
+        std::vector<int64_t> m_prev;
+        std::vector<symbol>  m_symbols;
+
+        // matches of every position of the segment being parsed, those
+        // past its end carried over with the positions up to m_found, and
+        // the bit cost of each literal/length and distance code, carried
+        // over as the first guess for the next segment
+        std::vector<uint32_t> m_match_index;
+        std::vector<match_entry> m_matches;
+        int64_t     m_found;
+        int         m_skip;
+        std::vector<float>   m_lit_cost;
+        std::vector<float>   m_dist_cost;
+
+        bool        m_match_available;
+        int         m_prev_len;
+        int         m_prev_dist;
+
+        std::vector<uint8_t>* m_out;
+        uint64_t    m_bits;
+        int         m_bit_count;
+
+        const uint8_t* at(int64_t pos) const { return m_window.data() + (pos - m_base); }
+
+        int64_t insert(int64_t pos);
+        int  longest_match(int64_t pos, int64_t cand, int prev_len, int max_len, int& dist);
+        void deflate(int64_t end);
+        void deflate_optimal(int64_t end);
+        int  find_matches(int64_t pos, int64_t cand, int max_len, match_entry* out);
+        void parse(int64_t start, int n, std::vector<symbol>& symbols);
+        void literal(int64_t pos);
+        void match(int len, int dist);
+        void put_bits(uint32_t value, int count);
+        void flush_bits(bool align);
+        void write_block(bool final);
+        void write_block(bool final, std::size_t count);
+        void write_blocks(bool last, bool final);
+        void write_stored(const uint8_t* data, std::size_t len, bool final);
+    };
+
+    ////////////////////////////////////
+    //
+    // zlib (RFC 1950) wrapper around
+    // a deflate stream
+    //
+
+    class zlib_stream
+    {
+    public:
+        zlib_stream(int level, int threads = 1);
+
+        void write(const uint8_t* data, std::size_t len, std::vector<uint8_t>& out);
+        void finish(std::vector<uint8_t>& out);
+
+    private:
+        std::vector<deflate_encoder> m_encoders;
+        int         m_level;
+        int         m_threads;
+        uint32_t    m_adler;
+        bool        m_started;
+
+        // with several threads input is split into chunks compressed
+        // independently, each primed with the 32kb preceding it
+        std::vector<uint8_t> m_pending;
+        std::vector<uint8_t> m_dictionary;
+
+        void write_header(std::vector<uint8_t>& out);
+        std::size_t chunk_bytes(bool final) const;
+        void compress_chunks(bool final, std::vector<uint8_t>& out);
+    };
+}
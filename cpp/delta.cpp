@@ -0,0 +1,229 @@
+
+#include "delta.hpp"
+#include "deflate.hpp"
+#include "atlas.hpp"
+#include "png.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+using namespace blocs__atlas;
+
+namespace
+{
+    // checksums whole images in pieces across the workers
+    uint32_t image_crc(const uint8_t* pixels, int w, int h, int threads)
+    {
+        std::size_t stride = (std::size_t)w * CHANNELS;
+        int pieces = std::max(1, std::min(threads, h));
+        std::vector<uint32_t> crcs(pieces);
+        parallel_for(pieces, threads, [&](int i, int)
+        {
+            int begin = (int)((int64_t)h * i / pieces);
+            int end = (int)((int64_t)h * (i + 1) / pieces);
+            crcs[i] = crc32(0, pixels + begin * stride, (end - begin) * stride);
+        });
+
+        uint32_t crc = crcs[0];
+        for (int i = 1; i < pieces; i++)
+        {
+            int rows = (int)((int64_t)h * (i + 1) / pieces) - (int)((int64_t)h * i / pieces);
+            crc = crc32_combine(crc, crcs[i], rows * stride);
+        }
+        return crc;
+    }
+}
+
+////////////////////////////////////
+//
+// dirty rects
+//
+
+void blocs__atlas::diff_tiles(const uint8_t* old, const uint8_t* pixels, int w, int h, int threads, std::vector<patch_rect>& rects)
+{
+    int columns = (w + PATCH_TILE - 1) / PATCH_TILE;
+    int rows = (h + PATCH_TILE - 1) / PATCH_TILE;
+    std::size_t stride = (std::size_t)w * CHANNELS;
+
+    // a tile is dirty once any of its rows differs,
+    // so later rows only compare tiles still clean
+    std::vector<uint8_t> dirty((std::size_t)columns * rows, 0);
+    parallel_for(rows, threads, [&](int ty, int)
+    {
+        uint8_t* row_dirty = dirty.data() + (std::size_t)ty * columns;
+        for (int y = ty * PATCH_TILE; y < std::min(h, (ty + 1) * PATCH_TILE); y++)
+        {
+            const uint8_t* a = old + y * stride;
+            const uint8_t* b = pixels + y * stride;
+            for (int tx = 0; tx < columns; tx++)
+            {
+                std::size_t begin = (std::size_t)tx * PATCH_TILE * CHANNELS;
+                std::size_t len = std::min<std::size_t>(PATCH_TILE * CHANNELS, stride - begin);
+                if (!row_dirty[tx] && memcmp(a + begin, b + begin, len) != 0)
+                    row_dirty[tx] = 1;
+            }
+        }
+    });
+
+    // runs of dirty tiles in a row, extending the rect above
+    // when it spans exactly the same columns, both kept in order
+    rects.clear();
+    std::vector<patch_rect> open, next;
+    for (int ty = 0; ty < rows; ty++)
+    {
+        const uint8_t* row_dirty = dirty.data() + (std::size_t)ty * columns;
+        uint32_t y = ty * PATCH_TILE;
+        uint32_t tile_h = std::min(PATCH_TILE, h - (int)y);
+        std::size_t above = 0;
+
+        next.clear();
+        for (int tx = 0; tx < columns;)
+        {
+            if (!row_dirty[tx])
+            {
+                tx++;
+                continue;
+            }
+            int end = tx;
+            while (end < columns && row_dirty[end])
+                end++;
+
+            uint32_t x = tx * PATCH_TILE;
+            uint32_t run_w = std::min(end * PATCH_TILE, w) - x;
+            while (above < open.size() && open[above].x < x)
+                rects.push_back(open[above++]);
+            if (above < open.size() && open[above].x == x && open[above].w == run_w)
+            {
+                next.push_back(open[above++]);
+                next.back().h += tile_h;
+            }
+            else
+                next.push_back({ x, y, run_w, tile_h });
+            tx = end;
+        }
+        rects.insert(rects.end(), open.begin() + above, open.end());
+        open.swap(next);
+    }
+    rects.insert(rects.end(), open.begin(), open.end());
+
+    std::sort(rects.begin(), rects.end(), [](const patch_rect& a, const patch_rect& b)
+    {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+}
+
+////////////////////////////////////
+//
+// patch files
+//
+
+bool blocs__atlas::write_patch(const std::string& output, const uint8_t* old, const uint8_t* pixels, int w, int h, int threads, patch_header& header)
+{
+    std::vector<patch_rect> rects;
+    diff_tiles(old, pixels, w, h, threads, rects);
+
+    // pixels are stored as the difference from the old ones, so
+    // untouched pixels inside a dirty tile compress to nothing
+    std::size_t stride = (std::size_t)w * CHANNELS;
+    std::size_t size = 0;
+    for (const auto& rect : rects)
+        size += (std::size_t)rect.w * rect.h * CHANNELS;
+
+    std::vector<uint8_t> deltas(size);
+    uint8_t* delta = deltas.data();
+    for (const auto& rect : rects)
+    {
+        for (uint32_t y = rect.y; y < rect.y + rect.h; y++)
+        {
+            std::size_t begin = y * stride + (std::size_t)rect.x * CHANNELS;
+            for (std::size_t i = begin; i < begin + (std::size_t)rect.w * CHANNELS; i++)
+                *delta++ = pixels[i] - old[i];
+        }
+    }
+
+    std::vector<uint8_t> compressed;
+    zlib_stream zlib(9, threads);
+    zlib.write(deltas.data(), deltas.size(), compressed);
+    zlib.finish(compressed);
+
+    header = { PATCH_MAGIC, PATCH_VERSION, (uint32_t)w, (uint32_t)h, PATCH_TILE,
+        (uint32_t)rects.size(), size, compressed.size(), image_crc(old, w, h, threads), image_crc(pixels, w, h, threads) };
+
+    std::ofstream stream(output, std::ios::out | std::ios::binary | std::ios::trunc);
+    stream.write((const char*)&header, sizeof(header));
+    stream.write((const char*)rects.data(), sizeof(patch_rect) * rects.size());
+    stream.write((const char*)compressed.data(), compressed.size());
+    stream.close();
+    return !stream.fail();
+}
+
+bool blocs__atlas::apply_patch(const uint8_t* data, std::size_t len, uint8_t* pixels, int w, int h)
+{
+    patch_header header;
+    if (len < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != PATCH_MAGIC || header.version != PATCH_VERSION)
+        return false;
+    if (header.width != (uint32_t)w || header.height != (uint32_t)h)
+        return false;
+    if ((len - sizeof(header)) / sizeof(patch_rect) < header.rects)
+        return false;
+
+    std::vector<patch_rect> rects(header.rects);
+    memcpy(rects.data(), data + sizeof(header), sizeof(patch_rect) * header.rects);
+    uint64_t size = 0;
+    for (const auto& rect : rects)
+    {
+        if (rect.x > header.width || rect.w > header.width - rect.x)
+            return false;
+        if (rect.y > header.height || rect.h > header.height - rect.y)
+            return false;
+        size += (uint64_t)rect.w * rect.h * CHANNELS;
+    }
+
+    std::size_t offset = sizeof(header) + sizeof(patch_rect) * header.rects;
+    if (size != header.size || header.compressed != len - offset)
+        return false;
+    if (size > INT_MAX || header.compressed > INT_MAX)
+        return false;
+    if (image_crc(pixels, w, h, 1) != header.source_crc)
+        return false;
+
+    // the decoder writes into a buffer of the exact size and fails
+    // rather than growing it, anything else it needs is scratch
+    std::vector<uint8_t> deltas(size);
+    arena scratch;
+    if (size > 0 && !zlib_decode(data + offset, header.compressed, deltas.data(), size, scratch))
+        return false;
+
+    // tiles are patched in a copy, and only copied back once
+    // the result is the image the patch was made from
+    std::size_t stride = (std::size_t)w * CHANNELS;
+    std::vector<uint8_t> patched(pixels, pixels + stride * h);
+    const uint8_t* delta = deltas.data();
+    for (const auto& rect : rects)
+    {
+        for (uint32_t y = rect.y; y < rect.y + rect.h; y++)
+        {
+            uint8_t* row = patched.data() + y * stride + (std::size_t)rect.x * CHANNELS;
+            for (std::size_t i = 0; i < (std::size_t)rect.w * CHANNELS; i++)
+                row[i] += *delta++;
+        }
+    }
+    if (image_crc(patched.data(), w, h, 1) != header.target_crc)
+        return false;
+
+    for (const auto& rect : rects)
+    {
+        for (uint32_t y = rect.y; y < rect.y + rect.h; y++)
+        {
+            std::size_t begin = y * stride + (std::size_t)rect.x * CHANNELS;
+            memcpy(pixels + begin, patched.data() + begin, (std::size_t)rect.w * CHANNELS);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define PATCH_MAGIC     0x54415042  // "BPAT"
+#define PATCH_VERSION   1
+#define PATCH_TILE      16
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // patches holding only the regions of
+    // an atlas that changed since a build
+    //
+
+    // a patch begins with this header, little endian, followed by the
+    // table of dirty rects, then a zlib stream of the pixels of every rect,
+    // row by row and rect after rect, each byte the new value minus the old
+    struct patch_header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint32_t    width;
+        uint32_t    height;
+        uint32_t    tile;           // rects are whole tiles of this size, clipped to the image
+        uint32_t    rects;
+        uint64_t    size;           // size of the pixels once decompressed
+        uint64_t    compressed;
+        uint32_t    source_crc;     // crc-32 of the whole image the patch applies to
+        uint32_t    target_crc;     // and of the image it turns it into
+    };
+
+    struct patch_rect
+    {
+        uint32_t    x;
+        uint32_t    y;
+        uint32_t    w;
+        uint32_t    h;
+    };
+
+    static_assert(sizeof(patch_header) == 48 && sizeof(patch_rect) == 16, "patch tables must not be padded");
+
+    /**
+     * @brief           Compares two images tile by tile and merges the tiles
+     *                  that differ into rects, runs of tiles along a row that
+     *                  continue runs of the same span in the row above
+     *
+     * @param old       RGBA pixels of the previous image
+     * @param pixels    RGBA pixels of the new image, the same size
+     * @param w         Image width
+     * @param h         Image height
+     * @param threads   Number of worker threads
+     * @param rects     Dirty rects, ordered by their first row
+     */
+    void diff_tiles(const uint8_t* old, const uint8_t* pixels, int w, int h, int threads, std::vector<patch_rect>& rects);
+
+    /**
+     * @brief           Writes a patch turning the previous image into the new one
+     *
+     * @param output    Patch file
+     * @param old       RGBA pixels of the previous image
+     * @param pixels    RGBA pixels of the new image, the same size
+     * @param w         Image width
+     * @param h         Image height
+     * @param threads   Number of worker threads
+     * @param header    Header of the written patch
+     * @return true     If the patch was written
+     */
+    bool write_patch(const std::string& output, const uint8_t* old, const uint8_t* pixels, int w, int h, int threads, patch_header& header);
+
+    /**
+     * @brief           Applies a patch to the image it was made against,
+     *                  checking every rect and byte stays in bounds
+     *
+     * @param data      Patch file contents
+     * @param len       Length of the patch
+     * @param pixels    RGBA pixels of the previous image, patched in place
+     *                  and left as they were if the patch fails
+     * @param w         Image width
+     * @param h         Image height
+     * @return true     If the patch was valid, made against these pixels
+     *                  and turned them into the image it was made from
+     */
+    bool apply_patch(const uint8_t* data, std::size_t len, uint8_t* pixels, int w, int h);
+}
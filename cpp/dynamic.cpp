@@ -0,0 +1,315 @@
+
+#include "dynamic.hpp"
+
+using namespace blocs__atlas;
+
+namespace
+{
+    /**
+     * @brief           Finds the first leaf at or after lo whose widest space
+     *                  is at least w wide, skipping whole subtrees narrower
+     *
+     * @param widest    Tree of the widest space under each node
+     * @param node      Node to search under
+     * @param l         First leaf under the node
+     * @param r         Last leaf under the node
+     * @param lo        First leaf that may be returned
+     * @param w         Width needed
+     * @return int      Leaf, or -1 if none fits
+     */
+    int first_fit(const std::vector<int>& widest, int node, int l, int r, int lo, int w)
+    {
+        if (r < lo || widest[node] < w)
+            return -1;
+        if (l == r)
+            return l;
+        int mid = (l + r) / 2;
+        int found = first_fit(widest, node * 2, l, mid, lo, w);
+        return found >= 0 ? found : first_fit(widest, node * 2 + 1, mid + 1, r, lo, w);
+    }
+}
+
+/**
+ * @brief               Creates an allocator of rects of a texture
+ *
+ * @param w             Width of the texture
+ * @param h             Height of the texture
+ * @param padding       Empty pixels kept right of and below each rect,
+ *                      a texture of no pixels never hands out a rect
+ */
+dynamic_atlas::dynamic_atlas(int w, int h, int padding)
+    : m_w(std::max(w, 0)), m_h(std::max(h, 0)), m_padding(std::max(padding, 0))
+{
+    m_leaves = 1;
+    while (m_leaves < h + 1)
+        m_leaves *= 2;
+    clear();
+}
+
+/**
+ * @brief               Frees every rect, leaving the whole texture as one space
+ */
+void dynamic_atlas::clear()
+{
+    m_count = 0;
+    m_used = 0;
+    m_nodes.clear();
+    m_free_nodes.clear();
+    m_allocations.clear();
+    m_free_ids.clear();
+    m_spaces.assign(m_h + 1, {});
+    m_widest.assign(m_leaves * 2, 0);
+    add_space(new_node({ 0, 0, m_w, m_h }, DYNAMIC_NONE));
+}
+
+uint32_t dynamic_atlas::new_node(const rect& space, uint32_t parent)
+{
+    uint32_t n;
+    if (!m_free_nodes.empty())
+    {
+        n = m_free_nodes.back();
+        m_free_nodes.pop_back();
+    }
+    else
+    {
+        n = (uint32_t)m_nodes.size();
+        m_nodes.emplace_back();
+    }
+    m_nodes[n] = { space, parent, { DYNAMIC_NONE, DYNAMIC_NONE }, DYNAMIC_NONE, State::FREE };
+    return n;
+}
+
+////////////////////////////////////
+//
+// index of free spaces
+//
+
+void dynamic_atlas::add_space(uint32_t n)
+{
+    const rect& space = m_nodes[n].space;
+    m_spaces[space.h].insert({ space.w, n });
+    update_widest(space.h);
+}
+
+void dynamic_atlas::remove_space(uint32_t n)
+{
+    const rect& space = m_nodes[n].space;
+    m_spaces[space.h].erase({ space.w, n });
+    update_widest(space.h);
+}
+
+// refreshes the widest space of a height and of the nodes above it
+void dynamic_atlas::update_widest(int h)
+{
+    int i = m_leaves + h;
+    m_widest[i] = m_spaces[h].empty() ? 0 : m_spaces[h].rbegin()->first;
+    for (i /= 2; i > 0; i /= 2)
+        m_widest[i] = std::max(m_widest[i * 2], m_widest[i * 2 + 1]);
+}
+
+/**
+ * @brief               Finds the shortest height with a free space
+ *                      at least as tall and as wide as needed
+ *
+ * @param h             Height needed
+ * @param w             Width needed
+ * @return int          Height of the space, or -1 if none fits
+ */
+int dynamic_atlas::find_height(int h, int w) const
+{
+    if (h > m_h)
+        return -1;
+    return first_fit(m_widest, 1, 0, m_leaves - 1, h, w);
+}
+
+////////////////////////////////////
+//
+// allocation
+//
+
+/**
+ * @brief               Takes the shortest, then narrowest, space a box fits
+ *                      in and splits off what is below and right of the box
+ *
+ * @param w             Width of the box, padding included
+ * @param h             Height of the box, padding included
+ * @return uint32_t     Node of the box, DYNAMIC_NONE if nothing fits
+ */
+uint32_t dynamic_atlas::place(int w, int h)
+{
+    int height = find_height(h, w);
+    if (height < 0)
+        return DYNAMIC_NONE;
+    uint32_t n = m_spaces[height].lower_bound({ w, 0 })->second;
+    remove_space(n);
+
+    // cut the space in two, keeping the larger leftover whole
+    // |-------|-------|    |-------|-------|
+    // |  box  | right |    |  box  |       |
+    // |_______|_______| or |_______| right |
+    // |     below     |    | below |       |
+    // |_______________|    |_______|_______|
+    rect space = m_nodes[n].space;
+    auto split = [&](const rect& keep, const rect& rest)
+    {
+        uint32_t first = new_node(keep, n);
+        uint32_t second = new_node(rest, n);
+        m_nodes[n].child[0] = first;
+        m_nodes[n].child[1] = second;
+        m_nodes[n].state = State::SPLIT;
+        add_space(second);
+        n = first;
+    };
+    // pack cuts rows as its textures come tallest first, but
+    // rects come in any order here and rows of every height
+    // would leave the space between them too narrow to use
+    bool rows = (int64_t)space.w * (space.h - h) >= (int64_t)(space.w - w) * space.h;
+    if (rows)
+    {
+        if (space.h > h)
+            split({ space.x, space.y, space.w, h }, { space.x, space.y + h, space.w, space.h - h });
+        if (space.w > w)
+            split({ space.x, space.y, w, h }, { space.x + w, space.y, space.w - w, h });
+    }
+    else
+    {
+        if (space.w > w)
+            split({ space.x, space.y, w, space.h }, { space.x + w, space.y, space.w - w, space.h });
+        if (space.h > h)
+            split({ space.x, space.y, w, h }, { space.x, space.y + h, w, space.h - h });
+    }
+    m_nodes[n].state = State::USED;
+    return n;
+}
+
+/**
+ * @brief               Frees a node, joining it with its sibling into their
+ *                      parent's space for as long as both halves are free
+ *
+ * @param n             Node of a freed rect
+ */
+void dynamic_atlas::release(uint32_t n)
+{
+    m_nodes[n].state = State::FREE;
+    m_nodes[n].id = DYNAMIC_NONE;
+    for (uint32_t parent = m_nodes[n].parent; parent != DYNAMIC_NONE; parent = m_nodes[n].parent)
+    {
+        node& split = m_nodes[parent];
+        uint32_t sibling = split.child[0] == n ? split.child[1] : split.child[0];
+        if (m_nodes[sibling].state != State::FREE)
+            break;
+
+        remove_space(sibling);
+        m_free_nodes.push_back(n);
+        m_free_nodes.push_back(sibling);
+        split.child[0] = split.child[1] = DYNAMIC_NONE;
+        split.state = State::FREE;
+        n = parent;
+    }
+    add_space(n);
+}
+
+/**
+ * @brief               Allocates a rect, in O(log n) of the free spaces
+ *
+ * @param w             Width of the rect
+ * @param h             Height of the rect
+ * @return uint32_t     Id of the rect, DYNAMIC_NONE if it does not fit
+ */
+uint32_t dynamic_atlas::allocate(int w, int h)
+{
+    if (w <= 0 || h <= 0)
+        return DYNAMIC_NONE;
+    uint32_t n = place(w + m_padding, h + m_padding);
+    if (n == DYNAMIC_NONE)
+        return DYNAMIC_NONE;
+
+    uint32_t id;
+    if (!m_free_ids.empty())
+    {
+        id = m_free_ids.back();
+        m_free_ids.pop_back();
+    }
+    else
+    {
+        id = (uint32_t)m_allocations.size();
+        m_allocations.emplace_back();
+    }
+    const rect& space = m_nodes[n].space;
+    m_allocations[id] = { { space.x, space.y, w, h }, n };
+    m_nodes[n].id = id;
+    m_count++;
+    m_used += (int64_t)w * h;
+    return id;
+}
+
+/**
+ * @brief               Frees a rect, its id may be handed out again
+ *
+ * @param id            Id of the rect
+ * @return true         If the id was allocated
+ */
+bool dynamic_atlas::free(uint32_t id)
+{
+    if (id >= m_allocations.size() || m_allocations[id].node == DYNAMIC_NONE)
+        return false;
+    allocation& freed = m_allocations[id];
+    release(freed.node);
+    freed.node = DYNAMIC_NONE;
+    m_free_ids.push_back(id);
+    m_count--;
+    m_used -= (int64_t)freed.rect.w * freed.rect.h;
+    return true;
+}
+
+/**
+ * @brief               Packs every rect again from the tallest down, as
+ *                      atlas::pack does, joining the space left between them,
+ *                      ids stay the same and only their rects move
+ *
+ * @param moves         Rects that moved, whose pixels the caller copies,
+ *                      through a second texture as they may overlap
+ * @return true         If every rect fit, otherwise nothing moved
+ */
+bool dynamic_atlas::defragment(std::vector<dynamic_move>& moves)
+{
+    moves.clear();
+    std::vector<uint32_t> live;
+    live.reserve(m_count);
+    for (uint32_t id = 0; id < m_allocations.size(); id++)
+        if (m_allocations[id].node != DYNAMIC_NONE)
+            live.push_back(id);
+    std::stable_sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b)
+    {
+        const rect& ra = m_allocations[a].rect;
+        const rect& rb = m_allocations[b].rect;
+        return ra.h != rb.h ? ra.h > rb.h : ra.w > rb.w;
+    });
+
+    dynamic_atlas packed(m_w, m_h, m_padding);
+    std::vector<uint32_t> nodes(live.size());
+    for (std::size_t i = 0; i < live.size(); i++)
+    {
+        const rect& r = m_allocations[live[i]].rect;
+        nodes[i] = packed.place(r.w + m_padding, r.h + m_padding);
+        if (nodes[i] == DYNAMIC_NONE)
+            return false;
+    }
+
+    for (std::size_t i = 0; i < live.size(); i++)
+    {
+        allocation& moved = m_allocations[live[i]];
+        node& placed = packed.m_nodes[nodes[i]];
+        placed.id = live[i];
+        rect to = { placed.space.x, placed.space.y, moved.rect.w, moved.rect.h };
+        if (to.x != moved.rect.x || to.y != moved.rect.y)
+            moves.push_back({ live[i], moved.rect, to });
+        moved.rect = to;
+        moved.node = nodes[i];
+    }
+    m_nodes.swap(packed.m_nodes);
+    m_free_nodes.swap(packed.m_free_nodes);
+    m_spaces.swap(packed.m_spaces);
+    m_widest.swap(packed.m_widest);
+    return true;
+}
@@ -0,0 +1,108 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "atlas.hpp"
+
+#define DYNAMIC_NONE    UINT32_MAX
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // rects allocated and freed at runtime,
+    // for glyph caches and streamed sprites
+    //
+
+    // where defragment moved an allocation, for the caller to copy its pixels
+    struct dynamic_move
+    {
+        uint32_t    id;
+        rect        from;
+        rect        to;
+    };
+
+    /**
+     * @brief           Allocates rects of a texture while it is in use, splitting
+     *                  free spaces the way atlas::pack does and joining them
+     *                  back as rects are freed, it only hands out rects and
+     *                  never touches pixels, which stay in the caller's textures
+     */
+    class dynamic_atlas
+    {
+    public:
+        dynamic_atlas(int w, int h, int padding = 0);
+
+        dynamic_atlas(const dynamic_atlas&) = delete;
+        dynamic_atlas& operator=(const dynamic_atlas&) = delete;
+
+        uint32_t allocate(int w, int h);
+        bool free(uint32_t id);
+        bool defragment(std::vector<dynamic_move>& moves);
+        void clear();
+
+        const rect& get(uint32_t id) const { return m_allocations[id].rect; }
+        std::size_t count() const { return m_count; }
+        int64_t used() const { return m_used; }
+        int width() const { return m_w; }
+        int height() const { return m_h; }
+
+    private:
+        enum class State : uint8_t
+        {
+            FREE,
+            USED,
+            SPLIT,
+        };
+
+        // splits form a binary tree, a space is cut into the row
+        // the rect takes and what is below it, then that row into
+        // the rect and what is right of it, as in atlas::pack, or
+        // into columns first when that leaves the larger space whole
+        struct node
+        {
+            rect        space;
+            uint32_t    parent;
+            uint32_t    child[2];
+            uint32_t    id;             // allocation using the node
+            State       state;
+        };
+
+        struct allocation
+        {
+            blocs__atlas::rect rect;
+            uint32_t    node;           // DYNAMIC_NONE once freed
+        };
+
+        int         m_w;
+        int         m_h;
+        int         m_padding;
+        std::size_t m_count;
+        int64_t     m_used;
+
+        std::vector<node>       m_nodes;
+        std::vector<uint32_t>   m_free_nodes;
+        std::vector<allocation> m_allocations;
+        std::vector<uint32_t>   m_free_ids;
+
+        // free spaces by height, each height's ordered by width, and a
+        // tree over the heights of the widest space of each, so the
+        // shortest then narrowest space that fits is found in O(log n)
+        std::vector<std::set<std::pair<int, uint32_t>>> m_spaces;
+        std::vector<int>        m_widest;
+        int         m_leaves;
+
+        uint32_t new_node(const rect& space, uint32_t parent);
+        void add_space(uint32_t n);
+        void remove_space(uint32_t n);
+        void update_widest(int h);
+        int find_height(int h, int w) const;
+        uint32_t place(int w, int h);
+        void release(uint32_t n);
+    };
+}
@@ -0,0 +1,588 @@
+
+#include "etc.hpp"
+#include "writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#define BLOCK_PIXELS    16
+#define HALF_PIXELS     8
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// etc2 block bits
+//
+
+namespace
+{
+    // etc1 intensity modifiers, indices 0 to 3 select +a, +b, -a and -b
+    const int modifiers[8][2] =
+    {
+        {  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+        { 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 },
+    };
+
+    // eac alpha modifiers, scaled by the block's multiplier
+    const int alpha_modifiers[16][8] =
+    {
+        { -3, -6,  -9, -15, 2, 5, 8, 14 },
+        { -3, -7, -10, -13, 2, 6, 9, 12 },
+        { -2, -5,  -8, -13, 1, 4, 7, 12 },
+        { -2, -4,  -6, -13, 1, 3, 5, 12 },
+        { -3, -6,  -8, -12, 2, 5, 7, 11 },
+        { -3, -7,  -9, -11, 2, 6, 8, 10 },
+        { -4, -7,  -8, -11, 3, 6, 7, 10 },
+        { -3, -5,  -8, -11, 2, 4, 7, 10 },
+        { -2, -6,  -8, -10, 1, 5, 7,  9 },
+        { -2, -5,  -8, -10, 1, 4, 7,  9 },
+        { -2, -4,  -8, -10, 1, 3, 7,  9 },
+        { -2, -5,  -7, -10, 1, 4, 6,  9 },
+        { -3, -4,  -7, -10, 2, 3, 6,  9 },
+        { -1, -2,  -3, -10, 0, 1, 2,  9 },
+        { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+        { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+    };
+
+    // the table whose modifiers include 0, used for blocks of one alpha
+    const int ALPHA_FLAT_TABLE = 13;
+    const int ALPHA_FLAT_INDEX = 4;
+
+    inline int clamp_byte(int v)
+    {
+        return std::min(std::max(v, 0), 255);
+    }
+
+    // expands a quantized channel to 8 bits by repeating its high bits
+    inline int extend(int v, int bits)
+    {
+        v <<= 8 - bits;
+        return v | v >> bits;
+    }
+
+    // blocks are big endian 64 bit words
+    inline void put_u64be(uint8_t* dst, uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            dst[i] = value >> (56 - 8 * i);
+    }
+
+    // index bits are ordered down the columns of the block
+    inline int bit_position(int x, int y)
+    {
+        return x * 4 + y;
+    }
+}
+
+////////////////////////////////////
+//
+// individual and differential
+// modes, two halves of 8 pixels
+//
+
+namespace
+{
+    // the 2x4 (or when flipped 4x2) pixels sharing a base color
+    struct half_block
+    {
+        int         rgb[HALF_PIXELS][3];
+        int         pos[HALF_PIXELS];
+        int         sum[3];
+    };
+
+    struct half_fit
+    {
+        int         base[3];
+        int         table;
+        uint8_t     indices[HALF_PIXELS];
+        int         error;
+    };
+
+    void split_block(const uint8_t* pixels, bool flip, half_block halves[2])
+    {
+        int count[2] = {};
+        halves[0] = halves[1] = {};
+        for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+        {
+            int h = flip ? y >> 1 : x >> 1;
+            half_block& half = halves[h];
+            int i = count[h]++;
+            for (int c = 0; c < 3; c++)
+            {
+                half.rgb[i][c] = pixels[(y * 4 + x) * CHANNELS + c];
+                half.sum[c] += half.rgb[i][c];
+            }
+            half.pos[i] = bit_position(x, y);
+        }
+    }
+
+    /**
+     * @brief           Picks the modifier table and indices that best fit
+     *                  a half block around a base color
+     *
+     * @param half      Pixels of the half block
+     * @param fit       Quantized base color in, table, indices and error out
+     * @param bits      Bits per channel of the base color
+     */
+    void fit_table(const half_block& half, half_fit& fit, int bits)
+    {
+        int color[3];
+        for (int c = 0; c < 3; c++)
+            color[c] = extend(fit.base[c], bits);
+
+        fit.error = INT_MAX;
+        for (int t = 0; t < 8 && fit.error > 0; t++)
+        {
+            const int offsets[4] = { modifiers[t][0], modifiers[t][1], -modifiers[t][0], -modifiers[t][1] };
+            int palette[4][3];
+            for (int k = 0; k < 4; k++)
+            for (int c = 0; c < 3; c++)
+                palette[k][c] = clamp_byte(color[c] + offsets[k]);
+
+            int error = 0;
+            uint8_t indices[HALF_PIXELS];
+            for (int i = 0; i < HALF_PIXELS && error < fit.error; i++)
+            {
+                int best = INT_MAX;
+                for (int k = 0; k < 4; k++)
+                {
+                    int e = 0;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int d = palette[k][c] - half.rgb[i][c];
+                        e += d * d;
+                    }
+                    if (e < best)
+                    {
+                        best = e;
+                        indices[i] = k;
+                    }
+                }
+                error += best;
+            }
+
+            if (error < fit.error)
+            {
+                fit.error = error;
+                fit.table = t;
+                memcpy(fit.indices, indices, sizeof(indices));
+            }
+        }
+    }
+
+    /**
+     * @brief           Fits the base colors worth trying for a half block,
+     *                  its quantized average and for THOROUGH every
+     *                  neighbouring step of each channel
+     *
+     * @param half      Pixels of the half block
+     * @param bits      Bits per channel of the base color
+     * @param effort    Search effort
+     * @param fits      Fitted candidates, at most 27
+     * @return int      Number of candidates
+     */
+    int fit_candidates(const half_block& half, int bits, Effort effort, half_fit fits[27])
+    {
+        int max = (1 << bits) - 1;
+        int q[3];
+        for (int c = 0; c < 3; c++)
+            q[c] = (half.sum[c] * max * 2 + 255 * HALF_PIXELS) / (255 * HALF_PIXELS * 2);
+
+        int step = effort == Effort::THOROUGH ? 1 : 0;
+        int count = 0;
+        for (int r = q[0] - step; r <= q[0] + step; r++)
+        for (int g = q[1] - step; g <= q[1] + step; g++)
+        for (int b = q[2] - step; b <= q[2] + step; b++)
+        {
+            if (r < 0 || g < 0 || b < 0 || r > max || g > max || b > max)
+                continue;
+            half_fit& fit = fits[count++];
+            fit.base[0] = r;
+            fit.base[1] = g;
+            fit.base[2] = b;
+            fit_table(half, fit, bits);
+        }
+        return count;
+    }
+
+    inline const half_fit& best_of(const half_fit* fits, int count)
+    {
+        return *std::min_element(fits, fits + count, [](const half_fit& a, const half_fit& b) { return a.error < b.error; });
+    }
+
+    // differential mode stores the second base as a 3 bit signed offset
+    inline bool in_reach(const half_fit& a, const half_fit& b)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int d = b.base[c] - a.base[c];
+            if (d < -4 || d > 3)
+                return false;
+        }
+        return true;
+    }
+
+    uint64_t pack_halves(const half_fit fits[2], const half_block halves[2], bool differential, bool flip)
+    {
+        uint64_t bits = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            if (differential)
+            {
+                bits |= (uint64_t)fits[0].base[c] << (59 - 8 * c);
+                bits |= (uint64_t)((fits[1].base[c] - fits[0].base[c]) & 7) << (56 - 8 * c);
+            }
+            else
+            {
+                bits |= (uint64_t)fits[0].base[c] << (60 - 8 * c);
+                bits |= (uint64_t)fits[1].base[c] << (56 - 8 * c);
+            }
+        }
+        bits |= (uint64_t)fits[0].table << 37 | (uint64_t)fits[1].table << 34;
+        bits |= (uint64_t)differential << 33 | (uint64_t)flip << 32;
+
+        // most significant index bits in the upper 16, least in the lower
+        for (int h = 0; h < 2; h++)
+        for (int i = 0; i < HALF_PIXELS; i++)
+        {
+            int index = fits[h].indices[i];
+            bits |= (uint64_t)(index >> 1) << (16 + halves[h].pos[i]);
+            bits |= (uint64_t)(index & 1) << halves[h].pos[i];
+        }
+        return bits;
+    }
+
+    /**
+     * @brief           Finds the best pair of differential base colors,
+     *                  the offset between them limits which pairs are valid,
+     *                  failing any pulls the second base within reach
+     *
+     * @param halves    Pixels of both halves
+     * @param fits0     Candidates of the first half
+     * @param count0    Number of candidates of the first half
+     * @param fits1     Candidates of the second half
+     * @param count1    Number of candidates of the second half
+     * @param out       Best pair
+     * @return int      Error of the pair
+     */
+    int pair_differential(const half_block halves[2], const half_fit* fits0, int count0, const half_fit* fits1, int count1, half_fit out[2])
+    {
+        int best = INT_MAX;
+        for (int i = 0; i < count0; i++)
+        for (int j = 0; j < count1; j++)
+        {
+            int error = fits0[i].error + fits1[j].error;
+            if (error < best && in_reach(fits0[i], fits1[j]))
+            {
+                best = error;
+                out[0] = fits0[i];
+                out[1] = fits1[j];
+            }
+        }
+        if (best < INT_MAX)
+            return best;
+
+        half_fit a = best_of(fits0, count0);
+        half_fit b = best_of(fits1, count1);
+        for (int c = 0; c < 3; c++)
+            b.base[c] = std::min(std::max(b.base[c], a.base[c] - 4), a.base[c] + 3);
+        fit_table(halves[1], b, 5);
+
+        out[0] = a;
+        out[1] = b;
+        return a.error + b.error;
+    }
+}
+
+////////////////////////////////////
+//
+// planar mode, a gradient between
+// colors at three corners
+//
+
+namespace
+{
+    const int PLANAR_BITS[3] = { 6, 7, 6 };
+
+    // decoded channel at (x, y) from the corner colors at (0, 0), (4, 0) and (0, 4)
+    inline int planar_value(int o, int h, int v, int x, int y)
+    {
+        int value = x * (h - o) + y * (v - o) + 4 * o + 2;
+        return value < 0 ? 0 : std::min(value >> 2, 255);
+    }
+
+    /**
+     * @brief           Fits a plane through each channel of the block by
+     *                  least squares, then tries the neighbouring quantized
+     *                  corners of each channel
+     *
+     * @param pixels    Pixels of the block
+     * @param error     Error of the block
+     * @return uint64_t Block bits
+     */
+    uint64_t encode_planar(const uint8_t* pixels, int& error)
+    {
+        // normal equations of the plane's weights at each pixel,
+        // the same for every block so they are inverted once
+        static const auto inverse = []
+        {
+            double m[3][3] = {};
+            for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+            {
+                double f[3] = { 1 - x / 4.0 - y / 4.0, x / 4.0, y / 4.0 };
+                for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    m[i][j] += f[i] * f[j];
+            }
+            std::array<std::array<double, 3>, 3> inv;
+            double det =
+                m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+            {
+                int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+                int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+                inv[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+            }
+            return inv;
+        }();
+
+        int corners[3][3];
+        error = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            double rhs[3] = {};
+            for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+            {
+                double p = pixels[(y * 4 + x) * CHANNELS + c];
+                rhs[0] += (1 - x / 4.0 - y / 4.0) * p;
+                rhs[1] += x / 4.0 * p;
+                rhs[2] += y / 4.0 * p;
+            }
+
+            int bits = PLANAR_BITS[c];
+            int max = (1 << bits) - 1;
+            int q[3];
+            for (int i = 0; i < 3; i++)
+            {
+                double value = inverse[i][0] * rhs[0] + inverse[i][1] * rhs[1] + inverse[i][2] * rhs[2];
+                q[i] = (int)std::lround(std::min(std::max(value, 0.0), 255.0) * max / 255);
+            }
+
+            int best = INT_MAX;
+            for (int o = std::max(q[0] - 1, 0); o <= std::min(q[0] + 1, max); o++)
+            for (int h = std::max(q[1] - 1, 0); h <= std::min(q[1] + 1, max); h++)
+            for (int v = std::max(q[2] - 1, 0); v <= std::min(q[2] + 1, max); v++)
+            {
+                int eo = extend(o, bits), eh = extend(h, bits), ev = extend(v, bits);
+                int e = 0;
+                for (int y = 0; y < 4 && e < best; y++)
+                for (int x = 0; x < 4; x++)
+                {
+                    int d = planar_value(eo, eh, ev, x, y) - pixels[(y * 4 + x) * CHANNELS + c];
+                    e += d * d;
+                }
+                if (e < best)
+                {
+                    best = e;
+                    corners[0][c] = o;
+                    corners[1][c] = h;
+                    corners[2][c] = v;
+                }
+            }
+            error += best;
+        }
+
+        const int* o = corners[0];
+        const int* h = corners[1];
+        const int* v = corners[2];
+        uint8_t b[8];
+        b[0] = o[0] << 1 | o[1] >> 6;
+        b[1] = (o[1] & 0x3f) << 1 | o[2] >> 5;
+        b[2] = (o[2] >> 3 & 3) << 3 | (o[2] >> 1 & 3);
+        b[3] = (o[2] & 1) << 7 | (h[0] >> 1) << 2 | 1 << 1 | (h[0] & 1);
+        b[4] = h[1] << 1 | h[2] >> 5;
+        b[5] = (h[2] & 0x1f) << 3 | v[0] >> 3;
+        b[6] = (v[0] & 7) << 5 | v[1] >> 2;
+        b[7] = (v[1] & 3) << 6 | v[2];
+
+        // planar blocks are differential blocks whose blue overflows while
+        // red and green do not, the unused bits are set to make it so
+        auto overflows = [](uint8_t byte)
+        {
+            int base  = byte >> 3;
+            int delta = (byte & 3) - (byte & 4);
+            return base + delta < 0 || base + delta > 31;
+        };
+        if (overflows(b[0]))
+            b[0] |= 0x80;
+        if (overflows(b[1]))
+            b[1] |= 0x80;
+        if (!overflows(b[2] | 0xe0))
+            b[2] |= 0x04;
+        else
+            b[2] |= 0xe0;
+
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++)
+            bits = bits << 8 | b[i];
+        return bits;
+    }
+}
+
+////////////////////////////////////
+//
+// color and alpha blocks
+//
+
+namespace
+{
+    void encode_color(const uint8_t* pixels, uint8_t* out, Effort effort)
+    {
+        uint64_t best_bits = 0;
+        int best = INT_MAX;
+
+        for (int flip = 0; flip < 2 && best > 0; flip++)
+        {
+            half_block halves[2];
+            split_block(pixels, flip, halves);
+
+            half_fit fits[2];
+            half_fit individual[2][27];
+            half_fit differential[2][27];
+            int counts[2];
+
+            // individual mode, a 4 bit base color per half
+            for (int h = 0; h < 2; h++)
+            {
+                counts[h] = fit_candidates(halves[h], 4, effort, individual[h]);
+                fits[h] = best_of(individual[h], counts[h]);
+            }
+            int error = fits[0].error + fits[1].error;
+            if (error < best)
+            {
+                best = error;
+                best_bits = pack_halves(fits, halves, false, flip);
+            }
+
+            // differential mode, 5 bit base colors near each other
+            for (int h = 0; h < 2; h++)
+                counts[h] = fit_candidates(halves[h], 5, effort, differential[h]);
+            error = pair_differential(halves, differential[0], counts[0], differential[1], counts[1], fits);
+            if (error < best)
+            {
+                best = error;
+                best_bits = pack_halves(fits, halves, true, flip);
+            }
+        }
+
+        if (effort == Effort::THOROUGH && best > 0)
+        {
+            int error;
+            uint64_t bits = encode_planar(pixels, error);
+            if (error < best)
+                best_bits = bits;
+        }
+        put_u64be(out, best_bits);
+    }
+
+    int fit_alpha(const int* alphas, int base, int table, int multiplier, int limit, uint8_t* indices)
+    {
+        int values[8];
+        for (int k = 0; k < 8; k++)
+            values[k] = clamp_byte(base + alpha_modifiers[table][k] * multiplier);
+
+        int error = 0;
+        for (int i = 0; i < BLOCK_PIXELS && error < limit; i++)
+        {
+            int best = INT_MAX;
+            for (int k = 0; k < 8; k++)
+            {
+                int d = values[k] - alphas[i];
+                if (d * d < best)
+                {
+                    best = d * d;
+                    indices[i] = k;
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+    /**
+     * @brief           Encodes the alpha of the block as eac, for each table
+     *                  the multiplier spanning the block's alpha range and
+     *                  the base centering it, THOROUGH also tries neighbours
+     *
+     * @param pixels    Pixels of the block
+     * @param out       8 byte block
+     * @param effort    Search effort
+     */
+    void encode_alpha(const uint8_t* pixels, uint8_t* out, Effort effort)
+    {
+        // indices run down the columns
+        int alphas[BLOCK_PIXELS];
+        for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+            alphas[bit_position(x, y)] = pixels[(y * 4 + x) * CHANNELS + 3];
+
+        int lo = *std::min_element(alphas, alphas + BLOCK_PIXELS);
+        int hi = *std::max_element(alphas, alphas + BLOCK_PIXELS);
+
+        int best_base = lo, best_table = ALPHA_FLAT_TABLE, best_multiplier = 1;
+        uint8_t best_indices[BLOCK_PIXELS];
+        memset(best_indices, ALPHA_FLAT_INDEX, sizeof(best_indices));
+
+        int best = lo == hi ? 0 : INT_MAX;
+        int step = effort == Effort::THOROUGH ? 1 : 0;
+        for (int t = 0; t < 16 && best > 0; t++)
+        {
+            int low  = alpha_modifiers[t][3];
+            int high = alpha_modifiers[t][7];
+            int estimate = std::min(std::max((hi - lo + (high - low) / 2) / (high - low), 1), 15);
+            for (int m = std::max(estimate - step, 1); m <= std::min(estimate + step, 15); m++)
+            {
+                int center = (int)std::lround((lo + hi) / 2.0 - (low + high) * m / 2.0);
+                for (int base = std::max(center - step, 0); base <= std::min(center + step, 255); base++)
+                {
+                    uint8_t indices[BLOCK_PIXELS];
+                    int error = fit_alpha(alphas, base, t, m, best, indices);
+                    if (error < best)
+                    {
+                        best = error;
+                        best_base = base;
+                        best_table = t;
+                        best_multiplier = m;
+                        memcpy(best_indices, indices, sizeof(indices));
+                    }
+                }
+            }
+        }
+
+        uint64_t bits = (uint64_t)best_base << 56 | (uint64_t)best_multiplier << 52 | (uint64_t)best_table << 48;
+        for (int i = 0; i < BLOCK_PIXELS; i++)
+            bits |= (uint64_t)best_indices[i] << (45 - 3 * i);
+        put_u64be(out, bits);
+    }
+}
+
+////////////////////////////////////
+//
+// etc2 api
+//
+
+void blocs__atlas::encode_etc2(const uint8_t* pixels, uint8_t* out, Effort effort)
+{
+    encode_alpha(pixels, out, effort);
+    encode_color(pixels, out + 8, effort);
+}
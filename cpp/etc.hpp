@@ -0,0 +1,32 @@
+
+#pragma once
+
+#include <cstdint>
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // etc2 rgba8 compression of 4x4
+    // pixel blocks, eac alpha + etc2 rgb
+    //
+
+    // how hard the etc2 encoder searches, FAST quantizes the average color
+    // of each half block, THOROUGH also tries the neighbouring base colors
+    // and the planar mode for smooth gradients
+    enum class Effort
+    {
+        FAST,
+        THOROUGH,
+    };
+
+    /**
+     * @brief           Encodes 16 RGBA pixels (row major) as an ETC2 RGBA8
+     *                  block, an EAC alpha block followed by an ETC2 color block
+     *
+     * @param pixels    Pixels of the block
+     * @param out       16 byte block
+     * @param effort    How many base colors and modes are searched
+     */
+    void encode_etc2(const uint8_t* pixels, uint8_t* out, Effort effort);
+}
@@ -0,0 +1,227 @@
+
+#include "ktx.hpp"
+
+#define KTX_HEADER_SIZE     80
+#define KTX_LEVEL_SIZE      24
+
+#define VK_FORMAT_R8G8B8A8_UNORM        37
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK  133
+#define VK_FORMAT_BC3_UNORM_BLOCK       137
+#define VK_FORMAT_BC7_UNORM_BLOCK       145
+#define VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK 151
+#define VK_FORMAT_ASTC_4x4_UNORM_BLOCK  157
+
+#define KHR_DF_MODEL_BC1A   128
+#define KHR_DF_MODEL_BC3    130
+#define KHR_DF_MODEL_BC7    134
+#define KHR_DF_MODEL_ETC2   161
+#define KHR_DF_MODEL_ASTC   162
+#define KHR_DF_CHANNEL_COLOR 0
+#define KHR_DF_CHANNEL_BC1A_ALPHAPRESENT 1
+#define KHR_DF_CHANNEL_ETC2_COLOR 2
+#define KHR_DF_CHANNEL_ALPHA 15
+
+using namespace blocs__atlas;
+
+namespace
+{
+    inline void put_u16le(std::vector<uint8_t>& out, uint16_t value)
+    {
+        out.push_back(value);
+        out.push_back(value >> 8);
+    }
+
+    inline void put_u32le(std::vector<uint8_t>& out, uint32_t value)
+    {
+        put_u16le(out, value);
+        put_u16le(out, value >> 16);
+    }
+
+    inline void put_u64le(std::vector<uint8_t>& out, uint64_t value)
+    {
+        put_u32le(out, value);
+        put_u32le(out, value >> 32);
+    }
+
+    struct sample
+    {
+        uint16_t    offset;
+        uint16_t    bits;
+        uint8_t     channel;
+    };
+
+    /**
+     * @brief           Builds the data format descriptor of a block
+     *                  compressed format, one basic descriptor block
+     *                  with a sample per compressed plane of the block
+     */
+    std::vector<uint8_t> format_descriptor(Format format, const footprint& block)
+    {
+        uint8_t model;
+        std::vector<sample> samples;
+        switch (format)
+        {
+        case Format::BC1:
+            // blocks may use punch-through alpha, as the rgba vk format says
+            model = KHR_DF_MODEL_BC1A;
+            samples = { { 0, 64, KHR_DF_CHANNEL_BC1A_ALPHAPRESENT } };
+            break;
+        case Format::BC3:
+            model = KHR_DF_MODEL_BC3;
+            samples = { { 0, 64, KHR_DF_CHANNEL_ALPHA }, { 64, 64, KHR_DF_CHANNEL_COLOR } };
+            break;
+        case Format::ETC2:
+            model = KHR_DF_MODEL_ETC2;
+            samples = { { 0, 64, KHR_DF_CHANNEL_ALPHA }, { 64, 64, KHR_DF_CHANNEL_ETC2_COLOR } };
+            break;
+        case Format::ASTC:
+            model = KHR_DF_MODEL_ASTC;
+            samples = { { 0, 128, KHR_DF_CHANNEL_COLOR } };
+            break;
+        default:
+            model = KHR_DF_MODEL_BC7;
+            samples = { { 0, 128, KHR_DF_CHANNEL_COLOR } };
+            break;
+        }
+
+        std::vector<uint8_t> dfd;
+        uint16_t block_size = 24 + 16 * samples.size();
+        put_u32le(dfd, 4 + block_size);
+        put_u32le(dfd, 0);                  // khronos vendor, basic descriptor
+        put_u16le(dfd, 2);                  // version
+        put_u16le(dfd, block_size);
+        dfd.push_back(model);
+        dfd.push_back(1);                   // bt.709 primaries
+        dfd.push_back(1);                   // linear transfer
+        dfd.push_back(0);                   // straight alpha
+        dfd.insert(dfd.end(), { (uint8_t)(block.w - 1), (uint8_t)(block.h - 1), 0, 0 });
+        dfd.push_back(block_bytes(format));
+        dfd.insert(dfd.end(), 7, 0);
+        for (const auto& s : samples)
+        {
+            put_u16le(dfd, s.offset);
+            dfd.push_back(s.bits - 1);
+            dfd.push_back(s.channel);
+            put_u32le(dfd, 0);              // sample position
+            put_u32le(dfd, 0);
+            put_u32le(dfd, UINT32_MAX);
+        }
+        return dfd;
+    }
+
+    // unorm astc formats follow each other in order of footprint,
+    // each followed by its srgb twin
+    uint32_t astc_format(const footprint& block)
+    {
+        static const int sizes[][2] = { { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 }, { 8, 8 } };
+        int i = 0;
+        while (sizes[i][0] != block.w || sizes[i][1] != block.h)
+            i++;
+        return VK_FORMAT_ASTC_4x4_UNORM_BLOCK + 2 * i;
+    }
+}
+
+uint32_t blocs__atlas::vk_format(Format format, const bc_options& options)
+{
+    switch (format)
+    {
+    case Format::RGBA8: return VK_FORMAT_R8G8B8A8_UNORM;
+    case Format::BC1:   return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    case Format::BC3:   return VK_FORMAT_BC3_UNORM_BLOCK;
+    case Format::BC7:   return VK_FORMAT_BC7_UNORM_BLOCK;
+    case Format::ETC2:  return VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK;
+    case Format::ASTC:  return astc_format(options.astc);
+    default:            return 0;
+    }
+}
+
+////////////////////////////////////
+//
+// ktx2 writer
+//
+
+/**
+ * @brief           Opens a ktx2 file and writes its header, pixel
+ *                  rows are then streamed in with write_rows
+ *
+ * @param output    Output file
+ * @param w         Image width
+ * @param h         Image height
+ * @param format    Block compressed format
+ * @param options   Endpoint fitting method, bc7 quality and thread count
+ * @param levels    Mip levels
+ * @param layers    Array layers, 1 for a plain 2d texture
+ */
+ktx2_writer::ktx2_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels, int layers)
+    : block_writer(w, h, block_footprint(format, options).h, levels, layers), m_stream(output, std::ios::out | std::ios::binary | std::ios::trunc),
+      m_format(format), m_options(options)
+{
+    m_good = m_good && block_bytes(format) > 0 && m_stream.is_open();
+    if (!m_good)
+        return;
+    m_offsets.resize(levels);
+    m_written.resize(levels);
+
+    footprint block = block_footprint(format, options);
+    std::vector<uint8_t> dfd = format_descriptor(format, block);
+    uint32_t dfd_offset = KTX_HEADER_SIZE + KTX_LEVEL_SIZE * levels;
+
+    // levels are stored smallest first, each aligned to the block size
+    std::vector<uint64_t> sizes(levels);
+    uint64_t align = block_bytes(format);
+    uint64_t offset = dfd_offset + dfd.size();
+    for (int l = levels - 1; l >= 0; l--)
+    {
+        uint64_t columns = (level_size(w, l) + block.w - 1) / block.w;
+        uint64_t rows = (level_size(h, l) + block.h - 1) / block.h;
+        sizes[l] = columns * rows * block_bytes(format) * layers;
+        m_offsets[l] = (offset + align - 1) / align * align;
+        offset = m_offsets[l] + sizes[l];
+    }
+
+    std::vector<uint8_t> header = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+    put_u32le(header, vk_format(format, options));
+    put_u32le(header, 1);                   // type size of compressed formats
+    put_u32le(header, w);
+    put_u32le(header, h);
+    put_u32le(header, 0);                   // depth
+    put_u32le(header, layers > 1 ? layers : 0);
+    put_u32le(header, 1);                   // faces
+    put_u32le(header, levels);
+    put_u32le(header, 0);                   // no supercompression
+    put_u32le(header, dfd_offset);
+    put_u32le(header, dfd.size());
+    put_u32le(header, 0);                   // no key/value data
+    put_u32le(header, 0);
+    put_u64le(header, 0);                   // no supercompression data
+    put_u64le(header, 0);
+
+    for (int l = 0; l < levels; l++)
+    {
+        put_u64le(header, m_offsets[l]);
+        put_u64le(header, sizes[l]);
+        put_u64le(header, sizes[l]);
+    }
+
+    header.insert(header.end(), dfd.begin(), dfd.end());
+    header.resize(m_offsets[levels - 1], 0);
+    m_stream.write((const char*)header.data(), header.size());
+}
+
+// the first level streams in at the end of the file while the smaller
+// levels, each encoded whole once a layer is done, fill in before it
+void ktx2_writer::encode(int level, int, const uint8_t* pixels, int w, int rows)
+{
+    footprint block = block_footprint(m_format, m_options);
+    m_blocks.resize((std::size_t)((w + block.w - 1) / block.w) * ((rows + block.h - 1) / block.h) * block_bytes(m_format));
+    encode_blocks(m_format, pixels, w, rows, m_blocks.data(), m_options);
+    m_stream.seekp(m_offsets[level] + m_written[level]);
+    m_stream.write((const char*)m_blocks.data(), m_blocks.size());
+    m_written[level] += m_blocks.size();
+}
+
+bool ktx2_writer::close()
+{
+    m_stream.close();
+    return !m_stream.fail();
+}
@@ -0,0 +1,50 @@
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bc.hpp"
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // ktx2 files of block compressed
+    // textures, encoded a band at a time
+    // with optional mips and array layers
+    //
+
+    /**
+     * @brief           Gets the VkFormat that pixels of a format
+     *                  are uploaded as, unorm rather than srgb
+     *
+     * @param format    Uncompressed or block compressed format
+     * @param options   Options holding the astc footprint
+     * @return uint32_t 0 for png and qoi, which have none
+     */
+    uint32_t vk_format(Format format, const bc_options& options);
+
+    class ktx2_writer : public block_writer
+    {
+    public:
+        ktx2_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels = 1, int layers = 1);
+
+    private:
+        std::ofstream m_stream;
+        Format      m_format;
+        bc_options  m_options;
+        std::vector<uint8_t> m_blocks;
+
+        // where each level starts and how much of it is written,
+        // layers of a level follow one another
+        std::vector<uint64_t> m_offsets;
+        std::vector<uint64_t> m_written;
+
+        void encode(int level, int layer, const uint8_t* pixels, int w, int rows) override;
+        bool close() override;
+    };
+}
@@ -0,0 +1,321 @@
+
+#include "lz4.hpp"
+#include "thread.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5
+#define MATCH_LIMIT     12      // matches start at least this far from the end
+#define MAX_OFFSET      65535
+#define HASH_BITS       12
+#define SKIP_SHIFT      6       // misses before the search step grows
+
+using namespace blocs__atlas;
+
+namespace
+{
+    inline uint32_t read32(const uint8_t* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint32_t hash4(uint32_t v)
+    {
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    /**
+     * @brief           Counts matching bytes between two positions
+     *                  eight bytes at a time
+     */
+    inline std::size_t match_length(const uint8_t* a, const uint8_t* b, std::size_t max_len)
+    {
+        std::size_t len = 0;
+        while (len + 8 <= max_len)
+        {
+            uint64_t x, y;
+            memcpy(&x, a + len, 8);
+            memcpy(&y, b + len, 8);
+            if (x != y)
+                return len + (__builtin_ctzll(x ^ y) >> 3);
+            len += 8;
+        }
+        while (len < max_len && a[len] == b[len])
+            len++;
+        return len;
+    }
+
+    // lengths past what fits in the token continue
+    // in bytes of 255 ended by one below it
+    inline uint8_t* put_length(uint8_t* out, std::size_t len)
+    {
+        for (; len >= 255; len -= 255)
+            *out++ = 255;
+        *out++ = len;
+        return out;
+    }
+
+    inline bool get_length(const uint8_t*& in, const uint8_t* end, std::size_t& len)
+    {
+        uint8_t byte;
+        do
+        {
+            if (in >= end)
+                return false;
+            byte = *in++;
+            len += byte;
+        }
+        while (byte == 255);
+        return true;
+    }
+
+    /**
+     * @brief           Writes a sequence of literals followed by a match,
+     *                  the last sequence of a block has no match
+     *
+     * @param out       Output
+     * @param literals  Literals
+     * @param count     Number of literals
+     * @param offset    Distance back to the match
+     * @param length    Length of the match, 0 for none
+     * @return uint8_t* End of the sequence
+     */
+    uint8_t* put_sequence(uint8_t* out, const uint8_t* literals, std::size_t count, std::size_t offset, std::size_t length)
+    {
+        uint8_t* token = out++;
+        *token = std::min<std::size_t>(count, 15) << 4;
+        if (count >= 15)
+            out = put_length(out, count - 15);
+        memcpy(out, literals, count);
+        out += count;
+
+        if (length == 0)
+            return out;
+
+        *out++ = offset;
+        *out++ = offset >> 8;
+        length -= MIN_MATCH;
+        *token |= std::min<std::size_t>(length, 15);
+        if (length >= 15)
+            out = put_length(out, length - 15);
+        return out;
+    }
+}
+
+////////////////////////////////////
+//
+// lz4 blocks
+//
+
+std::size_t blocs__atlas::lz4_compress(const uint8_t* data, std::size_t len, uint8_t* out)
+{
+    uint8_t* op = out;
+    std::size_t anchor = 0;
+
+    if (len > MATCH_LIMIT)
+    {
+        // positions of the last sequence seen with each hash,
+        // stale or colliding entries are caught by the compare
+        uint32_t table[1 << HASH_BITS] = {};
+        std::size_t limit = len - MATCH_LIMIT;
+        std::size_t pos = 1;
+        std::size_t misses = 1 << SKIP_SHIFT;
+
+        while (pos <= limit)
+        {
+            uint32_t seq = read32(data + pos);
+            uint32_t& slot = table[hash4(seq)];
+            std::size_t ref = slot;
+            slot = pos;
+
+            if (pos - ref > MAX_OFFSET || read32(data + ref) != seq)
+            {
+                // step further the longer nothing matches,
+                // so incompressible data is skipped quickly
+                pos += misses++ >> SKIP_SHIFT;
+                continue;
+            }
+
+            while (pos > anchor && ref > 0 && data[pos - 1] == data[ref - 1])
+            {
+                pos--;
+                ref--;
+            }
+
+            std::size_t max_len = len - LAST_LITERALS - pos - MIN_MATCH;
+            std::size_t length = MIN_MATCH + match_length(data + pos + MIN_MATCH, data + ref + MIN_MATCH, max_len);
+            op = put_sequence(op, data + anchor, pos - anchor, pos - ref, length);
+
+            pos += length;
+            anchor = pos;
+            misses = 1 << SKIP_SHIFT;
+            if (pos <= limit)
+                table[hash4(read32(data + pos - 2))] = pos - 2;
+        }
+    }
+
+    op = put_sequence(op, data + anchor, len - anchor, 0, 0);
+    return op - out;
+}
+
+bool blocs__atlas::lz4_decompress(const uint8_t* data, std::size_t len, uint8_t* out, std::size_t out_len)
+{
+    const uint8_t* ip = data;
+    const uint8_t* end = data + len;
+    uint8_t* op = out;
+    uint8_t* out_end = out + out_len;
+
+    while (ip < end)
+    {
+        int token = *ip++;
+        std::size_t count = token >> 4;
+        if (count == 15 && !get_length(ip, end, count))
+            return false;
+        if ((std::size_t)(end - ip) < count || (std::size_t)(out_end - op) < count)
+            return false;
+        memcpy(op, ip, count);
+        ip += count;
+        op += count;
+
+        // the last sequence ends after its literals
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        std::size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (std::size_t)(op - out))
+            return false;
+
+        std::size_t length = token & 15;
+        if (length == 15 && !get_length(ip, end, length))
+            return false;
+        length += MIN_MATCH;
+        if ((std::size_t)(out_end - op) < length)
+            return false;
+
+        // overlapping matches repeat the last offset bytes, so copy
+        // the pattern in pieces that double as more of it is written,
+        // each read ending where its write begins
+        std::size_t step = offset;
+        for (std::size_t i = 0; i < length; step *= 2)
+        {
+            std::size_t n = std::min(step, length - i);
+            memcpy(op + i, op + i - step, n);
+            i += n;
+        }
+        op += length;
+    }
+    return op == out_end;
+}
+
+////////////////////////////////////
+//
+// chunked files
+//
+
+void blocs__atlas::lz4_compress_chunks(const uint8_t* data, std::size_t len, int threads, std::vector<uint8_t>& out)
+{
+    uint32_t chunks = (len + LZ4_CHUNK - 1) / LZ4_CHUNK;
+    std::vector<std::vector<uint8_t>> blocks(chunks);
+    parallel_for(chunks, threads, [&](int i, int)
+    {
+        std::size_t begin = (std::size_t)i * LZ4_CHUNK;
+        std::size_t size = std::min<std::size_t>(LZ4_CHUNK, len - begin);
+        blocks[i].resize(lz4_bound(size));
+        blocks[i].resize(lz4_compress(data + begin, size, blocks[i].data()));
+
+        // chunks that do not shrink are kept as they are
+        if (blocks[i].size() >= size)
+            blocks[i].assign(data + begin, data + begin + size);
+    });
+
+    lz4_header header = { LZ4_MAGIC, LZ4_VERSION, len, LZ4_CHUNK, chunks };
+    std::vector<lz4_chunk> table(chunks);
+    uint64_t offset = sizeof(lz4_header) + sizeof(lz4_chunk) * chunks;
+    for (uint32_t i = 0; i < chunks; i++)
+    {
+        table[i].offset = offset;
+        table[i].size = blocks[i].size();
+        table[i].raw_size = std::min<std::size_t>(LZ4_CHUNK, len - (std::size_t)i * LZ4_CHUNK);
+        offset += blocks[i].size();
+    }
+
+    out.resize(offset);
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + sizeof(header), table.data(), sizeof(lz4_chunk) * chunks);
+    for (uint32_t i = 0; i < chunks; i++)
+        memcpy(out.data() + table[i].offset, blocks[i].data(), blocks[i].size());
+}
+
+bool blocs__atlas::lz4_decompress_chunks(const uint8_t* data, std::size_t len, int threads, std::vector<uint8_t>& out)
+{
+    lz4_header header;
+    if (len < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LZ4_MAGIC || header.version != LZ4_VERSION || header.chunk_size == 0)
+        return false;
+    if (header.chunks != (header.size + header.chunk_size - 1) / header.chunk_size)
+        return false;
+    if ((len - sizeof(header)) / sizeof(lz4_chunk) < header.chunks)
+        return false;
+
+    std::vector<lz4_chunk> table(header.chunks);
+    memcpy(table.data(), data + sizeof(header), sizeof(lz4_chunk) * header.chunks);
+    for (uint32_t i = 0; i < header.chunks; i++)
+    {
+        uint64_t begin = (uint64_t)i * header.chunk_size;
+        if (table[i].raw_size != std::min<uint64_t>(header.chunk_size, header.size - begin))
+            return false;
+        if (table[i].offset > len || table[i].size > len - table[i].offset || table[i].size > table[i].raw_size)
+            return false;
+    }
+
+    out.resize(header.size);
+    std::atomic<bool> valid(true);
+    parallel_for(header.chunks, threads, [&](int i, int)
+    {
+        const lz4_chunk& chunk = table[i];
+        const uint8_t* in = data + chunk.offset;
+        uint8_t* dst = out.data() + (std::size_t)i * header.chunk_size;
+        if (chunk.size == chunk.raw_size)
+            memcpy(dst, in, chunk.size);
+        else if (!lz4_decompress(in, chunk.size, dst, chunk.raw_size))
+            valid = false;
+    });
+    return valid;
+}
+
+bool blocs__atlas::lz4_compress_file(const std::string& input, const std::string& output, int threads)
+{
+    std::vector<uint8_t> data;
+    {
+        std::ifstream stream(input, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!stream.is_open())
+            return false;
+        data.resize(stream.tellg());
+        stream.seekg(0);
+        stream.read((char*)data.data(), data.size());
+    }
+
+    std::vector<uint8_t> chunked;
+    lz4_compress_chunks(data.data(), data.size(), threads, chunked);
+
+    std::ofstream stream(output, std::ios::out | std::ios::binary | std::ios::trunc);
+    stream.write((const char*)chunked.data(), chunked.size());
+    stream.close();
+
+    // the input is only removed once its replacement is whole
+    if (stream.fail())
+        return false;
+    std::filesystem::remove(input);
+    return true;
+}
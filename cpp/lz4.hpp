@@ -0,0 +1,109 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define LZ4_MAGIC       0x345a4c42  // "BLZ4"
+#define LZ4_VERSION     1
+#define LZ4_CHUNK       (256 << 10)
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // lz4 block compression, and files
+    // split into chunks that decompress
+    // independently of one another
+    //
+
+    // a chunked file begins with this header, little endian, followed by
+    // a table of the chunks, then the chunks, each lz4 blocks of up to
+    // chunk_size bytes, or stored as is when size equals raw_size
+    struct lz4_header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint64_t    size;           // size of the whole decompressed file
+        uint32_t    chunk_size;
+        uint32_t    chunks;
+    };
+
+    struct lz4_chunk
+    {
+        uint64_t    offset;         // from the start of the file
+        uint32_t    size;
+        uint32_t    raw_size;
+    };
+
+    static_assert(sizeof(lz4_header) == 24 && sizeof(lz4_chunk) == 16, "lz4 tables must not be padded");
+
+    /**
+     * @brief           Gets the most bytes lz4_compress can
+     *                  write for an input of some length
+     *
+     * @param len       Length of the input
+     * @return std::size_t
+     */
+    inline std::size_t lz4_bound(std::size_t len)
+    {
+        return len + len / 255 + 16;
+    }
+
+    /**
+     * @brief           Compresses data as a single lz4 block
+     *
+     * @param data      Data to compress
+     * @param len       Length of the data, at most 2gb
+     * @param out       Output, lz4_bound(len) bytes
+     * @return std::size_t Length of the block
+     */
+    std::size_t lz4_compress(const uint8_t* data, std::size_t len, uint8_t* out);
+
+    /**
+     * @brief           Decompresses a single lz4 block, checking
+     *                  every read and write stays in bounds
+     *
+     * @param data      Block
+     * @param len       Length of the block
+     * @param out       Output
+     * @param out_len   Length the block decompresses to
+     * @return true     If the block decompressed to exactly out_len bytes
+     */
+    bool lz4_decompress(const uint8_t* data, std::size_t len, uint8_t* out, std::size_t out_len);
+
+    /**
+     * @brief           Compresses data as a chunked file, the
+     *                  chunks compressed across worker threads
+     *
+     * @param data      Data to compress
+     * @param len       Length of the data
+     * @param threads   Number of worker threads
+     * @param out       Chunked file
+     */
+    void lz4_compress_chunks(const uint8_t* data, std::size_t len, int threads, std::vector<uint8_t>& out);
+
+    /**
+     * @brief           Decompresses a chunked file, the chunks
+     *                  decompressed across worker threads
+     *
+     * @param data      Chunked file
+     * @param len       Length of the file
+     * @param threads   Number of worker threads
+     * @param out       Decompressed data, resized to fit
+     * @return true     If the file and every chunk were valid
+     */
+    bool lz4_decompress_chunks(const uint8_t* data, std::size_t len, int threads, std::vector<uint8_t>& out);
+
+    /**
+     * @brief           Replaces a file with its chunked compression
+     *
+     * @param input     File to compress, removed once compressed
+     * @param output    Chunked file
+     * @param threads   Number of worker threads
+     * @return true     If the input was read and the output written
+     */
+    bool lz4_compress_file(const std::string& input, const std::string& output, int threads);
+}
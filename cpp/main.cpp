@@ -40,10 +40,34 @@ options:
     -i  --input             sets input directory
     -o  --output            sets output file name and directory
     -v  --verbose           print atlas state to the console
+        --json-compact      write the json without any whitespace
+        --quad-format       uvs and offsets of each sprite's quad in the binary output (float|unorm16|none)
+        --emit-header       also write a C++ header of constexpr sprite ids, rects, uvs and names
+        --huge-pages        back pixel memory with huge pages
     -u  --unique            remove duplicates from the atlas (TODO...)
     -e  --expand            repeat pixels along image edges
+        --expand-mode       how expanded edges are filled (clamp|wrap|mirror|none)
+        --manifest          per-sprite expand mode overrides ("name mode" per line)
     -b  --border            empty border space between images
     -s  --size              sets atlas size (width and height equal)
+        --stream            composite and write the output in bands of rows
+        --png-level         png compression level from 0 (none) to 9 (smallest)
+        --png-filter        png row filter (auto|none|sub|up|avg|paeth)
+        --png-max           smallest png, tries every filter strategy and parses optimally (slow, not with --stream)
+        --format            output format (png|qoi|rgba8|bc1|bc3|bc7|etc2|astc), rgba8 is always raw
+        --container         file for block compressed formats (dds|ktx2|raw), etc2 and astc are never dds
+        --bc-fit            bc1/bc3 endpoint fitting (range|cluster)
+        --bc7-quality       bc7 search effort (fast|normal|full)
+        --etc2-effort       etc2 search effort (fast|thorough)
+        --astc-block        astc footprint, sprites are aligned to it (4x4|5x4|5x5|6x5|6x6|8x5|8x6|8x8)
+        --astc-quality      astc search effort (fast|normal|full)
+        --mips              write the full mip chain of block compressed and rgba8 formats
+        --lz4               compress raw, dds and ktx2 files in independent lz4 chunks (.blz)
+        --delta-from        previous atlas (png|qoi|raw) to write a patch of the changed tiles against (.bpatch)
+        --apply-patch       apply a patch to the --delta-from atlas and save the result, without packing
+        --bench-reader      time cold and warm opens and lookups of a packed .dat (and its .raw), without packing
+        --bench-alloc       time the runtime allocator allocating and freeing glyphs in an atlas of --size, without packing
+    -j  --threads           number of worker threads (defaults to one per core)
     -d  --demo              generates random boxes (exclude first arg)
 */
 
@@ -52,408 +76,265 @@ options:
 using namespace blocs__atlas;
 
 ////////////////////////////////////
-//
-// image loading, unloading, saving
-// and pixel data manipulation
-//
-
-image::image() {}
-
-/**
- * @brief       Creates an empty image of a size
- *              to have pixels added later
- * 
- * @param w     Image width
- * @param h     Image height
- */
-image::image(int32_t w, int32_t h)
-    : w(w), h(h)
-{
-    data = new uint8_t[w * h * CHANNELS];
-}
 
-/**
- * @brief       Reads RGBA pixel data from an image located
- *              at the provided file path
- * 
- * @param path  File path to read from
- * @return      true false 
- */
-bool image::load(const std::string& path)
+namespace
 {
-    int bpp;
-    data = stbi_load(path.c_str(), &w, &h, &bpp, CHANNELS);
-    return data != nullptr;
-}
+    std::string     input_dir;
+    std::string     output_dir;
+    std::string     output_name;
 
-/**
- * @brief       Frees bitmaps data from memory
- */
-void image::unload()
-{
-    log_assert(data != nullptr, "cannot dispose an unloaded image");
-    stbi_image_free(data);
-}
+    bool            log_verbose;
+    bool            is_demo;
+    bool            is_stream;
+    bool            json_compact;
+    Quads           quad_format;
 
-/**
- * @brief       Fills a bitmap's pixel data with transparent
- *              empty pixels (RGBA of 0U)
- */
-void image::clear()
-{
-    data = new uint8_t[w * h * CHANNELS];
-    memset(data, 0U, w * h * CHANNELS * sizeof(uint8_t));
-}
+    int32_t         atlas_size;
+    int32_t         atlas_expand;
+    Expand          atlas_expand_mode;
+    int32_t         atlas_border;
+    bool            atlas_unique;
 
-/**
- * @brief       Blits pixel data onto a portion on a bitmap
- * 
- * @param pxls  New pixel data
- * @param dst   Destination rect on the image
- */
-void image::set_pixels(uint8_t* pxls, const rect& dst)
-{
-    log_assert(dst.x + dst.w <= w && dst.y + dst.h <= h,
-        "new pixels (%dpx, %dpx) cannot be larger than image (%dpx, %dpx)",
-        dst.w, dst.y, w, h);
+    std::unique_ptr<atlas> packer;
+    const image*    atlas_bmp;
+    bool            huge_pages;
 
-    for (int y = 0; y < dst.h; y++)
+    std::vector<image> images;
+    std::unordered_set<std::size_t> hashes;
+    std::unordered_map<std::string, Expand> expand_overrides;
+
+    Format          format;
+    Container       container;
+    png_options     png;
+    bc_options      bc;
+    bool            mips;
+    bool            lz4;
+    int32_t         threads;
+
+    std::string     delta_from;
+    std::string     patch_file;
+    std::string     header_file;
+    std::string     bench_file;
+    bool            bench_alloc;
+
+    /**
+     * @brief           Opens a writer of the output format and container,
+     *                  adding the file extension to the output path
+     * 
+     * @param texture   Output path without extension, extended in place
+     * @param w         Image width
+     * @param h         Image height
+     * @param levels    Mip levels of block compressed and rgba8 formats
+     * @return std::unique_ptr<row_writer> 
+     */
+    std::unique_ptr<row_writer> open_writer(std::string& texture, int w, int h, int levels)
     {
-        int from = y * dst.w;
-        int to = dst.x + (dst.y + y) * w;
-        memcpy(
-            data + to * CHANNELS,
-            pxls + from * CHANNELS,
-            dst.w * CHANNELS * sizeof(uint8_t)
-        );
+        if (format == Format::PNG)
+            return std::make_unique<png_writer>(texture += PNG_EXT, w, h, png);
+        if (format == Format::QOI)
+            return std::make_unique<qoi_writer>(texture += QOI_EXT, w, h);
+        if (container == Container::RAW)
+            return std::make_unique<raw_writer>(texture += RAW_EXT, w, h, format, bc, levels);
+        if (container == Container::DDS)
+            return std::make_unique<dds_writer>(texture += DDS_EXT, w, h, format, bc, levels);
+        return std::make_unique<ktx2_writer>(texture += KTX2_EXT, w, h, format, bc, levels);
     }
-}
 
-/**
- * @brief        Saves bitmap data as a png file
- * 
- * @param output Output directory
- */
-void image::save_png(const std::string& output)
-{
-    log_assert(data != nullptr, "cannot save unloaded image");
-    log_assert(w > 0 && h > 0, "image too small to save");
-	
-    // TODO: custom compression settings
-    stbi_write_force_png_filter = 0;
-    stbi_write_png_compression_level = 0;
-
-    stbi_write_png(output.c_str(), w, h, CHANNELS, data, w * CHANNELS);
-}
-
-/**
- * @brief       Generates a unique hash based on
- *              the pixels of a loaded bitmap
- */
-std::size_t image::generate_hash()
-{
-    std::size_t hash = 0;
-    int len = w * h * 4;
-    std::string str;
-    str.reserve(len);
-    for (int i = 0; i < len; i++)
-        str += std::to_string(data[i]);
-    hash ^= std::hash<std::string>{}(str) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-    return hash;
-}
-
-////////////////////////////////////
-//
-// texture atlas generation
-//
-
-/**
- * @brief               Creates a new atlas object
- * 
- * @param n             Number of expected textures to be added
- * @param size          Size of final atlas
- * @param expand        Amount of pixels to repeat on edges
- * @param border        Amount of empty space between bitmaps
- * @param unique        Whether to enforce unique bitmaps
- */
-atlas::atlas(std::size_t n, int size, int expand, int border)
-    : m_size(size), m_expand(expand), m_border(border)
-{
-    m_buffer = new uint8_t[size * size * CHANNELS];
-    m_buffer_index = 0U;
-    m_textures.reserve(n);
-}
-
-atlas::~atlas()
-{
-    m_bitmap->unload();
-    delete[] m_buffer;
-}
-
-/**
- * @brief               Adds a texture to the list of textures to be packed
- *                      and adds bitmap data to buffer
- * 
- * @param image         Image to be packed and bitmap data added to buffer
- */
-void atlas::add_texture(const image& image)
-{
-    log_assert(image.data != nullptr, "could not read texture data");
-    log_assert(image.w <= m_size && image.h <= m_size, "pixel data (%dpx, %dpx) too large for atlas (%dpx)",
-        image.w, image.h, m_size);
-
-    m_textures.push_back({
-        image.name,
-        { 0, 0, image.w, image.h },
-        m_buffer_index
-    });
-    uint32_t buffer_length = image.w * image.h * CHANNELS;
-    memcpy(m_buffer + m_buffer_index, image.data, buffer_length);
-    m_buffer_index += buffer_length;
-}
-
-/**
- * @brief               Packs bitmap rects into smallest possible
- *                      configuration and updates texture positions
- */
-void atlas::pack()
-{
-    int area  = 0;
-    int max_w = 0;
-    int max_h = 0;
-    int padding = m_expand * 2 + m_border;
-    for (int i = 0; i < m_textures.size(); i++)
+    // drops a file from the page cache, so the next open reads from disk,
+    // only linux can drop another open's pages, elsewhere cold opens are
+    // as warm as the cache leaves them
+    void evict_file(const std::string& path)
     {
-        rect rect = m_textures[i].rect;
-        area += (rect.w + padding) * (rect.h + padding);
-        max_w = std::max(max_w, rect.w + padding);
-        max_h = std::max(max_h, rect.h + padding);
+#if defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+#else
+        (void)path;
+#endif
     }
-    double suboptimal_coefficient = 0.85; // assumes sub-100% space utilization
-
-    log_assert(max_w <= m_size && max_h <= m_size,
-        "max size needed (%dpx, %dpx) larger than atlas size (%dpx)",
-        max_w, max_h, m_size);
-    log_assert(area <= m_size * m_size * suboptimal_coefficient,
-        "total area needed (%dpx) cannot fit in atlas size (%.fpx, AKA %d x %d with %.2f%% space utilization)",
-        area, m_size * m_size * suboptimal_coefficient, m_size, m_size, suboptimal_coefficient);
-
-    std::vector<rect> spaces = { { 0, 0, m_size, m_size } };
-
-    std::sort(m_textures.begin(), m_textures.end(), [](texture a, texture b)
-    {
-        return a.rect.h > b.rect.h;
-    });
 
-    for (auto& texture : m_textures)
+    /**
+     * @brief           Times the runtime reader on a packed atlas, opening it
+     *                  cold from disk and warm from the page cache, and looking
+     *                  up every texture by name, using the raw texture next
+     *                  to the metadata when there is one
+     *
+     * @param metadata  Binary metadata (.dat)
+     */
+    void bench_reader(const std::string& metadata)
     {
-        auto& rect = texture.rect;
-        log_assert(rect.w <= m_size && rect.h <= m_size,
-            "texture larger (%dpx, %dpx) than maximum size (%dpx)",
-            rect.w, rect.h, m_size);
-
-        for (int i = spaces.size() - 1; i >= 0; i--)
+        std::string texture = metadata.substr(0, metadata.size() - file_ext(metadata).size()) + RAW_EXT;
+        if (!std::filesystem::exists(texture))
+            texture.clear();
+
+        atlas_reader reader;
+        log_assert(reader.open(metadata, texture), "could not read atlas \"%s\"", metadata.c_str());
+        log_assert(reader.count() > 0, "atlas \"%s\" has no textures", metadata.c_str());
+        std::string key(reader.name(reader.count() / 2));
+        reader.close();
+
+        // each cold open maps the files and looks one name up, so
+        // it pays for the header, the hash and the texture pages
+        const int cold_runs = 8;
+        double cold = 0.0;
+        for (int run = 0; run < cold_runs; run++)
         {
-            auto space = spaces[i];
-
-            int w = rect.w + padding;
-            int h = rect.h + padding;
-
-            // check if image too large for space
-            if (w > space.w || h > space.h)
-                continue;
+            evict_file(metadata);
+            if (!texture.empty())
+                evict_file(texture);
+            double start = get_time_ms();
+            log_assert(reader.open(metadata, texture) && reader.find(key) != nullptr, "could not reopen \"%s\"", metadata.c_str());
+            cold += get_time_ms() - start;
+            reader.close();
+        }
 
-            // add image to space's top-left
-            // |-------|-------|
-            // |  box  |       |
-            // |_______|       |
-            // |         space |
-            // |_______________|
-            rect.x = space.x + m_expand;
-            rect.y = space.y + m_expand;
+        const int warm_runs = 1000;
+        double start = get_time_ms();
+        for (int run = 0; run < warm_runs; run++)
+        {
+            log_assert(reader.open(metadata, texture) && reader.find(key) != nullptr, "could not reopen \"%s\"", metadata.c_str());
+            reader.close();
+        }
+        double warm = get_time_ms() - start;
 
-            if (w == space.w && h == space.h)
-            {
-                // remove space if perfect fit
-                // |---------------|
-                // |               |
-                // |      box      |
-                // |               |
-                // |_______________|
-                auto last = spaces.back();
-                spaces.pop_back();
-                
-                if (i < spaces.size())
-                    spaces[i] = last;
-            }
-            else if (h == space.h)
-            {
-                // space matches image height
-                // move space right and cut off width
-                // |-------|---------------|
-                // |  box  | updated space |
-                // |_______|_______________|
-                space.x += w;
-                space.w -= w;
-                spaces[i] = space;
-            }
-            else if (w == space.w)
-            {
-                // space matches image width
-                // move space down and cut off height
-                // |---------------|
-                // |      box      |
-                // |_______________|
-                // | updated space |
-                // |_______________|
-                space.y += h;
-                space.h -= h;
-                spaces[i] = space;
-            }
-            else
-            {
-                // split width and height
-                // difference into two new spaces
-                // |-------|-----------|
-                // |  box  | new space |
-                // |_______|___________|
-                // | updated space     |
-                // |___________________|
-                spaces.push_back({
-                    space.x + w,
-                    space.y,
-                    space.w - w,
-                    h
-                });
-                space.y += h;
-                space.h -= h;
-                spaces[i] = space;
-            }
+        // every name must find a texture of that name,
+        // the first of them when names are repeated
+        log_assert(reader.open(metadata, texture), "could not reopen \"%s\"", metadata.c_str());
+        uint32_t count = reader.count();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const dat_texture* found = reader.find(reader.name(i));
+            log_assert(found != nullptr && reader.name(*found) == reader.name(i), "lookup of texture %u failed", i);
+        }
 
-            break;
+        uint32_t passes = std::max(1U, 1000000U / count);
+        volatile int32_t sink = 0;
+        start = get_time_ms();
+        for (uint32_t pass = 0; pass < passes; pass++)
+            for (uint32_t i = 0; i < count; i++)
+                sink = reader.find(reader.name(i))->x;
+        double lookups = get_time_ms() - start;
+        log_assert(sink >= 0, "lookup returned a negative position");
+
+        if (texture.empty())
+            log(Log::INFO, "Read \"%s\"", metadata.c_str());
+        else
+            log(Log::INFO, "Read \"%s\" and \"%s\"", metadata.c_str(), texture.c_str());
+        log(Log::INFO, " - Textures ................... %u", count);
+        if (reader.pixels() != nullptr)
+        {
+            page_view page = reader.page(0, 0);
+            log(Log::INFO, " - Pages ...................... %u x %u levels (%ux%u, %zu bytes)",
+                reader.pixels()->pages, reader.pixels()->levels, page.width, page.height, page.size);
         }
+        log(Log::INFO, " - Cold open .................. %.3fms", cold / cold_runs);
+        log(Log::INFO, " - Warm open .................. %.3fms", warm / warm_runs);
+        log(Log::INFO, " - Lookup ..................... %.1fns", lookups * 1e6 / ((double)passes * count));
+        reader.close();
     }
-}
-
-/**
- * @brief               Generates atlas texture data based on packed
- *                      rects using the buffer of pixels
- */
-image* atlas::generate_bitmap()
-{
-    m_bitmap = new image(m_size, m_size);
-    m_bitmap->clear();
 
-    for (auto texture : m_textures)
+    // checks every rect lies in the texture and none overlap
+    void check_dynamic(const dynamic_atlas& cache, const std::vector<uint32_t>& live)
     {
-        auto rect = texture.rect;
-        if (m_expand > 0)
+        std::vector<uint8_t> covered((std::size_t)cache.width() * cache.height(), 0);
+        for (auto id : live)
         {
-            uint8_t* src_buffer = m_buffer + texture.buffer_index;
-            uint8_t* dst_buffer = m_bitmap->data;
-            for (int y = -m_expand * CHANNELS; y < (rect.h + m_expand) * CHANNELS; y += CHANNELS)
-            {
-                for (int x = -m_expand * CHANNELS; x < (rect.w + m_expand) * CHANNELS; x += CHANNELS)
-                {
-                    int src_x = x < 0 ?
-                        0 : x > (rect.w - 1) * CHANNELS ?
-                            (rect.w - 1) * CHANNELS : x;
-                    int src_y = y < 0 ?
-                        0 : y > (rect.h - 1) * CHANNELS ?
-                            (rect.h - 1) * CHANNELS : y;
-
-                    dst_buffer[rect.x*CHANNELS+x+(rect.y*CHANNELS+y)*m_size+0] = src_buffer[src_x+src_y*rect.w+0];
-                    dst_buffer[rect.x*CHANNELS+x+(rect.y*CHANNELS+y)*m_size+1] = src_buffer[src_x+src_y*rect.w+1];
-                    dst_buffer[rect.x*CHANNELS+x+(rect.y*CHANNELS+y)*m_size+2] = src_buffer[src_x+src_y*rect.w+2];
-                    dst_buffer[rect.x*CHANNELS+x+(rect.y*CHANNELS+y)*m_size+3] = src_buffer[src_x+src_y*rect.w+3];
-                }
-            }
+            const rect& r = cache.get(id);
+            log_assert(r.x >= 0 && r.y >= 0 && r.x + r.w <= cache.width() && r.y + r.h <= cache.height(),
+                "rect %u out of bounds", id);
+            for (int y = r.y; y < r.y + r.h; y++)
+                for (int x = r.x; x < r.x + r.w; x++)
+                    log_assert(covered[(std::size_t)y * cache.width() + x]++ == 0, "rect %u overlaps another", id);
         }
-        else
-            m_bitmap->set_pixels(m_buffer + texture.buffer_index, rect);
     }
 
-    return m_bitmap;
-}
-
-/**
- * @brief           Saves atlas data in JSON format
- * 
- * @param output    Output directory
- */
-void atlas::save_json(const std::string& output)
-{
-    std::ofstream stream(output, std::ofstream::trunc);
-    stream << '{' << '\n';
-    stream << "\t\"w\": " << m_bitmap->w << ',' << '\n';
-    stream << "\t\"h\": " << m_bitmap->h << ',' << '\n';
-    stream << "\t\"n\": " << m_textures.size() << ',' << '\n';
-    stream << "\t\"textures\": " << '[' << '\n';
-    for (int i = 0; i < m_textures.size(); i++)
+    /**
+     * @brief           Times the dynamic allocator as a glyph cache under churn,
+     *                  filling a texture with small rects, then over and over
+     *                  freeing a random half of them and allocating as many,
+     *                  and defragmenting what is left at the end
+     *
+     * @param size      Width and height of the texture
+     */
+    void bench_dynamic(int size)
     {
-        auto texture = m_textures[i];
-        auto rect = texture.rect;
-
-        stream << "\t\t" << '{' << '\n';
-        stream << "\t\t\t" << "\"n\": " << '"' << texture.name << '"' << ',' << '\n';
-        stream << "\t\t\t" << "\"x\": " << rect.x << ',' << '\n';
-        stream << "\t\t\t" << "\"y\": " << rect.y << ',' << '\n';
-        stream << "\t\t\t" << "\"w\": " << rect.w << ',' << '\n';
-        stream << "\t\t\t" << "\"h\": " << rect.h << '\n';
-        stream << "\t\t" << '}';
-        if (i != m_textures.size() - 1)
-            stream << ',' << '\n';
-    }
-    stream << '\n' << '\t' << ']' << '\n';
-    stream << '}';
-    stream.close();
-}
+        dynamic_atlas cache(size, size, 1);
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> glyph(6, 48);
+
+        // filled until many glyphs in a row no longer fit
+        std::vector<uint32_t> live;
+        double start = get_time_ms();
+        for (int misses = 0; misses < 64;)
+        {
+            uint32_t id = cache.allocate(glyph(random), glyph(random));
+            if (id == DYNAMIC_NONE)
+                misses++;
+            else
+                live.push_back(id);
+        }
+        double fill = get_time_ms() - start;
+        std::size_t filled = live.size();
+        double fill_usage = (double)cache.used() / ((double)size * size);
+
+        const int rounds = 20;
+        std::size_t frees = 0, allocations = 0, failures = 0;
+        double free_time = 0.0, allocate_time = 0.0;
+        for (int round = 0; round < rounds; round++)
+        {
+            std::shuffle(live.begin(), live.end(), random);
+            std::size_t half = live.size() / 2;
+
+            start = get_time_ms();
+            for (std::size_t i = live.size() - half; i < live.size(); i++)
+                cache.free(live[i]);
+            free_time += get_time_ms() - start;
+            frees += half;
+            live.resize(live.size() - half);
+
+            start = get_time_ms();
+            for (std::size_t i = 0; i < half; i++)
+            {
+                uint32_t id = cache.allocate(glyph(random), glyph(random));
+                if (id != DYNAMIC_NONE)
+                    live.push_back(id);
+                else
+                    failures++;
+            }
+            allocate_time += get_time_ms() - start;
+            allocations += half;
+        }
+        check_dynamic(cache, live);
+        double churn_usage = (double)cache.used() / ((double)size * size);
+
+        std::vector<dynamic_move> moves;
+        start = get_time_ms();
+        bool defragmented = cache.defragment(moves);
+        double defragment = get_time_ms() - start;
+        check_dynamic(cache, live);
+
+        // what fits again once the free space is joined
+        std::size_t refilled = 0;
+        for (int misses = 0; misses < 64;)
+        {
+            if (cache.allocate(glyph(random), glyph(random)) != DYNAMIC_NONE)
+                refilled++;
+            else
+                misses++;
+        }
 
-/**
- * @brief           Saves atlas data in binary format
- * 
- * @param output    Output directory
- */
-void atlas::save_binary(const std::string& output)
-{
-    std::ofstream stream(output, std::ios::out | std::ios::binary);
-    write_binary(stream, (int16_t)m_bitmap->w);
-    write_binary(stream, (int16_t)m_bitmap->h);
-    write_binary(stream, (int16_t)m_textures.size());
-    for (int i = 0; i < m_textures.size(); i++)
-    {
-        auto texture = m_textures[i];
-        auto rect = texture.rect;
-        stream.write(texture.name.data(), texture.name.length() + 1);
-        write_binary(stream, (int16_t)rect.x);
-        write_binary(stream, (int16_t)rect.y);
-        write_binary(stream, (int16_t)rect.w);
-        write_binary(stream, (int16_t)rect.h);
+        log(Log::INFO, "Dynamic atlas %dx%d, rects of 6-48px", size, size);
+        log(Log::INFO, " - Fill ....................... %.2fms (%zu rects, %.1f%% used)", fill, filled, fill_usage * 100.0);
+        log(Log::INFO, " - Allocate ................... %.1fns (%zu, %zu failed)", allocate_time * 1e6 / allocations, allocations, failures);
+        log(Log::INFO, " - Free ....................... %.1fns (%zu)", free_time * 1e6 / frees, frees);
+        log(Log::INFO, " - After churn ................ %.1f%% used", churn_usage * 100.0);
+        log(Log::INFO, " - Defragment ................. %.2fms (%s, %zu moved, %zu more fit after)",
+            defragment, defragmented ? "packed" : "did not fit", moves.size(), refilled);
     }
-    stream.close();
-}
-
-////////////////////////////////////
-
-namespace
-{
-    std::string     input_dir;
-    std::string     output_dir;
-    std::string     output_name;
-
-    bool            log_verbose;
-    bool            is_demo;
-
-    int32_t         atlas_size;
-    int32_t         atlas_expand;
-    int32_t         atlas_border;
-    bool            atlas_unique;
-
-    atlas*          packer;
-    image*          atlas_bmp;
-
-    std::vector<image> images;
-    std::unordered_set<std::size_t> hashes;
 }
 
 int main(int argc, const char *argv[])
@@ -495,6 +376,111 @@ int main(int argc, const char *argv[])
             log_assert(i < argc, "went out of bounds looking for size argument value");
             atlas_size = std::stoi(argv[i]);
         }
+        else if (arg == "--json-compact")
+            json_compact = true;
+        else if (arg == "--quad-format")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for quad format argument value");
+            quad_format = parse_quads(argv[i]);
+        }
+        else if (arg == "--emit-header")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for emit header argument value");
+            header_file = argv[i];
+        }
+        else if (arg == "--huge-pages")
+            huge_pages = true;
+        else if (arg == "--stream")
+            is_stream = true;
+        else if (arg == "--png-level")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for png level argument value");
+            png.level = std::stoi(argv[i]);
+            log_assert(png.level >= 0 && png.level <= 9, "png level (%d) must be from 0 to 9", png.level);
+        }
+        else if (arg == "--png-max")
+            png.maximum = true;
+        else if (arg == "--png-filter")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for png filter argument value");
+            png.filter = parse_filter(argv[i]);
+        }
+        else if (arg == "--format")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for format argument value");
+            format = parse_format(argv[i]);
+        }
+        else if (arg == "--container")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for container argument value");
+            container = parse_container(argv[i]);
+        }
+        else if (arg == "--bc7-quality")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for bc7 quality argument value");
+            bc.quality = parse_quality(argv[i]);
+        }
+        else if (arg == "--etc2-effort")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for etc2 effort argument value");
+            bc.effort = parse_effort(argv[i]);
+        }
+        else if (arg == "--astc-block")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for astc block argument value");
+            bc.astc = parse_footprint(argv[i]);
+        }
+        else if (arg == "--astc-quality")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for astc quality argument value");
+            bc.astc_quality = parse_quality(argv[i]);
+        }
+        else if (arg == "--mips")
+            mips = true;
+        else if (arg == "--lz4")
+            lz4 = true;
+        else if (arg == "--delta-from")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for delta from argument value");
+            delta_from = argv[i];
+        }
+        else if (arg == "--apply-patch")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for apply patch argument value");
+            patch_file = argv[i];
+        }
+        else if (arg == "--bench-reader")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for bench reader argument value");
+            bench_file = argv[i];
+        }
+        else if (arg == "--bench-alloc")
+            bench_alloc = true;
+        else if (arg == "--bc-fit")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for bc fit argument value");
+            bc.fit = parse_fit(argv[i]);
+        }
+        else if (arg == "-j" || arg == "--threads")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for threads argument value");
+            threads = std::stoi(argv[i]);
+        }
         else if (arg == "-v" || arg == "--verbose")
             log_verbose = true;
         else if (arg == "-u" || arg == "--unique")
@@ -505,6 +491,18 @@ int main(int argc, const char *argv[])
             log_assert(i < argc, "went out of bounds looking for expand argument value");
             atlas_expand = std::stoi(argv[i]);
         }
+        else if (arg == "--expand-mode")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for expand mode argument value");
+            atlas_expand_mode = parse_expand(argv[i]);
+        }
+        else if (arg == "--manifest")
+        {
+            i++;
+            log_assert(i < argc, "went out of bounds looking for manifest argument value");
+            read_manifest(argv[i], expand_overrides);
+        }
         else if (arg == "-b" || arg == "--border")
         {
             i++;
@@ -515,10 +513,81 @@ int main(int argc, const char *argv[])
             log_assert(0, "unrecognized arg \"%s\"", arg.c_str());
     }
 
+    log_assert(!lz4 || (format != Format::PNG && format != Format::QOI), "lz4 only applies to raw, dds and ktx2 files");
+    log_assert(patch_file.empty() || !delta_from.empty(), "applying a patch needs the atlas it was made against (--delta-from)");
+    log_assert(delta_from.empty() || !is_stream || !patch_file.empty(), "patches compare whole atlases, so cannot be streamed");
+    log_assert(!png.maximum || !is_stream, "--png-max compares whole images, so cannot be streamed");
+    log_assert(quad_format != Quads::UNORM16 || atlas_size <= UINT16_MAX, "atlas too large for unorm16 quads (%dpx)", atlas_size);
+
+    png.threads = thread_count(threads);
+    bc.threads = png.threads;
+
+    // dds has no etc2 or astc formats, and
+    // uncompressed pixels only go in raw files
+    if ((format == Format::ETC2 || format == Format::ASTC) && container == Container::DDS)
+        container = Container::KTX2;
+    if (format == Format::RGBA8)
+        container = Container::RAW;
+
     // Set start time for logging
     double time_start, time_prev, time_curr;
     time_start = time_prev = time_curr = get_time_ms();
 
+    // Time the runtime reader on an atlas already packed
+    if (!bench_file.empty())
+    {
+        bench_reader(bench_file);
+        return 0;
+    }
+
+    // Time the runtime allocator at the atlas size
+    if (bench_alloc)
+    {
+        bench_dynamic(atlas_size);
+        return 0;
+    }
+
+    // Apply a patch to a previous atlas and save the
+    // result in the output format, nothing is packed
+    if (!patch_file.empty())
+    {
+        arena pixels;
+        pixels.set_huge_pages(huge_pages);
+
+        image bmp(pixels);
+        std::vector<uint8_t> file;
+        log_assert(read_file(delta_from, file) && bmp.load(file.data(), file.size()),
+            "could not read previous atlas \"%s\"", delta_from.c_str());
+
+        std::vector<uint8_t> patch;
+        log_assert(read_file(patch_file, patch), "could not open patch \"%s\"", patch_file.c_str());
+        log_assert(apply_patch(patch.data(), patch.size(), bmp.data, bmp.w, bmp.h),
+            "patch \"%s\" is invalid or was not made against \"%s\"", patch_file.c_str(), delta_from.c_str());
+
+        std::string texture = output_dir + output_name;
+        int levels = mips ? level_count(bmp.w, bmp.h) : 1;
+        std::unique_ptr<row_writer> writer = open_writer(texture, bmp.w, bmp.h, levels);
+        log_assert(writer->good(), "could not open \"%s\" for writing", texture.c_str());
+        log_assert(bmp.save(*writer), "could not write \"%s\"", texture.c_str());
+        if (lz4)
+        {
+            writer.reset();
+            log_assert(lz4_compress_file(texture, texture + LZ4_EXT, bc.threads), "could not compress \"%s\"", texture.c_str());
+        }
+
+        if (log_verbose)
+        {
+            log(Log::WHITE,
+                "Patched ...................... %.2fms",
+                get_time_ms() - time_start
+            );
+        }
+
+        bmp.unload();
+        log(Log::WHITE, "Saved to \"%s\"", output_dir.c_str());
+        return 0;
+    }
+
     if (log_verbose)
     {
         log(Log::WHITE, "blocs___atlas v.0.0");
@@ -528,9 +597,9 @@ int main(int argc, const char *argv[])
 
     // Find images from directory in first argument
     {
+        std::vector<std::string> filenames;
         if (!is_demo)
         {
-            std::vector<std::string> filenames;
             enumerate_dir(input_dir, filenames);
 
             if (log_verbose)
@@ -542,28 +611,41 @@ int main(int argc, const char *argv[])
                 );
                 time_prev = time_curr;
             }
+        }
+
+        // images are loaded straight into the atlas's own names and pixels
+        packer = std::make_unique<atlas>(filenames.size(), atlas_size, atlas_expand, atlas_border, atlas_expand_mode);
+        packer->pixels().set_huge_pages(huge_pages);
+
+        if (!is_demo)
+        {
+            std::size_t names_size = 0;
+            for (const auto& f : filenames)
+                names_size += f.size();
+            packer->names().reserve(filenames.size(), names_size);
 
+            std::vector<uint8_t> file;
             for (auto f : filenames)
             {
                 std::string ext = file_ext(f);
                 if (ext_is_img(ext))
                 {
-                    image bmp = {};
-                    bmp.name = file_name(f);
-                    if (bmp.load(f))
+                    image bmp(packer->pixels());
+                    bmp.name = packer->names().intern(file_name(f));
+                    if (read_file(f, file) && bmp.load(file.data(), file.size()))
                     {
                         std::size_t hash = bmp.generate_hash();
                         if (atlas_unique && hashes.find(hash) != hashes.end())
                         {
                             log(Log::WARN,
                                 "   ! Removed non-unique image \"%s\" from batch",
-                                bmp.name.c_str()
+                                packer->names().c_str(bmp.name)
                             );
                         }
                         else
                         {
                             hashes.insert(hash);
-                            images.emplace_back(bmp);
+                            images.emplace_back(std::move(bmp));
                             if (log_verbose)
                                 log(Log::GOOD, "   ✓ \"%s\"", f.c_str());
                         }
@@ -579,18 +661,18 @@ int main(int argc, const char *argv[])
         else
         {
             srand(time(NULL));
-            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(400,  80));
-            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box( 80, 400));
-            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(250, 250));
-            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(100, 250));
-            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(250, 100));
-            for (int i = rand() % 20; i >= 0; i--)        images.emplace_back(demo::rand_box(100, 100));
-            for (int i = rand() % 10; i >= 0; i--)        images.emplace_back(demo::rand_box( 60,  60));
-            for (int i = rand() % 30; i >= 0; i--)        images.emplace_back(demo::rand_box( 50,  50));
-            for (int i = rand() % 40; i >= 0; i--)        images.emplace_back(demo::rand_box( 50,  20));
-            for (int i = 50 + rand() % 50; i >= 0; i--)   images.emplace_back(demo::rand_box( 20,  50));
-            for (int i = 300 + rand() % 200; i >= 0; i--) images.emplace_back(demo::rand_box( 10,  10));
-            for (int i = 500 + rand() % 500; i >= 0; i--) images.emplace_back(demo::rand_box(  5,   5));
+            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(*packer, 400,  80));
+            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(*packer,  80, 400));
+            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(*packer, 250, 250));
+            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(*packer, 100, 250));
+            if (((float)rand() / RAND_MAX) > 0.5)         images.emplace_back(demo::rand_box(*packer, 250, 100));
+            for (int i = rand() % 20; i >= 0; i--)        images.emplace_back(demo::rand_box(*packer, 100, 100));
+            for (int i = rand() % 10; i >= 0; i--)        images.emplace_back(demo::rand_box(*packer,  60,  60));
+            for (int i = rand() % 30; i >= 0; i--)        images.emplace_back(demo::rand_box(*packer,  50,  50));
+            for (int i = rand() % 40; i >= 0; i--)        images.emplace_back(demo::rand_box(*packer,  50,  20));
+            for (int i = 50 + rand() % 50; i >= 0; i--)   images.emplace_back(demo::rand_box(*packer,  20,  50));
+            for (int i = 300 + rand() % 200; i >= 0; i--) images.emplace_back(demo::rand_box(*packer,  10,  10));
+            for (int i = 500 + rand() % 500; i >= 0; i--) images.emplace_back(demo::rand_box(*packer,   5,   5));
         }
         
         if (log_verbose)
@@ -606,16 +688,29 @@ int main(int argc, const char *argv[])
         log_assert(images.size() > 2, "not enough images (%d) to pack", images.size());
     }
     
-    // Allocate pixel data buffer and copy textures into buffer
+    // Hand the loaded images over to the atlas
     {
-        packer = new atlas(images.size(), atlas_size, atlas_expand, atlas_border);
         for (auto& image : images)
-            packer->add_texture(image);
+        {
+            // manifest names are never interned, so ones matching
+            // no image leave nothing behind in the pool
+            auto found = expand_overrides.find(std::string(packer->names().view(image.name)));
+            Expand expand = found != expand_overrides.end() ? found->second : atlas_expand_mode;
+            int w = image.w;
+            int h = image.h;
+            log_assert(packer->add_texture(std::move(image), expand), "pixel data (%dpx, %dpx) too large for atlas (%dpx)",
+                w, h, atlas_size);
+        }
+        images.clear();
+
+        if (format == Format::ASTC)
+            packer->align_to(bc.astc);
     }
     
     // Bin packing image rects
     {
-        packer->pack();      
+        log_assert(packer->pack(), "could not fit %d textures in atlas size (%dpx), try a larger --size",
+            (int)packer->textures().size(), atlas_size);
 
         if (log_verbose)
         {
@@ -629,8 +724,9 @@ int main(int argc, const char *argv[])
     }
 
     // Generate atlas and blit textures data onto image
+    if (!is_stream)
     {
-        atlas_bmp = packer->generate_bitmap();       
+        atlas_bmp = &packer->generate_bitmap();       
 
         if (log_verbose)
         {
@@ -643,25 +739,94 @@ int main(int argc, const char *argv[])
         }
     }
     
-    // Save atlas as png
+    // Save atlas as png, qoi, raw or block compressed dds/ktx2/raw,
+    // then optionally lz4 compress it
+    {
+        int levels = mips ? level_count(atlas_size, atlas_size) : 1;
+        std::string texture = output_dir + output_name;
+
+        std::unique_ptr<row_writer> writer = open_writer(texture, atlas_size, atlas_size, levels);
+        log_assert(writer->good(), "could not open \"%s\" for writing", texture.c_str());
+
+        // Either from the generated bitmap or band by band
+        bool saved = is_stream ? packer->save_stream(*writer) : atlas_bmp->save(*writer);
+        log_assert(saved, "could not write \"%s\"", texture.c_str());
+
+        if (log_verbose)
+        {
+            time_curr = get_time_ms();
+            log(Log::WHITE,
+                is_stream ? " - Stream Texture ............ %.2fms" : " - Save Texture .............. %.2fms",
+                time_curr - time_prev
+            );
+            time_prev = time_curr;
+        }
+
+        // Swap the finished file for its lz4 chunks
+        if (lz4)
+        {
+            writer.reset();
+            log_assert(lz4_compress_file(texture, texture + LZ4_EXT, bc.threads), "could not compress \"%s\"", texture.c_str());
+
+            if (log_verbose)
+            {
+                time_curr = get_time_ms();
+                log(Log::WHITE,
+                    " - Compress Texture .......... %.2fms",
+                    time_curr - time_prev
+                );
+                time_prev = time_curr;
+            }
+        }
+    }
+
+    // Write the tiles that changed since a previous build
+    if (!delta_from.empty())
     {
-        atlas_bmp->save_png(output_dir + output_name + ".png");
+        image old(packer->pixels());
+        std::vector<uint8_t> file;
+        log_assert(read_file(delta_from, file) && old.load(file.data(), file.size()),
+            "could not read previous atlas \"%s\"", delta_from.c_str());
+        log_assert(old.w == atlas_size && old.h == atlas_size,
+            "previous atlas (%dpx, %dpx) is not the size of the new one (%dpx)", old.w, old.h, atlas_size);
+
+        patch_header patch;
+        std::string patch_path = output_dir + output_name + PATCH_EXT;
+        log_assert(write_patch(patch_path, old.data, atlas_bmp->data, atlas_size, atlas_size, png.threads, patch),
+            "could not open \"%s\" for writing", patch_path.c_str());
+        old.unload();
 
         if (log_verbose)
         {
             time_curr = get_time_ms();
             log(Log::WHITE,
-                " - Save PNG .................. %.2fms",
+                " - Write Patch ............... %.2fms",
                 time_curr - time_prev
             );
+            log(Log::INFO,
+                "   %u dirty rects, %.2fkb",
+                patch.rects,
+                (sizeof(patch_header) + sizeof(patch_rect) * patch.rects + patch.compressed) / 1024.0
+            );
             time_prev = time_curr;
         }
     }
 
     // Serialize atlas data
     {
-        packer->save_json(output_dir + output_name + ".json");
-        packer->save_binary(output_dir + output_name + ".dat");
+        std::string json = packer->save_json(json_compact);
+        write_file(output_dir + output_name + ".json", json.data(), json.size());
+
+        std::vector<uint8_t> binary;
+        log_assert(packer->save_binary(binary, quad_format), "could not build a perfect hash of %d names",
+            (int)packer->textures().size());
+        write_file(output_dir + output_name + DAT_EXT, binary.data(), binary.size());
+
+        if (!header_file.empty())
+        {
+            std::string header = packer->save_header(file_name(header_file));
+            write_file(header_file, header.data(), header.size());
+        }
 
         if (log_verbose)
         {
@@ -686,17 +851,15 @@ int main(int argc, const char *argv[])
     
     // Clean up
     {
-        for (int i = 0; i < images.size(); i++)
+        if (log_verbose)
         {
-            if (!is_demo)
-            {
-                auto* image = &images.back();
-                image->unload();
-                images.pop_back();
-            }
+            log(Log::WHITE,
+                "Pixel memory ................. %.2fmb",
+                packer->pixels().reserved() / (1024.0 * 1024.0)
+            );
         }
-        
-        delete packer;
+
+        packer.reset();
     }
 
     log(Log::WHITE, "Saved to \"%s\"", output_dir.c_str());
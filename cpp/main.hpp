@@ -1,25 +1,48 @@
 
 #pragma once
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cstdarg>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image.h"
-#include "stb_image_write.h"
-
-#define CHANNELS 4
+#include "arena.hpp"
+#include "atlas.hpp"
+#include "dat.hpp"
+#include "dds.hpp"
+#include "dynamic.hpp"
+#include "delta.hpp"
+#include "ktx.hpp"
+#include "lz4.hpp"
+#include "mph.hpp"
+#include "names.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
+#include "raw.hpp"
+#include "reader.hpp"
+#include "thread.hpp"
 
 #define PNG_EXT ".png"
 #define JPG_EXT ".jpg"
+#define QOI_EXT ".qoi"
+#define DDS_EXT ".dds"
+#define KTX2_EXT ".ktx2"
+#define RAW_EXT ".raw"
+#define LZ4_EXT ".blz"
+#define PATCH_EXT ".bpatch"
+#define DAT_EXT ".dat"
 
 namespace blocs__atlas
 {
@@ -67,85 +90,155 @@ namespace blocs__atlas
         ).time_since_epoch().count() * 0.001;
     }
 
-    ////////////////////////////////////
-    //
-    // image loading, unloading, saving
-    // and pixel data manipulation
-    //
-
-    struct rect;
-
-    struct image
+    /**
+     * @brief       Parses an extrusion mode from its command
+     *              line name (clamp, wrap, mirror, none)
+     * 
+     * @param name  Name of the extrusion mode
+     * @return Expand 
+     */
+    inline Expand parse_expand(const std::string& name)
     {
-        std::string name;
-        int32_t     w;
-        int32_t     h;
-        uint8_t*    data;
-        
-        image();
-        image(int32_t w, int32_t h);
-
-        ~image(){}
-
-        bool load(const std::string& path);
-        void unload();
-        void clear();
-        void set_pixels(uint8_t* data, const rect& dst);
-        void save_png(const std::string& output);
-        std::size_t generate_hash();
-    };
-
-    ////////////////////////////////////
-    //
-    // texture atlas generation
-    //
+        if (name == "clamp")  return Expand::CLAMP;
+        if (name == "wrap")   return Expand::WRAP;
+        if (name == "mirror") return Expand::MIRROR;
+        if (name == "none")   return Expand::NONE;
+        log_assert(0, "unrecognized expand mode \"%s\"", name.c_str());
+        return Expand::CLAMP;
+    }
 
-    struct rect
+    /**
+     * @brief       Parses how quads are written from its command
+     *              line name (float, unorm16, none)
+     * 
+     * @param name  Name of the quad format
+     * @return Quads 
+     */
+    inline Quads parse_quads(const std::string& name)
     {
-        int32_t     x;
-        int32_t     y;
-        int32_t     w;
-        int32_t     h;
-    };
+        if (name == "float")   return Quads::FLOAT;
+        if (name == "unorm16") return Quads::UNORM16;
+        if (name == "none")    return Quads::NONE;
+        log_assert(0, "unrecognized quad format \"%s\"", name.c_str());
+        return Quads::FLOAT;
+    }
 
-    struct texture
-    {
-        std::string name;
-        rect        rect;
-        uint32_t    buffer_index;
-    };
-    
-    class atlas
+    /**
+     * @brief       Parses a png row filter from its command
+     *              line name (auto, none, sub, up, avg, paeth)
+     * 
+     * @param name  Name of the filter
+     * @return Filter 
+     */
+    inline Filter parse_filter(const std::string& name)
     {
-    public:
-        int         m_size;
-        int         m_expand;
-        int         m_border;
-
-        uint8_t*    m_buffer;
-        uint32_t    m_buffer_index;
+        if (name == "auto")  return Filter::AUTO;
+        if (name == "none")  return Filter::NONE;
+        if (name == "sub")   return Filter::SUB;
+        if (name == "up")    return Filter::UP;
+        if (name == "avg")   return Filter::AVG;
+        if (name == "paeth") return Filter::PAETH;
+        log_assert(0, "unrecognized png filter \"%s\"", name.c_str());
+        return Filter::AUTO;
+    }
 
-        image*      m_bitmap;
+    /**
+     * @brief       Parses an output format from its command
+     *              line name (png, qoi, rgba8, bc1, bc3, bc7, etc2, astc)
+     * 
+     * @param name  Name of the format
+     * @return Format 
+     */
+    inline Format parse_format(const std::string& name)
+    {
+        if (name == "png") return Format::PNG;
+        if (name == "qoi") return Format::QOI;
+        if (name == "rgba8") return Format::RGBA8;
+        if (name == "bc1") return Format::BC1;
+        if (name == "bc3") return Format::BC3;
+        if (name == "bc7") return Format::BC7;
+        if (name == "etc2") return Format::ETC2;
+        if (name == "astc") return Format::ASTC;
+        log_assert(0, "unrecognized output format \"%s\"", name.c_str());
+        return Format::PNG;
+    }
 
-        std::vector<texture> m_textures;
+    /**
+     * @brief       Parses a block endpoint fitting method from
+     *              its command line name (range, cluster)
+     * 
+     * @param name  Name of the fitting method
+     * @return Fit 
+     */
+    inline Fit parse_fit(const std::string& name)
+    {
+        if (name == "range")   return Fit::RANGE;
+        if (name == "cluster") return Fit::CLUSTER;
+        log_assert(0, "unrecognized block fit \"%s\"", name.c_str());
+        return Fit::RANGE;
+    }
 
-    public:
-        atlas() = delete;
-        atlas(std::size_t n, int size, int expand, int border);
+    /**
+     * @brief       Parses a bc7 quality preset from its command
+     *              line name (fast, normal, full)
+     * 
+     * @param name  Name of the preset
+     * @return Quality 
+     */
+    inline Quality parse_quality(const std::string& name)
+    {
+        if (name == "fast")   return Quality::FAST;
+        if (name == "normal") return Quality::NORMAL;
+        if (name == "full")   return Quality::FULL;
+        log_assert(0, "unrecognized bc7 quality \"%s\"", name.c_str());
+        return Quality::NORMAL;
+    }
 
-        ~atlas();
+    /**
+     * @brief       Parses an etc2 search effort from its command
+     *              line name (fast, thorough)
+     * 
+     * @param name  Name of the effort
+     * @return Effort 
+     */
+    inline Effort parse_effort(const std::string& name)
+    {
+        if (name == "fast")     return Effort::FAST;
+        if (name == "thorough") return Effort::THOROUGH;
+        log_assert(0, "unrecognized etc2 effort \"%s\"", name.c_str());
+        return Effort::FAST;
+    }
 
-        void add_texture(const image& image);
-        void pack();
-        void save_json(const std::string& output);
-        void save_binary(const std::string& output);
-        image* generate_bitmap();
-    };
+    /**
+     * @brief       Parses an astc block footprint from its
+     *              command line name (4x4, 5x4, ... 8x8)
+     * 
+     * @param name  Width and height of the footprint
+     * @return footprint 
+     */
+    inline footprint parse_footprint(const std::string& name)
+    {
+        footprint block;
+        char x = 0;
+        int read = sscanf(name.c_str(), "%d%c%d", &block.w, &x, &block.h);
+        log_assert(read == 3 && x == 'x' && valid_footprint(block), "unrecognized astc footprint \"%s\"", name.c_str());
+        return block;
+    }
 
-    inline void write_binary(std::ofstream& stream, int16_t value)
+    /**
+     * @brief       Parses a block compressed file container
+     *              from its command line name (dds, ktx2)
+     * 
+     * @param name  Name of the container
+     * @return Container 
+     */
+    inline Container parse_container(const std::string& name)
     {
-        stream.put(static_cast<uint8_t>(value & 0xff));
-        stream.put(static_cast<uint8_t>((value >> 8) & 0xff));
+        if (name == "dds")  return Container::DDS;
+        if (name == "ktx2") return Container::KTX2;
+        if (name == "raw")  return Container::RAW;
+        log_assert(0, "unrecognized container \"%s\"", name.c_str());
+        return Container::DDS;
     }
 
     ////////////////////////////////////
@@ -198,7 +291,7 @@ namespace blocs__atlas
      */
     inline bool ext_is_img(const std::string& ext)
     {
-        return ext == PNG_EXT || ext == JPG_EXT;
+        return ext == PNG_EXT || ext == JPG_EXT || ext == QOI_EXT;
     }
 
     /**
@@ -226,6 +319,72 @@ namespace blocs__atlas
             files.emplace_back(p.path().string());
     }
 
+    /**
+     * @brief       Reads a whole file into a buffer
+     * 
+     * @param path  File path to read from
+     * @param file  Buffer receiving the contents
+     * @return true If the file could be opened
+     */
+    inline bool read_file(const std::string& path, std::vector<uint8_t>& file)
+    {
+        std::ifstream stream(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!stream.is_open())
+            return false;
+        file.resize((std::size_t)stream.tellg());
+        stream.seekg(0);
+        stream.read((char*)file.data(), file.size());
+        return (bool)stream;
+    }
+
+    /**
+     * @brief       Writes a buffer out as a whole file
+     * 
+     * @param path  File path to write to
+     * @param data  Contents of the file
+     * @param size  Length of the contents
+     */
+    inline void write_file(const std::string& path, const void* data, std::size_t size)
+    {
+        std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        log_assert(stream.is_open(), "could not open \"%s\" for writing", path.c_str());
+        stream.write((const char*)data, size);
+    }
+
+    /**
+     * @brief           Reads per-sprite extrusion overrides from a manifest
+     *                  where each line is "<sprite name> <expand mode>"
+     *                  (blank lines and lines starting with # are skipped)
+     * 
+     * @param path      Manifest file to read from
+     * @param overrides Map of sprite names to extrusion modes
+     */
+    inline void read_manifest(const std::string& path, std::unordered_map<std::string, Expand>& overrides)
+    {
+        std::ifstream stream(path);
+        log_assert(stream.is_open(), "could not open manifest \"%s\"", path.c_str());
+
+        const char* space = " \t\r";
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            // trimmed first, so trailing spaces and windows line
+            // endings never leave an empty mode behind
+            std::size_t first = line.find_first_not_of(space);
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            line = line.substr(first, line.find_last_not_of(space) + 1 - first);
+
+            std::size_t split = line.find_last_of(space);
+            if (split == std::string::npos)
+                continue;
+
+            std::string name = line.substr(0, line.find_last_not_of(space, split) + 1);
+            std::string mode = line.substr(split + 1);
+            overrides[name] = parse_expand(mode);
+        }
+    }
+
     ////////////////////////////////////
     //
     // demo structs and funcs for
@@ -286,10 +445,10 @@ namespace blocs__atlas
             }
         }
 
-        inline image rand_box(int w, int h)
+        inline image rand_box(atlas& packer, int w, int h)
         {
-            image bmp = image(w, h);
-            bmp.name = "box";
+            image bmp(w, h, packer.pixels());
+            bmp.name = packer.names().intern("box");
             hsl_color color = hsl_color((float)rand() / RAND_MAX, 1.0f, 0.7f, 1.0f);
             fill_color(bmp, color);
             return bmp;
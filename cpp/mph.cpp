@@ -0,0 +1,152 @@
+
+#include "mph.hpp"
+
+#include <algorithm>
+
+#define BUCKET_SIZE     4           // names per bucket on average
+#define MAX_PILOT       (1 << 24)   // pilots tried before giving up on a seed
+#define MAX_SEEDS       16
+
+using namespace blocs__atlas;
+
+namespace
+{
+    /**
+     * @brief           Finds the first of each group of equal names, names that
+     *                  are equal hash the same, so sorting by hash brings them
+     *                  together and only names of equal hashes are compared
+     *
+     * @param names     Names, some possibly the same
+     * @param distinct  Indices of the first of each name, in order
+     */
+    void distinct_names(const std::vector<std::string_view>& names, std::vector<uint32_t>& distinct)
+    {
+        std::vector<std::pair<uint64_t, uint32_t>> sorted(names.size());
+        for (uint32_t i = 0; i < names.size(); i++)
+            sorted[i] = { dat_hash_name(names[i].data(), names[i].size(), 0), i };
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<uint8_t> repeated(names.size(), 0);
+        for (std::size_t run = 0; run < sorted.size();)
+        {
+            std::size_t end = run + 1;
+            while (end < sorted.size() && sorted[end].first == sorted[run].first)
+                end++;
+            for (std::size_t i = run + 1; i < end; i++)
+                for (std::size_t j = run; j < i; j++)
+                    if (!repeated[sorted[j].second] && names[sorted[i].second] == names[sorted[j].second])
+                    {
+                        repeated[sorted[i].second] = 1;
+                        break;
+                    }
+            run = end;
+        }
+
+        distinct.clear();
+        for (uint32_t i = 0; i < names.size(); i++)
+            if (!repeated[i])
+                distinct.push_back(i);
+    }
+}
+
+bool blocs__atlas::build_perfect_hash(const std::vector<std::string_view>& all_names, const std::vector<uint32_t>& all_values, perfect_hash& hash)
+{
+    std::vector<uint32_t> distinct;
+    distinct_names(all_names, distinct);
+    std::vector<std::string_view> names(distinct.size());
+    std::vector<uint32_t> values(distinct.size());
+    for (std::size_t i = 0; i < distinct.size(); i++)
+    {
+        names[i] = all_names[distinct[i]];
+        values[i] = all_values[distinct[i]];
+    }
+
+    uint32_t n = names.size();
+    uint32_t buckets = std::max<uint32_t>(1, (n + BUCKET_SIZE - 1) / BUCKET_SIZE);
+    hash.header = { 0, buckets, n };
+    hash.pilots.assign(buckets, 0);
+    hash.slots.assign(n, 0);
+    if (n == 0)
+        return true;
+
+    std::vector<uint64_t> hashes(n);
+    std::vector<uint32_t> start(buckets + 1), members(n), order(buckets);
+    std::vector<uint8_t> taken(n);
+    std::vector<uint32_t> placed;
+
+    for (uint64_t attempt = 0; attempt < MAX_SEEDS; attempt++)
+    {
+        uint64_t seed = dat_mix(attempt + 1);
+        for (uint32_t i = 0; i < n; i++)
+            hashes[i] = dat_hash_name(names[i].data(), names[i].size(), seed);
+
+        // names grouped by bucket, counted then placed
+        std::fill(start.begin(), start.end(), 0);
+        for (uint32_t i = 0; i < n; i++)
+            start[dat_bucket(hashes[i], buckets) + 1]++;
+        for (uint32_t b = 0; b < buckets; b++)
+            start[b + 1] += start[b];
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (uint32_t i = 0; i < n; i++)
+            members[fill[dat_bucket(hashes[i], buckets)]++] = i;
+
+        for (uint32_t b = 0; b < buckets; b++)
+            order[b] = b;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            return start[a + 1] - start[a] > start[b + 1] - start[b];
+        });
+
+        std::fill(taken.begin(), taken.end(), 0);
+        bool placed_all = true;
+        for (uint32_t b : order)
+        {
+            uint32_t size = start[b + 1] - start[b];
+            if (size == 0)
+                break;
+
+            // the first pilot sending every name of the bucket to a
+            // different free slot, most buckets placed last hold one
+            uint32_t pilot = 0;
+            if (size == 1)
+            {
+                uint64_t h = hashes[members[start[b]]];
+                while (pilot < MAX_PILOT && taken[dat_slot(h, pilot, n)])
+                    pilot++;
+                placed.assign(1, dat_slot(h, pilot, n));
+            }
+            else for (; pilot < MAX_PILOT; pilot++)
+            {
+                placed.clear();
+                for (uint32_t k = start[b]; k < start[b + 1]; k++)
+                {
+                    uint32_t slot = dat_slot(hashes[members[k]], pilot, n);
+                    if (taken[slot] || std::find(placed.begin(), placed.end(), slot) != placed.end())
+                        break;
+                    placed.push_back(slot);
+                }
+                if (placed.size() == size)
+                    break;
+            }
+            if (pilot == MAX_PILOT)
+            {
+                placed_all = false;
+                break;
+            }
+
+            hash.pilots[b] = pilot;
+            for (uint32_t k = 0; k < size; k++)
+            {
+                taken[placed[k]] = 1;
+                hash.slots[placed[k]] = values[members[start[b] + k]];
+            }
+        }
+
+        if (placed_all)
+        {
+            hash.header.seed = seed;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,36 @@
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "dat.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // minimal perfect hashing of names,
+    // looked up with the dat_ functions
+    //
+
+    struct perfect_hash
+    {
+        dat_hash    header;
+        std::vector<uint32_t> pilots;
+        std::vector<uint32_t> slots;
+    };
+
+    /**
+     * @brief           Builds a minimal perfect hash of the distinct names, trying
+     *                  pilots for the largest buckets first while the table
+     *                  is emptiest, and another seed if a bucket cannot be placed
+     *
+     * @param names     Names, of those that are the same only the first is kept
+     * @param values    Value of each name, stored in its slot
+     * @param hash      Tables of the hash
+     * @return true     If a seed was found placing every name
+     */
+    bool build_perfect_hash(const std::vector<std::string_view>& names, const std::vector<uint32_t>& values, perfect_hash& hash);
+}
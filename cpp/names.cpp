@@ -0,0 +1,117 @@
+
+#include "names.hpp"
+#include "dat.hpp"
+
+#define POOL_MIN_TABLE  64
+
+using namespace blocs__atlas;
+
+string_pool::string_pool()
+{
+    clear();
+}
+
+/**
+ * @brief           Finds the slot of a name in the table, the one holding
+ *                  it or the empty slot it would go in, probing linearly
+ *
+ * @param name      Name to find
+ * @param hash      Hash of the name
+ * @return std::size_t
+ */
+std::size_t string_pool::slot_of(std::string_view name, uint64_t hash) const
+{
+    std::size_t mask = m_table.size() - 1;
+    std::size_t slot = hash & mask;
+    while (m_table[slot] != 0)
+    {
+        const entry& found = m_entries[m_table[slot] - 1];
+        if (found.hash == hash && std::string_view(m_chars.data() + found.offset, found.size) == name)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// doubles the table, placing every name again by its kept hash,
+// names are distinct so each only needs the next empty slot
+void string_pool::grow()
+{
+    std::vector<uint32_t> table(m_table.size() * 2, 0);
+    m_table.swap(table);
+    std::size_t mask = m_table.size() - 1;
+    for (name_id id = 0; id < m_entries.size(); id++)
+    {
+        std::size_t slot = m_entries[id].hash & mask;
+        while (m_table[slot] != 0)
+            slot = (slot + 1) & mask;
+        m_table[slot] = id + 1;
+    }
+}
+
+/**
+ * @brief           Adds a name to the pool unless it is already there,
+ *                  offsets are 32 bit so callers keep the pool under 4gb
+ *
+ * @param name      Name to add
+ * @return name_id  Handle of the name, the same for equal names
+ */
+name_id string_pool::intern(std::string_view name)
+{
+    uint64_t hash = dat_hash_name(name.data(), name.size(), 0);
+    std::size_t slot = slot_of(name, hash);
+    if (m_table[slot] != 0)
+        return m_table[slot] - 1;
+
+    name_id id = (name_id)m_entries.size();
+    m_entries.push_back({ (uint32_t)m_chars.size(), (uint32_t)name.size(), hash });
+    m_chars.insert(m_chars.end(), name.begin(), name.end());
+    m_chars.push_back('\0');
+    m_table[slot] = id + 1;
+
+    // kept at most half full so probes stay short
+    if (m_entries.size() * 2 > m_table.size())
+        grow();
+    return id;
+}
+
+/**
+ * @brief           Finds a name without adding it
+ *
+ * @param name      Name to find
+ * @return name_id  Handle of the name, or 0 if it was never interned
+ */
+name_id string_pool::find(std::string_view name) const
+{
+    std::size_t slot = slot_of(name, dat_hash_name(name.data(), name.size(), 0));
+    return m_table[slot] != 0 ? m_table[slot] - 1 : 0;
+}
+
+/**
+ * @brief           Makes room for names ahead of interning them
+ *
+ * @param names     Number of names
+ * @param bytes     Their combined length, without nuls
+ */
+void string_pool::reserve(std::size_t names, std::size_t bytes)
+{
+    m_chars.reserve(m_chars.size() + bytes + names);
+    m_entries.reserve(m_entries.size() + names);
+    std::size_t table = m_table.size();
+    while (table < (m_entries.size() + names) * 2)
+        table *= 2;
+    if (table > m_table.size())
+    {
+        m_table.resize(table / 2);
+        grow();
+    }
+}
+
+// forgets every name but the empty one, invalidating their handles
+void string_pool::clear()
+{
+    m_chars.clear();
+    m_entries.clear();
+    m_table.assign(POOL_MIN_TABLE, 0);
+    intern({});
+}
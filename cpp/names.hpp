@@ -0,0 +1,60 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // interned names, stored once in a
+    // single pool and passed as handles
+    //
+
+    // handle of an interned name, 0 is always the empty name
+    using name_id = uint32_t;
+
+    /**
+     * @brief           Pool of distinct names, each followed by a nul, laid
+     *                  out as the strings of the binary metadata are
+     */
+    class string_pool
+    {
+    public:
+        string_pool();
+
+        string_pool(const string_pool&) = delete;
+        string_pool& operator=(const string_pool&) = delete;
+
+        name_id intern(std::string_view name);
+        name_id find(std::string_view name) const;
+        void reserve(std::size_t names, std::size_t bytes);
+        void clear();
+
+        std::string_view view(name_id id) const { return { m_chars.data() + m_entries[id].offset, m_entries[id].size }; }
+        const char* c_str(name_id id) const { return m_chars.data() + m_entries[id].offset; }
+        uint32_t offset(name_id id) const { return m_entries[id].offset; }
+
+        const char* data() const { return m_chars.data(); }
+        std::size_t size() const { return m_chars.size(); }
+        std::size_t count() const { return m_entries.size(); }
+
+    private:
+        struct entry
+        {
+            uint32_t    offset;
+            uint32_t    size;
+            uint64_t    hash;       // kept so growing never hashes names again
+        };
+
+        std::vector<char>     m_chars;
+        std::vector<entry>    m_entries;
+        std::vector<uint32_t> m_table;      // open addressed, id + 1 or 0 when empty
+
+        std::size_t slot_of(std::string_view name, uint64_t hash) const;
+        void grow();
+    };
+}
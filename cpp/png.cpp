@@ -0,0 +1,720 @@
+
+#include "png.hpp"
+#include "cpu.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
+
+#define IDAT_SIZE   (1 << 16)
+#define FILTER_ROWS 64
+#define FILTER_PARALLEL (1 << 16)
+#define CRC_PIECE   (1 << 18)
+#define STRATEGIES  7
+#define FINALISTS   2
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// crc-32 checksum, folded with carryless
+// multiplies when available
+//
+
+namespace
+{
+    using crc_fn = uint32_t (*)(uint32_t crc, const uint8_t* data, std::size_t len);
+
+    // multiplies two polynomials modulo the crc polynomial,
+    // bit 31 holds x^0 as the crc is bit reflected
+    uint32_t multiply_mod(uint32_t a, uint32_t b)
+    {
+        uint32_t product = 0;
+        for (uint32_t m = 1U << 31; m; m >>= 1)
+        {
+            if (a & m)
+                product ^= b;
+            b = b & 1 ? (b >> 1) ^ 0xedb88320U : b >> 1;
+        }
+        return product;
+    }
+
+    struct crc_table
+    {
+        // slicing by 8, values[k] advances a byte
+        // through k further bytes of zeros
+        uint32_t    values[8][256];
+
+        // x^(2^k * 8) modulo the polynomial, i.e.
+        // the shift applied by 2^k bytes of zeros
+        uint32_t    powers[64];
+
+        crc_table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+                values[0][i] = c;
+            }
+            for (int k = 1; k < 8; k++)
+                for (int i = 0; i < 256; i++)
+                    values[k][i] = (values[k - 1][i] >> 8) ^ values[0][values[k - 1][i] & 0xff];
+
+            // start from x^8, one byte
+            uint32_t p = 1U << 23;
+            for (int k = 0; k < 64; k++)
+            {
+                powers[k] = p;
+                p = multiply_mod(p, p);
+            }
+        }
+    };
+
+    const crc_table crc_table;
+
+    inline uint32_t load_le32(const uint8_t* src)
+    {
+        return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+    }
+
+    inline void put_u32(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = value >> 24;
+        dst[1] = value >> 16;
+        dst[2] = value >> 8;
+        dst[3] = value;
+    }
+
+    // the kernels work on the crc register, the
+    // complement of the checksum, in and out
+
+    uint32_t crc_scalar(uint32_t crc, const uint8_t* data, std::size_t len)
+    {
+        const auto& t = crc_table.values;
+        for (; len >= 8; len -= 8, data += 8)
+        {
+            uint32_t lo = crc ^ load_le32(data);
+            uint32_t hi = load_le32(data + 4);
+            crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        }
+        while (len--)
+            crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+#if defined(__ARM_FEATURE_CRC32)
+    uint32_t crc_arm(uint32_t crc, const uint8_t* data, std::size_t len)
+    {
+        for (; len >= 8; len -= 8, data += 8)
+        {
+            uint64_t value;
+            memcpy(&value, data, 8);
+            crc = __crc32d(crc, value);
+        }
+        while (len--)
+            crc = __crc32b(crc, *data++);
+        return crc;
+    }
+#endif
+
+#if defined(BLOCS_X86)
+    // multiplies both halves of x forward by the constants in k
+    // and adds them onto the next 128 bits of input
+    TARGET("sse2,pclmul") inline __m128i fold(__m128i x, __m128i k, __m128i next)
+    {
+        __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+        __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+        return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+    }
+
+    /**
+     * @brief           Folds 64 bytes at a time through four 128 bit
+     *                  accumulators with carryless multiplies, then reduces
+     *                  to 32 bits (Gopal et al, "Fast CRC Computation for
+     *                  Generic Polynomials Using PCLMULQDQ Instruction")
+     */
+    TARGET("sse2,pclmul") uint32_t crc_pclmul(uint32_t crc, const uint8_t* data, std::size_t len)
+    {
+        if (len < 64)
+            return crc_scalar(crc, data, len);
+
+        // x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32),
+        // x^64 and the barrett constants, all bit reflected
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+        const __m128i k5   = _mm_set_epi64x(0, 0x0163cd6124);
+        const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+        const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+        __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+        __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+        __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+        data += 64;
+        len -= 64;
+
+        for (; len >= 64; len -= 64, data += 64)
+        {
+            x1 = fold(x1, k1k2, _mm_loadu_si128((const __m128i*)(data + 0x00)));
+            x2 = fold(x2, k1k2, _mm_loadu_si128((const __m128i*)(data + 0x10)));
+            x3 = fold(x3, k1k2, _mm_loadu_si128((const __m128i*)(data + 0x20)));
+            x4 = fold(x4, k1k2, _mm_loadu_si128((const __m128i*)(data + 0x30)));
+        }
+
+        x1 = fold(x1, k3k4, x2);
+        x1 = fold(x1, k3k4, x3);
+        x1 = fold(x1, k3k4, x4);
+        for (; len >= 16; len -= 16, data += 16)
+            x1 = fold(x1, k3k4, _mm_loadu_si128((const __m128i*)data));
+
+        // 128 bits down to 64
+        x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // barrett reduction to 32
+        x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+        x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        crc = _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+        return crc_scalar(crc, data, len);
+    }
+#endif
+
+    crc_fn select_crc()
+    {
+#if defined(BLOCS_X86)
+        if (cpu().pclmul && cpu().sse2)
+            return crc_pclmul;
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+        return crc_arm;
+#else
+        return crc_scalar;
+#endif
+    }
+
+    const crc_fn crc_kernel = select_crc();
+}
+
+uint32_t blocs__atlas::crc32(uint32_t crc, const uint8_t* data, std::size_t len)
+{
+    return ~crc_kernel(~crc, data, len);
+}
+
+uint32_t blocs__atlas::crc32_combine(uint32_t crc1, uint32_t crc2, std::size_t len2)
+{
+    // shift the first checksum past len2 bytes of zeros,
+    // one power of two at a time, then add in the second
+    uint32_t shift = 1U << 31;
+    for (int k = 0; len2; k++, len2 >>= 1)
+        if (len2 & 1)
+            shift = multiply_mod(crc_table.powers[k], shift);
+    return multiply_mod(shift, crc1) ^ crc2;
+}
+
+////////////////////////////////////
+//
+// png row filters, vectorized with
+// sse2 or avx2 when available
+//
+
+namespace
+{
+    // filters a row of len bytes against the row above it (all zeros for
+    // the first row) and returns the sum of the filtered bytes' absolute
+    // values as signed bytes, lower usually compresses better, out
+    // is only written when the kernel is instantiated to store
+    using filter_fn = uint64_t (*)(const uint8_t* row, const uint8_t* prev, std::size_t len, uint8_t* out);
+
+    inline uint8_t paeth(int a, int b, int c)
+    {
+        int p  = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+    template <Filter F>
+    inline uint8_t predict(const uint8_t* row, const uint8_t* prev, std::size_t i)
+    {
+        int a = i < CHANNELS ? 0 : row[i - CHANNELS];
+        int c = i < CHANNELS ? 0 : prev[i - CHANNELS];
+        switch (F)
+        {
+        case Filter::SUB:   return a;
+        case Filter::UP:    return prev[i];
+        case Filter::AVG:   return (a + prev[i]) >> 1;
+        case Filter::PAETH: return paeth(a, prev[i], c);
+        default:            return 0;
+        }
+    }
+
+    /**
+     * @brief           Filters bytes [begin, len) of a row one at a time, used
+     *                  alone without simd and for the edges of vectorized rows
+     */
+    template <Filter F, bool STORE>
+    uint64_t filter_span(const uint8_t* row, const uint8_t* prev, std::size_t begin, std::size_t len, uint8_t* out)
+    {
+        uint64_t cost = 0;
+        for (std::size_t i = begin; i < len; i++)
+        {
+            uint8_t value = row[i] - predict<F>(row, prev, i);
+            if (STORE)
+                out[i] = value;
+            cost += abs((int8_t)value);
+        }
+        return cost;
+    }
+
+    template <Filter F, bool STORE>
+    uint64_t filter_scalar(const uint8_t* row, const uint8_t* prev, std::size_t len, uint8_t* out)
+    {
+        return filter_span<F, STORE>(row, prev, 0, len, out);
+    }
+
+#if defined(BLOCS_X86)
+    // bytes of the first pixel have no left neighbour so are filtered
+    // scalar, vectors then start one pixel in where row[i - CHANNELS]
+    // can be loaded unaligned alongside row[i]
+
+    template <Filter F, bool STORE>
+    TARGET("sse2") uint64_t filter_sse2(const uint8_t* row, const uint8_t* prev, std::size_t len, uint8_t* out)
+    {
+        std::size_t end = std::min<std::size_t>(len, CHANNELS);
+        uint64_t cost = filter_span<F, STORE>(row, prev, 0, end, out);
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one  = _mm_set1_epi8(1);
+        __m128i sum = zero;
+
+        std::size_t i = end;
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i a = _mm_loadu_si128((const __m128i*)(row + i - CHANNELS));
+            __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+            __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - CHANNELS));
+
+            __m128i pred = zero;
+            if (F == Filter::SUB)
+                pred = a;
+            else if (F == Filter::UP)
+                pred = b;
+            else if (F == Filter::AVG)
+                // avg_epu8 rounds up, take the carry back off
+                pred = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            else if (F == Filter::PAETH)
+            {
+                // distances from p = a + b - c worked out in 16 bit lanes
+                __m128i halves[2];
+                for (int half = 0; half < 2; half++)
+                {
+                    __m128i a16 = half ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+                    __m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                    __m128i c16 = half ? _mm_unpackhi_epi8(c, zero) : _mm_unpacklo_epi8(c, zero);
+
+                    __m128i pa = _mm_sub_epi16(b16, c16);
+                    __m128i pb = _mm_sub_epi16(a16, c16);
+                    __m128i pc = _mm_add_epi16(pa, pb);
+                    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+                    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+                    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+                    __m128i use_c  = _mm_cmpgt_epi16(pb, pc);
+                    __m128i bc     = _mm_or_si128(_mm_and_si128(use_c, c16), _mm_andnot_si128(use_c, b16));
+                    __m128i not_a  = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+                    halves[half]   = _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a16));
+                }
+                pred = _mm_packus_epi16(halves[0], halves[1]);
+            }
+
+            __m128i value = _mm_sub_epi8(x, pred);
+            if (STORE)
+                _mm_storeu_si128((__m128i*)(out + i), value);
+
+            // |value| as a signed byte, -128 comes out as 128 unsigned
+            __m128i magnitude = _mm_min_epu8(value, _mm_sub_epi8(zero, value));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(magnitude, zero));
+        }
+
+        uint64_t sums[2];
+        _mm_storeu_si128((__m128i*)sums, sum);
+        cost += sums[0] + sums[1];
+        return cost + filter_span<F, STORE>(row, prev, i, len, out);
+    }
+
+    template <Filter F, bool STORE>
+    TARGET("avx2") uint64_t filter_avx2(const uint8_t* row, const uint8_t* prev, std::size_t len, uint8_t* out)
+    {
+        std::size_t end = std::min<std::size_t>(len, CHANNELS);
+        uint64_t cost = filter_span<F, STORE>(row, prev, 0, end, out);
+
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one  = _mm256_set1_epi8(1);
+        __m256i sum = zero;
+
+        std::size_t i = end;
+        for (; i + 32 <= len; i += 32)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+            __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - CHANNELS));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+            __m256i c = _mm256_loadu_si256((const __m256i*)(prev + i - CHANNELS));
+
+            __m256i pred = zero;
+            if (F == Filter::SUB)
+                pred = a;
+            else if (F == Filter::UP)
+                pred = b;
+            else if (F == Filter::AVG)
+                pred = _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one));
+            else if (F == Filter::PAETH)
+            {
+                // unpack and pack both work within 128 bit lanes
+                // so the byte order comes back out unchanged
+                __m256i halves[2];
+                for (int half = 0; half < 2; half++)
+                {
+                    __m256i a16 = half ? _mm256_unpackhi_epi8(a, zero) : _mm256_unpacklo_epi8(a, zero);
+                    __m256i b16 = half ? _mm256_unpackhi_epi8(b, zero) : _mm256_unpacklo_epi8(b, zero);
+                    __m256i c16 = half ? _mm256_unpackhi_epi8(c, zero) : _mm256_unpacklo_epi8(c, zero);
+
+                    __m256i pa = _mm256_sub_epi16(b16, c16);
+                    __m256i pb = _mm256_sub_epi16(a16, c16);
+                    __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+                    pa = _mm256_abs_epi16(pa);
+                    pb = _mm256_abs_epi16(pb);
+
+                    __m256i bc    = _mm256_blendv_epi8(b16, c16, _mm256_cmpgt_epi16(pb, pc));
+                    __m256i not_a = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+                    halves[half]  = _mm256_blendv_epi8(a16, bc, not_a);
+                }
+                pred = _mm256_packus_epi16(halves[0], halves[1]);
+            }
+
+            __m256i value = _mm256_sub_epi8(x, pred);
+            if (STORE)
+                _mm256_storeu_si256((__m256i*)(out + i), value);
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_abs_epi8(value), zero));
+        }
+
+        uint64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, sum);
+        cost += sums[0] + sums[1] + sums[2] + sums[3];
+        return cost + filter_span<F, STORE>(row, prev, i, len, out);
+    }
+#endif
+
+    struct filter_kernels
+    {
+        filter_fn   store[5];
+        filter_fn   cost[5];
+    };
+
+    template <template <Filter, bool> class K>
+    constexpr filter_kernels make_kernels()
+    {
+        return {
+            { K<Filter::NONE, true>::run,  K<Filter::SUB, true>::run,  K<Filter::UP, true>::run,
+              K<Filter::AVG, true>::run,   K<Filter::PAETH, true>::run },
+            { K<Filter::NONE, false>::run, K<Filter::SUB, false>::run, K<Filter::UP, false>::run,
+              K<Filter::AVG, false>::run,  K<Filter::PAETH, false>::run },
+        };
+    }
+
+    template <Filter F, bool STORE> struct scalar_kernel { static constexpr filter_fn run = filter_scalar<F, STORE>; };
+#if defined(BLOCS_X86)
+    template <Filter F, bool STORE> struct sse2_kernel   { static constexpr filter_fn run = filter_sse2<F, STORE>; };
+    template <Filter F, bool STORE> struct avx2_kernel   { static constexpr filter_fn run = filter_avx2<F, STORE>; };
+#endif
+
+    /**
+     * @brief           Picks the widest filter kernels this machine supports
+     *
+     * @return const filter_kernels&
+     */
+    const filter_kernels& kernels()
+    {
+        static const filter_kernels selected = []
+        {
+#if defined(BLOCS_X86)
+            if (cpu().avx2)
+                return make_kernels<avx2_kernel>();
+            if (cpu().sse2)
+                return make_kernels<sse2_kernel>();
+#endif
+            return make_kernels<scalar_kernel>();
+        }();
+        return selected;
+    }
+
+    /**
+     * @brief           Picks the filter whose output has the smallest sum
+     *                  of absolute (signed) values, scoring without storing
+     */
+    int sum_filter(const filter_kernels& filters, const uint8_t* row, const uint8_t* prev, std::size_t stride)
+    {
+        int best = 0;
+        uint64_t best_cost = UINT64_MAX;
+        for (int type = 0; type < 5; type++)
+        {
+            uint64_t cost = filters.cost[type](row, prev, stride, nullptr);
+            if (cost < best_cost)
+            {
+                best = type;
+                best_cost = cost;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief           Picks the filter whose output bytes have the lowest
+     *                  entropy, slower but closer to what deflate makes of it
+     */
+    int entropy_filter(const filter_kernels& filters, const uint8_t* row, const uint8_t* prev, std::size_t stride, uint8_t* scratch)
+    {
+        int best = 0;
+        double best_bits = INFINITY;
+        for (int type = 0; type < 5; type++)
+        {
+            filters.store[type](row, prev, stride, scratch);
+            uint32_t counts[256] = {};
+            for (std::size_t i = 0; i < stride; i++)
+                counts[scratch[i]]++;
+
+            double bits = 0;
+            for (int v = 0; v < 256; v++)
+                if (counts[v])
+                    bits -= counts[v] * std::log2((double)counts[v] / stride);
+            if (bits < best_bits)
+            {
+                best = type;
+                best_bits = bits;
+            }
+        }
+        return best;
+    }
+}
+
+////////////////////////////////////
+//
+// png writer
+//
+
+/**
+ * @brief           Opens a png file and writes its header, pixel
+ *                  rows are then streamed in with write_rows
+ *
+ * @param output    Output file
+ * @param w         Image width
+ * @param h         Image height
+ * @param options   Compression level, row filter, maximum mode and thread count
+ */
+png_writer::png_writer(const std::string& output, int w, int h, const png_options& options)
+    : m_stream(output, std::ios::out | std::ios::binary | std::ios::trunc),
+      m_w(w), m_h(h), m_rows(0), m_filter(options.filter), m_maximum(options.maximum),
+      m_threads(thread_count(options.threads)), m_zlib(options.level, options.threads)
+{
+    m_good = m_stream.is_open();
+    if (!m_good)
+        return;
+
+    const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    m_stream.write((const char*)signature, sizeof(signature));
+
+    // 8 bit rgba, deflate, adaptive filtering, no interlace
+    uint8_t ihdr[13] = {};
+    put_u32(ihdr + 0, w);
+    put_u32(ihdr + 4, h);
+    ihdr[8] = 8;
+    ihdr[9] = 6;
+    write_chunk("IHDR", ihdr, sizeof(ihdr));
+}
+
+/**
+ * @brief           Filters, compresses and writes the next rows
+ *                  of the image to disk
+ *
+ * @param pixels    RGBA pixels of the rows
+ * @param rows      Number of rows
+ * @return true     If the rows fit in the image
+ */
+bool png_writer::write_rows(const uint8_t* pixels, int rows)
+{
+    if (!m_good || m_rows + rows > m_h)
+        return m_good = false;
+
+    std::size_t stride = (std::size_t)m_w * CHANNELS;
+    if (m_maximum)
+    {
+        m_image.insert(m_image.end(), pixels, pixels + rows * stride);
+        m_rows += rows;
+        return true;
+    }
+
+    if (m_prev.empty())
+        m_prev.assign(stride, 0);
+
+    const filter_kernels& filters = kernels();
+    for (int band = 0; band < rows; band += FILTER_ROWS)
+    {
+        int n = std::min(FILTER_ROWS, rows - band);
+        m_filtered.resize(n * (stride + 1));
+
+        // rows only read the unfiltered pixels so filter independently,
+        // split across workers once a band is big enough to be worth it
+        int threads = std::min<std::size_t>(m_threads, n * stride / FILTER_PARALLEL + 1);
+        parallel_for(n, threads, [&](int y, int)
+        {
+            const uint8_t* row  = pixels + (band + y) * stride;
+            const uint8_t* prev = band + y == 0 ? m_prev.data() : row - stride;
+            uint8_t* dst = m_filtered.data() + y * (stride + 1);
+
+            // score every filter without storing, then
+            // only write out whichever scores lowest
+            int best = m_filter == Filter::AUTO ? sum_filter(filters, row, prev, stride) : static_cast<int>(m_filter);
+            dst[0] = best;
+            filters.store[best](row, prev, stride, dst + 1);
+        });
+
+        m_zlib.write(m_filtered.data(), m_filtered.size(), m_idat);
+        if (m_idat.size() >= IDAT_SIZE)
+        {
+            write_chunk("IDAT", m_idat.data(), m_idat.size());
+            m_idat.clear();
+        }
+    }
+
+    memcpy(m_prev.data(), pixels + (rows - 1) * stride, stride);
+    m_rows += rows;
+    return true;
+}
+
+/**
+ * @brief           Flushes the compressed stream and closes the file
+ *
+ * @return true     If every row was written and the file closed whole
+ */
+bool png_writer::finish()
+{
+    if (!m_good || m_rows != m_h)
+        return m_good = false;
+
+    if (m_maximum)
+        write_maximum();
+    else
+    {
+        m_zlib.finish(m_idat);
+        write_chunk("IDAT", m_idat.data(), m_idat.size());
+    }
+    m_idat.clear();
+    write_chunk("IEND", nullptr, 0);
+    m_stream.close();
+    return m_good = !m_stream.fail();
+}
+
+/**
+ * @brief           Filters the whole image with every strategy, each fixed
+ *                  filter and both heuristics, ranks them by their size at
+ *                  level 9, then compresses the best few with the optimal
+ *                  parse and writes whichever comes out smallest
+ */
+void png_writer::write_maximum()
+{
+    std::size_t stride = (std::size_t)m_w * CHANNELS;
+    std::vector<uint8_t> zeros(stride, 0);
+    const filter_kernels& filters = kernels();
+
+    std::vector<std::vector<uint8_t>> filtered(STRATEGIES);
+    std::vector<std::size_t> sizes(STRATEGIES);
+    parallel_for(STRATEGIES, m_threads, [&](int strategy, int)
+    {
+        std::vector<uint8_t>& out = filtered[strategy];
+        std::vector<uint8_t> scratch(stride);
+        out.resize(m_h * (stride + 1));
+        for (int y = 0; y < m_h; y++)
+        {
+            const uint8_t* row  = m_image.data() + y * stride;
+            const uint8_t* prev = y == 0 ? zeros.data() : row - stride;
+            uint8_t* dst = out.data() + y * (stride + 1);
+
+            int type = strategy;
+            if (strategy == 5)
+                type = sum_filter(filters, row, prev, stride);
+            else if (strategy == 6)
+                type = entropy_filter(filters, row, prev, stride, scratch.data());
+            dst[0] = type;
+            filters.store[type](row, prev, stride, dst + 1);
+        }
+
+        zlib_stream zlib(9);
+        std::vector<uint8_t> compressed;
+        zlib.write(out.data(), out.size(), compressed);
+        zlib.finish(compressed);
+        sizes[strategy] = compressed.size();
+    });
+    m_image.clear();
+
+    std::vector<int> order(STRATEGIES);
+    for (int i = 0; i < STRATEGIES; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] < sizes[b]; });
+
+    // the optimal parse splits each finalist into bands across the workers
+    for (int i = 0; i < FINALISTS; i++)
+    {
+        const std::vector<uint8_t>& data = filtered[order[i]];
+        zlib_stream zlib(OPTIMAL_LEVEL, m_threads);
+        std::vector<uint8_t> idat;
+        zlib.write(data.data(), data.size(), idat);
+        zlib.finish(idat);
+        if (i == 0 || idat.size() < m_idat.size())
+            m_idat.swap(idat);
+    }
+    write_chunk("IDAT", m_idat.data(), m_idat.size());
+}
+
+void png_writer::write_chunk(const char* type, const uint8_t* data, std::size_t len)
+{
+    uint8_t header[8];
+    put_u32(header, len);
+    memcpy(header + 4, type, 4);
+
+    // large chunks are checksummed in pieces across
+    // the workers, then the pieces' checksums combined
+    int pieces = (int)std::min<std::size_t>(m_threads, (len + CRC_PIECE - 1) / CRC_PIECE);
+    std::size_t piece = pieces > 1 ? (len + pieces - 1) / pieces : len;
+    std::vector<uint32_t> crcs(std::max(pieces, 1));
+    parallel_for(pieces, pieces, [&](int i, int)
+    {
+        std::size_t begin = i * piece;
+        crcs[i] = crc32(0, data + begin, std::min(piece, len - begin));
+    });
+
+    uint32_t crc = crc32(0, header + 4, 4);
+    for (int i = 0; i < pieces; i++)
+        crc = crc32_combine(crc, crcs[i], std::min(piece, len - i * piece));
+
+    uint8_t footer[4];
+    put_u32(footer, crc);
+
+    m_stream.write((const char*)header, sizeof(header));
+    m_stream.write((const char*)data, len);
+    m_stream.write((const char*)footer, sizeof(footer));
+}
@@ -0,0 +1,90 @@
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "deflate.hpp"
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // png encoding written to disk
+    // one band of rows at a time
+    //
+
+    /**
+     * @brief           Updates a running CRC-32 checksum
+     *
+     * @param crc       Checksum of the data so far (0 to begin)
+     * @param data      New data
+     * @param len       Length of the new data
+     * @return uint32_t
+     */
+    uint32_t crc32(uint32_t crc, const uint8_t* data, std::size_t len);
+
+    /**
+     * @brief           Combines the CRC-32 checksums of two consecutive
+     *                  pieces of data into the checksum of both
+     *
+     * @param crc1      Checksum of the first piece
+     * @param crc2      Checksum of the second piece
+     * @param len2      Length of the second piece
+     * @return uint32_t
+     */
+    uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, std::size_t len2);
+
+    // values of NONE through PAETH match the
+    // filter type byte written before each row
+    enum class Filter
+    {
+        NONE,
+        SUB,
+        UP,
+        AVG,
+        PAETH,
+        AUTO,
+    };
+
+    // maximum holds every row until the end, then tries each filter
+    // strategy and compresses the best ones with the optimal parse,
+    // so it cannot be streamed
+    struct png_options
+    {
+        int         level   = 6;
+        Filter      filter  = Filter::AUTO;
+        bool        maximum = false;
+        int         threads = 1;
+    };
+
+    class png_writer : public row_writer
+    {
+    public:
+        png_writer(const std::string& output, int w, int h, const png_options& options);
+
+        bool write_rows(const uint8_t* pixels, int rows) override;
+        bool finish() override;
+
+    private:
+        std::ofstream m_stream;
+        int         m_w;
+        int         m_h;
+        int         m_rows;
+        Filter      m_filter;
+        bool        m_maximum;
+        int         m_threads;
+
+        zlib_stream m_zlib;
+        std::vector<uint8_t> m_prev;
+        std::vector<uint8_t> m_filtered;
+        std::vector<uint8_t> m_idat;
+        std::vector<uint8_t> m_image;
+
+        void write_maximum();
+        void write_chunk(const char* type, const uint8_t* data, std::size_t len);
+    };
+}
@@ -0,0 +1,289 @@
+
+#include "qoi.hpp"
+
+#include <cstring>
+
+#define QOI_OP_INDEX    0x00
+#define QOI_OP_DIFF     0x40
+#define QOI_OP_LUMA     0x80
+#define QOI_OP_RUN      0xc0
+#define QOI_OP_RGB      0xfe
+#define QOI_OP_RGBA     0xff
+#define QOI_MASK        0xc0
+
+#define QOI_HEADER      14
+#define QOI_PADDING     8
+#define QOI_MAX_RUN     62
+
+// most bytes a pixel can take, as QOI_OP_RGBA
+#define QOI_MAX_OP      5
+
+using namespace blocs__atlas;
+
+namespace
+{
+    inline void put_u32(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = value >> 24;
+        dst[1] = value >> 16;
+        dst[2] = value >> 8;
+        dst[3] = value;
+    }
+
+    inline uint32_t get_u32(const uint8_t* src)
+    {
+        return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | src[3];
+    }
+
+    // pixels are handled as r | g << 8 | b << 16 | a << 24
+    // so equal pixels compare as a single integer
+    inline uint32_t load_pixel(const uint8_t* src)
+    {
+        return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+    }
+
+    inline void store_pixel(uint8_t* dst, uint32_t px)
+    {
+        dst[0] = px;
+        dst[1] = px >> 8;
+        dst[2] = px >> 16;
+        dst[3] = px >> 24;
+    }
+
+    inline int hash(uint32_t px)
+    {
+        return ((px & 0xff) * 3 + (px >> 8 & 0xff) * 5 + (px >> 16 & 0xff) * 7 + (px >> 24) * 11) % 64;
+    }
+}
+
+////////////////////////////////////
+//
+// qoi writer
+//
+
+/**
+ * @brief           Opens a qoi file and writes its header, pixel
+ *                  rows are then streamed in with write_rows
+ *
+ * @param output    Output file
+ * @param w         Image width
+ * @param h         Image height
+ */
+qoi_writer::qoi_writer(const std::string& output, int w, int h)
+    : m_stream(output, std::ios::out | std::ios::binary | std::ios::trunc),
+      m_w(w), m_h(h), m_rows(0), m_index{}, m_prev(0xff000000), m_run(0)
+{
+    m_good = m_stream.is_open();
+    if (!m_good)
+        return;
+
+    // 4 channels, srgb with linear alpha
+    uint8_t header[QOI_HEADER] = { 'q', 'o', 'i', 'f' };
+    put_u32(header + 4, w);
+    put_u32(header + 8, h);
+    header[12] = 4;
+    header[13] = 0;
+    m_stream.write((const char*)header, sizeof(header));
+}
+
+/**
+ * @brief           Encodes and writes the next rows of the image,
+ *                  runs may carry over into the next rows
+ *
+ * @param pixels    RGBA pixels of the rows
+ * @param rows      Number of rows
+ * @return true     If the rows fit in the image
+ */
+bool qoi_writer::write_rows(const uint8_t* pixels, int rows)
+{
+    if (!m_good || m_rows + rows > m_h)
+        return m_good = false;
+
+    std::size_t count = (std::size_t)m_w * rows;
+    m_bytes.resize(count * QOI_MAX_OP);
+    uint8_t* out = m_bytes.data();
+
+    uint32_t prev = m_prev;
+    int run = m_run;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        uint32_t px = load_pixel(pixels + i * CHANNELS);
+        if (px == prev)
+        {
+            if (++run == QOI_MAX_RUN)
+            {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run)
+        {
+            *out++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        int slot = hash(px);
+        if (m_index[slot] == px)
+            *out++ = QOI_OP_INDEX | slot;
+        else
+        {
+            m_index[slot] = px;
+            if ((px ^ prev) >> 24 == 0)
+            {
+                // same alpha, so try the differences from the previous
+                // pixel, wrapping around as the decoder does
+                int8_t dr = (int8_t)(px - prev);
+                int8_t dg = (int8_t)((px >> 8) - (prev >> 8));
+                int8_t db = (int8_t)((px >> 16) - (prev >> 16));
+                int dr_dg = dr - dg;
+                int db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                {
+                    *out++ = QOI_OP_LUMA | (dg + 32);
+                    *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                }
+                else
+                {
+                    *out++ = QOI_OP_RGB;
+                    *out++ = px;
+                    *out++ = px >> 8;
+                    *out++ = px >> 16;
+                }
+            }
+            else
+            {
+                *out++ = QOI_OP_RGBA;
+                store_pixel(out, px);
+                out += 4;
+            }
+        }
+        prev = px;
+    }
+
+    m_prev = prev;
+    m_run = run;
+    m_rows += rows;
+    m_stream.write((const char*)m_bytes.data(), out - m_bytes.data());
+    return true;
+}
+
+/**
+ * @brief           Ends the last run, writes the end
+ *                  marker and closes the file
+ *
+ * @return true     If every row was written and the file closed whole
+ */
+bool qoi_writer::finish()
+{
+    if (!m_good || m_rows != m_h)
+        return m_good = false;
+
+    uint8_t end[1 + QOI_PADDING] = {};
+    std::size_t len = 0;
+    if (m_run)
+        end[len++] = QOI_OP_RUN | (m_run - 1);
+    end[len + QOI_PADDING - 1] = 1;
+    m_stream.write((const char*)end, len + QOI_PADDING);
+    m_stream.close();
+    return m_good = !m_stream.fail();
+}
+
+////////////////////////////////////
+//
+// qoi decoding
+//
+
+bool blocs__atlas::qoi_size(const uint8_t* data, std::size_t len, int& w, int& h)
+{
+    if (len < QOI_HEADER + QOI_PADDING || memcmp(data, "qoif", 4) != 0)
+        return false;
+
+    uint32_t width = get_u32(data + 4);
+    uint32_t height = get_u32(data + 8);
+    if (width == 0 || height == 0 || width > INT32_MAX / height / CHANNELS)
+        return false;
+    if (data[12] != 3 && data[12] != 4)
+        return false;
+
+    w = width;
+    h = height;
+    return true;
+}
+
+bool blocs__atlas::qoi_decode(const uint8_t* data, std::size_t len, uint8_t* pixels)
+{
+    int w, h;
+    if (!qoi_size(data, len, w, h))
+        return false;
+
+    // every op starting before the padding has all of
+    // its bytes in the file, so only the start is checked
+    const uint8_t* in = data + QOI_HEADER;
+    const uint8_t* end = data + len - QOI_PADDING;
+
+    uint32_t index[64] = {};
+    uint32_t px = 0xff000000;
+    std::size_t count = (std::size_t)w * h;
+    std::size_t i = 0;
+    while (i < count)
+    {
+        if (in >= end)
+            return false;
+
+        int op = *in++;
+        if (op == QOI_OP_RGB)
+        {
+            px = (px & 0xff000000) | in[0] | in[1] << 8 | in[2] << 16;
+            in += 3;
+        }
+        else if (op == QOI_OP_RGBA)
+        {
+            px = load_pixel(in);
+            in += 4;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_INDEX)
+        {
+            // the index holds the pixel already,
+            // so skip putting it back
+            px = index[op];
+            store_pixel(pixels + i++ * CHANNELS, px);
+            continue;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_DIFF)
+        {
+            uint32_t r = (px + ((op >> 4 & 3) - 2)) & 0xff;
+            uint32_t g = ((px >> 8) + ((op >> 2 & 3) - 2)) & 0xff;
+            uint32_t b = ((px >> 16) + ((op & 3) - 2)) & 0xff;
+            px = (px & 0xff000000) | r | g << 8 | b << 16;
+        }
+        else if ((op & QOI_MASK) == QOI_OP_LUMA)
+        {
+            int dg = (op & 0x3f) - 32;
+            int dr = dg + (*in >> 4) - 8;
+            int db = dg + (*in & 0x0f) - 8;
+            in++;
+            uint32_t r = (px + dr) & 0xff;
+            uint32_t g = ((px >> 8) + dg) & 0xff;
+            uint32_t b = ((px >> 16) + db) & 0xff;
+            px = (px & 0xff000000) | r | g << 8 | b << 16;
+        }
+        else
+        {
+            // a run repeats the previous pixel, which
+            // is already in the index
+            std::size_t run = std::min<std::size_t>((op & 0x3f) + 1, count - i);
+            for (std::size_t n = 0; n < run; n++)
+                store_pixel(pixels + (i + n) * CHANNELS, px);
+            i += run;
+            continue;
+        }
+
+        index[hash(px)] = px;
+        store_pixel(pixels + i++ * CHANNELS, px);
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // qoi encoding and decoding, a fast
+    // lossless format for local builds
+    //
+
+    class qoi_writer : public row_writer
+    {
+    public:
+        qoi_writer(const std::string& output, int w, int h);
+
+        bool write_rows(const uint8_t* pixels, int rows) override;
+        bool finish() override;
+
+    private:
+        std::ofstream m_stream;
+        int         m_w;
+        int         m_h;
+        int         m_rows;
+
+        // encoder state carried from one band of rows to the next
+        uint32_t    m_index[64];
+        uint32_t    m_prev;
+        int         m_run;
+        std::vector<uint8_t> m_bytes;
+    };
+
+    /**
+     * @brief           Reads the size of a qoi image from its header
+     *
+     * @param data      File contents
+     * @param len       Length of the file
+     * @param w         Image width
+     * @param h         Image height
+     * @return true     If the header is valid
+     */
+    bool qoi_size(const uint8_t* data, std::size_t len, int& w, int& h);
+
+    /**
+     * @brief           Decodes a qoi image to RGBA pixels, whatever
+     *                  the channel count in its header
+     *
+     * @param data      File contents
+     * @param len       Length of the file
+     * @param pixels    Output, w * h RGBA pixels as given by qoi_size
+     * @return true     If every pixel was decoded
+     */
+    bool qoi_decode(const uint8_t* data, std::size_t len, uint8_t* pixels);
+}
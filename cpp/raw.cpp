@@ -0,0 +1,186 @@
+
+#include "raw.hpp"
+#include "ktx.hpp"
+
+#include <cstring>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+using namespace blocs__atlas;
+
+namespace
+{
+    inline uint64_t align_up(uint64_t value)
+    {
+        return (value + RAW_ALIGN - 1) / RAW_ALIGN * RAW_ALIGN;
+    }
+}
+
+////////////////////////////////////
+//
+// raw writer
+//
+
+/**
+ * @brief           Lays out a raw file and sizes it, pixel rows
+ *                  are then streamed in with write_rows and each
+ *                  level encoded straight into its place
+ *
+ * @param output    Output file
+ * @param w         Image width
+ * @param h         Image height
+ * @param format    RGBA8 or a block compressed format
+ * @param options   Block compression options and thread count
+ * @param levels    Mip levels
+ * @param pages     Pages of the atlas, each the same size
+ */
+raw_writer::raw_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels, int pages)
+    : block_writer(w, h, format == Format::RGBA8 ? 1 : block_footprint(format, options).h, levels, pages),
+      m_format(format), m_options(options), m_header{}, m_output(output), m_data(nullptr), m_size(0)
+{
+    // the header has room for RAW_MAX_LEVELS levels
+    m_good = m_good && levels <= RAW_MAX_LEVELS && pages >= 1 && (format == Format::RGBA8 || block_bytes(format) > 0);
+    if (!m_good)
+        return;
+    m_written.resize(levels);
+
+    footprint block = format == Format::RGBA8 ? footprint{ 1, 1 } : block_footprint(format, options);
+    uint32_t bytes = format == Format::RGBA8 ? CHANNELS : block_bytes(format);
+
+    m_header.magic = RAW_MAGIC;
+    m_header.version = RAW_VERSION;
+    m_header.width = w;
+    m_header.height = h;
+    m_header.format = static_cast<uint32_t>(format);
+    m_header.vk_format = vk_format(format, options);
+    m_header.block_w = block.w;
+    m_header.block_h = block.h;
+    m_header.block_bytes = bytes;
+    m_header.levels = levels;
+    m_header.pages = pages;
+
+    // levels are stored largest first, pages of a
+    // level one after another, every one aligned
+    uint64_t offset = align_up(sizeof(raw_header));
+    for (int l = 0; l < levels; l++)
+    {
+        uint64_t columns = (level_size(w, l) + block.w - 1) / block.w;
+        uint64_t rows = (level_size(h, l) + block.h - 1) / block.h;
+        raw_level& level = m_header.level[l];
+        level.offset = offset;
+        level.size = columns * rows * bytes;
+        level.stride = align_up(level.size);
+        offset += level.stride * pages;
+    }
+    m_size = offset;
+
+#if !defined(_WIN32)
+    // map the output so levels are encoded directly into the
+    // page cache, without going through a write of their own
+    int fd = open(output.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        m_good = false;
+        return;
+    }
+    if (ftruncate(fd, m_size) == 0)
+    {
+        void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+            m_data = static_cast<uint8_t*>(data);
+    }
+    ::close(fd);
+#endif
+    if (m_data == nullptr)
+    {
+        m_buffer.resize(m_size);
+        m_data = m_buffer.data();
+    }
+    memcpy(m_data, &m_header, sizeof(raw_header));
+}
+
+raw_writer::~raw_writer()
+{
+#if !defined(_WIN32)
+    if (m_data != nullptr && m_buffer.empty())
+        munmap(m_data, m_size);
+#endif
+}
+
+// rows of every level arrive in order and a page is finished before the
+// next begins, so the bytes written so far place the rows within the level
+void raw_writer::encode(int level, int layer, const uint8_t* pixels, int w, int rows)
+{
+    const raw_level& info = m_header.level[level];
+    uint8_t* out = m_data + info.offset + layer * info.stride + (m_written[level] - layer * info.size);
+
+    std::size_t size;
+    if (m_format == Format::RGBA8)
+    {
+        size = (std::size_t)w * rows * CHANNELS;
+        memcpy(out, pixels, size);
+    }
+    else
+    {
+        footprint block = block_footprint(m_format, m_options);
+        size = (std::size_t)((w + block.w - 1) / block.w) * ((rows + block.h - 1) / block.h) * block_bytes(m_format);
+        encode_blocks(m_format, pixels, w, rows, out, m_options);
+    }
+    m_written[level] += size;
+}
+
+bool raw_writer::close()
+{
+    if (m_data == nullptr)
+        return false;
+
+    bool written = true;
+    if (m_buffer.empty())
+    {
+#if !defined(_WIN32)
+        written = munmap(m_data, m_size) == 0;
+#endif
+    }
+    else
+    {
+        // without a mapping the file goes out in a single write
+        std::ofstream stream(m_output, std::ios::out | std::ios::binary | std::ios::trunc);
+        stream.write((const char*)m_buffer.data(), m_buffer.size());
+        stream.close();
+        written = !stream.fail();
+        m_buffer.clear();
+    }
+    m_data = nullptr;
+    return written;
+}
+
+////////////////////////////////////
+//
+// raw reading
+//
+
+const uint8_t* blocs__atlas::raw_pixels(const uint8_t* data, std::size_t len, int& w, int& h)
+{
+    raw_header header;
+    if (len < sizeof(header))
+        return nullptr;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != RAW_MAGIC || header.version != RAW_VERSION || header.levels < 1)
+        return nullptr;
+    if (header.format != static_cast<uint32_t>(Format::RGBA8) || header.width == 0 || header.height == 0)
+        return nullptr;
+
+    const raw_level& level = header.level[0];
+    if (level.size != (uint64_t)header.width * header.height * CHANNELS)
+        return nullptr;
+    if (level.offset > len || level.size > len - level.offset)
+        return nullptr;
+
+    w = header.width;
+    h = header.height;
+    return data + level.offset;
+}
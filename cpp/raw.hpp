@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bc.hpp"
+#include "dat.hpp"
+#include "writer.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // raw textures, laid out as in dat.hpp
+    // and encoded straight into the file
+    //
+
+    class raw_writer : public block_writer
+    {
+    public:
+        raw_writer(const std::string& output, int w, int h, Format format, const bc_options& options, int levels = 1, int pages = 1);
+        ~raw_writer() override;
+
+    private:
+        Format      m_format;
+        bc_options  m_options;
+        raw_header  m_header;
+        std::string m_output;
+        std::vector<uint64_t> m_written;
+
+        // the whole file, either the mapped output or a
+        // buffer written out at once when closing
+        uint8_t*    m_data;
+        std::size_t m_size;
+        std::vector<uint8_t> m_buffer;
+
+        void encode(int level, int layer, const uint8_t* pixels, int w, int rows) override;
+        bool close() override;
+    };
+
+    /**
+     * @brief           Finds the pixels of a raw rgba8 file, the first
+     *                  level of its first page
+     *
+     * @param data      File contents
+     * @param len       Length of the file
+     * @param w         Image width
+     * @param h         Image height
+     * @return const uint8_t* RGBA pixels within the file, nullptr if the
+     *                  file is not a valid raw file of rgba8 pixels
+     */
+    const uint8_t* raw_pixels(const uint8_t* data, std::size_t len, int& w, int& h);
+}
@@ -0,0 +1,337 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef NOGDI
+        #define NOGDI
+    #endif
+    #include <windows.h>
+
+    // still defined by some sdk headers even without gdi,
+    // and would clash with anything of the name after this
+    #undef ERROR
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "dat.hpp"
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // header-only reading of packed atlases
+    // at runtime, mapped and never copied,
+    // needs nothing but this and dat.hpp
+    //
+
+    // a file mapped read only, with mmap or a windows file mapping
+    class mapped_file
+    {
+    public:
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file() { close(); }
+
+        bool open(const std::string& path)
+        {
+            close();
+#if !defined(_WIN32)
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0)
+            {
+                void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    m_data = static_cast<const uint8_t*>(data);
+                    m_size = info.st_size;
+                }
+            }
+            ::close(fd);
+            return m_data != nullptr;
+#else
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            {
+                // the view keeps the mapping open, so both handles can go
+                HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr)
+                {
+                    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    if (data != nullptr)
+                    {
+                        m_data = static_cast<const uint8_t*>(data);
+                        m_size = (std::size_t)size.QuadPart;
+                    }
+                    CloseHandle(mapping);
+                }
+            }
+            CloseHandle(file);
+            return m_data != nullptr;
+#endif
+        }
+
+        void close()
+        {
+            if (m_data != nullptr)
+            {
+#if !defined(_WIN32)
+                munmap(const_cast<uint8_t*>(m_data), m_size);
+#else
+                UnmapViewOfFile(m_data);
+#endif
+            }
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        const uint8_t* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+    private:
+        const uint8_t* m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    // a page of a mip level of the texture, ready to upload
+    struct page_view
+    {
+        const uint8_t* data;
+        std::size_t size;
+        uint32_t    width;
+        uint32_t    height;
+    };
+
+    /**
+     * @brief           Reads the binary metadata of an atlas and optionally
+     *                  its raw texture, opening checks only the header and
+     *                  the bounds of each table so it never touches more than
+     *                  the first pages, and every read after checks its own
+     *                  bounds, so lookups neither allocate nor copy
+     */
+    class atlas_reader
+    {
+    public:
+        atlas_reader() = default;
+        atlas_reader(const atlas_reader&) = delete;
+        atlas_reader& operator=(const atlas_reader&) = delete;
+
+        /**
+         * @brief           Maps an atlas's files
+         *
+         * @param metadata  Binary metadata (.dat)
+         * @param texture   Raw texture (.raw), or empty for none
+         * @return true     If the files were valid
+         */
+        bool open(const std::string& metadata, const std::string& texture = {})
+        {
+            close();
+            if (!m_dat.open(metadata) || !read_metadata() || (!texture.empty() && (!m_raw.open(texture) || !read_texture())))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            m_dat.close();
+            m_raw.close();
+            m_header = nullptr;
+            m_textures = nullptr;
+            m_strings = nullptr;
+            m_strings_size = 0;
+            m_hash = nullptr;
+            m_quads = nullptr;
+            m_quads16 = nullptr;
+            m_raw_header = nullptr;
+        }
+
+        uint32_t width() const { return m_header->width; }
+        uint32_t height() const { return m_header->height; }
+        uint32_t count() const { return m_header->textures; }
+
+        const dat_texture& texture(uint32_t i) const { return m_textures[i]; }
+
+        std::string_view name(const dat_texture& texture) const
+        {
+            if (texture.name >= m_strings_size || texture.name_size >= m_strings_size - texture.name)
+                return {};
+            return std::string_view(m_strings + texture.name, texture.name_size);
+        }
+
+        std::string_view name(uint32_t i) const { return name(m_textures[i]); }
+
+        /**
+         * @brief           Finds a texture by name through the perfect hash,
+         *                  or by a scan when the file was written without one
+         *
+         * @param key       Name of the texture
+         * @return const dat_texture* nullptr if no texture has the name
+         */
+        const dat_texture* find(std::string_view key) const
+        {
+            if (m_hash == nullptr)
+            {
+                for (uint32_t i = 0; i < count(); i++)
+                    if (name(i) == key)
+                        return m_textures + i;
+                return nullptr;
+            }
+            if (m_hash->slots == 0)
+                return nullptr;
+
+            uint64_t h = dat_hash_name(key.data(), key.size(), m_hash->seed);
+            uint32_t slot = dat_slot(h, m_pilots[dat_bucket(h, m_hash->buckets)], m_hash->slots);
+            uint32_t i = m_slots[slot];
+            if (i >= count() || name(i) != key)
+                return nullptr;
+            return m_textures + i;
+        }
+
+        // quads in the order of the textures, nullptr if the file has none in that format
+        const dat_quad* quads() const { return m_quads; }
+        const dat_quad16* quads16() const { return m_quads16; }
+
+        // the raw texture, nullptr if none was opened
+        const raw_header* pixels() const { return m_raw_header; }
+
+        /**
+         * @brief           Gets a page of a mip level of the raw texture
+         *
+         * @param level     Mip level
+         * @param page      Page of the level
+         * @return page_view With no data if there is no such page
+         */
+        page_view page(uint32_t level, uint32_t page) const
+        {
+            if (m_raw_header == nullptr || level >= m_raw_header->levels || page >= m_raw_header->pages)
+                return { nullptr, 0, 0, 0 };
+            const raw_level& info = m_raw_header->level[level];
+            return {
+                m_raw.data() + info.offset + page * info.stride,
+                (std::size_t)info.size,
+                std::max(m_raw_header->width >> level, 1U),
+                std::max(m_raw_header->height >> level, 1U),
+            };
+        }
+
+    private:
+        mapped_file m_dat;
+        mapped_file m_raw;
+
+        const dat_header*  m_header = nullptr;
+        const dat_texture* m_textures = nullptr;
+        const char*        m_strings = nullptr;
+        std::size_t        m_strings_size = 0;
+        const dat_hash*    m_hash = nullptr;
+        const uint32_t*    m_pilots = nullptr;
+        const uint32_t*    m_slots = nullptr;
+        const dat_quad*    m_quads = nullptr;
+        const dat_quad16*  m_quads16 = nullptr;
+        const raw_header*  m_raw_header = nullptr;
+
+        bool read_metadata()
+        {
+            const uint8_t* file = m_dat.data();
+            std::size_t len = m_dat.size();
+            if (len < sizeof(dat_header))
+                return false;
+            m_header = reinterpret_cast<const dat_header*>(file);
+            if (m_header->magic != DAT_MAGIC || m_header->version != DAT_VERSION || m_header->size != len)
+                return false;
+            if ((len - sizeof(dat_header)) / sizeof(dat_section) < m_header->sections)
+                return false;
+
+            const dat_section* sections = reinterpret_cast<const dat_section*>(file + sizeof(dat_header));
+            for (uint32_t i = 0; i < m_header->sections; i++)
+            {
+                const dat_section& section = sections[i];
+                if (section.offset % 4 != 0 || section.offset > len || section.size > len - section.offset)
+                    return false;
+
+                const uint8_t* data = file + section.offset;
+                if (section.type == static_cast<uint32_t>(Section::TEXTURES))
+                {
+                    if (section.count != m_header->textures || section.size != (uint64_t)section.count * sizeof(dat_texture))
+                        return false;
+                    m_textures = reinterpret_cast<const dat_texture*>(data);
+                }
+                else if (section.type == static_cast<uint32_t>(Section::STRINGS))
+                {
+                    m_strings = reinterpret_cast<const char*>(data);
+                    m_strings_size = section.size;
+                }
+                else if (section.type == static_cast<uint32_t>(Section::HASH))
+                {
+                    if (section.size < sizeof(dat_hash))
+                        return false;
+                    m_hash = reinterpret_cast<const dat_hash*>(data);
+                    if (m_hash->buckets == 0 || (section.size - sizeof(dat_hash)) / 4 < (uint64_t)m_hash->buckets + m_hash->slots)
+                        return false;
+                    m_pilots = reinterpret_cast<const uint32_t*>(m_hash + 1);
+                    m_slots = m_pilots + m_hash->buckets;
+                }
+                else if (section.type == static_cast<uint32_t>(Section::QUADS))
+                {
+                    if (section.count != m_header->textures || section.size != (uint64_t)section.count * sizeof(dat_quad))
+                        return false;
+                    m_quads = reinterpret_cast<const dat_quad*>(data);
+                }
+                else if (section.type == static_cast<uint32_t>(Section::QUADS16))
+                {
+                    if (section.count != m_header->textures || section.size != (uint64_t)section.count * sizeof(dat_quad16))
+                        return false;
+                    m_quads16 = reinterpret_cast<const dat_quad16*>(data);
+                }
+            }
+            return m_textures != nullptr && m_strings != nullptr;
+        }
+
+        bool read_texture()
+        {
+            const uint8_t* file = m_raw.data();
+            std::size_t len = m_raw.size();
+            if (len < sizeof(raw_header))
+                return false;
+            m_raw_header = reinterpret_cast<const raw_header*>(file);
+            if (m_raw_header->magic != RAW_MAGIC || m_raw_header->version != RAW_VERSION)
+                return false;
+            if (m_raw_header->levels < 1 || m_raw_header->levels > RAW_MAX_LEVELS || m_raw_header->pages < 1)
+                return false;
+
+            for (uint32_t l = 0; l < m_raw_header->levels; l++)
+            {
+                const raw_level& level = m_raw_header->level[l];
+                uint64_t last = level.offset + (uint64_t)(m_raw_header->pages - 1) * level.stride;
+                if (level.size > level.stride || last > len || level.size > len - last)
+                    return false;
+            }
+            return true;
+        }
+    };
+}
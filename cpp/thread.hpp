@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // helpers for splitting work
+    // across worker threads
+    //
+
+    /**
+     * @brief           Gets the number of worker threads to use
+     *
+     * @param requested Requested thread count (0 for one per core)
+     * @return int
+     */
+    inline int thread_count(int requested)
+    {
+        if (requested > 0)
+            return requested;
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    /**
+     * @brief           Runs a job for every index in [0, n) across worker threads,
+     *                  jobs are handed out one index at a time as workers free up
+     *
+     * @param n         Number of jobs
+     * @param threads   Number of worker threads (the caller's thread included)
+     * @param job       Called as job(index, worker) with worker in [0, threads)
+     */
+    template <typename F>
+    void parallel_for(int n, int threads, F&& job)
+    {
+        threads = std::min(threads, n);
+        if (threads <= 1)
+        {
+            for (int i = 0; i < n; i++)
+                job(i, 0);
+            return;
+        }
+
+        std::atomic<int> next(0);
+        auto work = [&](int worker)
+        {
+            for (int i = next++; i < n; i = next++)
+                job(i, worker);
+        };
+
+        std::vector<std::thread> workers;
+        for (int worker = 1; worker < threads; worker++)
+            workers.emplace_back(work, worker);
+        work(0);
+        for (auto& worker : workers)
+            worker.join();
+    }
+}
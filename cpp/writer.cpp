@@ -0,0 +1,264 @@
+
+#include "writer.hpp"
+
+#include <cstring>
+
+using namespace blocs__atlas;
+
+////////////////////////////////////
+//
+// mip level filtering
+//
+
+namespace
+{
+    /**
+     * @brief           Averages a box of pixels, colors weighted by their alpha
+     *                  so transparent pixels do not darken the edges of sprites
+     *
+     * @param rows      Rows of the box
+     * @param count     Number of rows
+     * @param x         First column of the box
+     * @param span      Number of columns
+     * @param out       Filtered pixel
+     */
+    void reduce_box(const uint8_t* const* rows, int count, int x, int span, uint8_t* out)
+    {
+        int n = count * span;
+        int alpha = 0;
+        int sum[3] = {};
+        int weighted[3] = {};
+        for (int r = 0; r < count; r++)
+        {
+            for (const uint8_t* p = rows[r] + x * CHANNELS; p < rows[r] + (x + span) * CHANNELS; p += CHANNELS)
+            {
+                alpha += p[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    sum[c] += p[c];
+                    weighted[c] += p[c] * p[3];
+                }
+            }
+        }
+
+        for (int c = 0; c < 3; c++)
+            out[c] = alpha > 0 ? (weighted[c] + alpha / 2) / alpha : (sum[c] + n / 2) / n;
+        out[3] = (alpha + n / 2) / n;
+    }
+
+    /**
+     * @brief           Averages each 2x2 pixels of two rows into a row of
+     *                  half the width, as reduce_box does, an odd width or a
+     *                  third row widening the last box to 3 so no pixel of
+     *                  the level above is left out
+     *
+     * @param rows      Rows to filter, 2 or for the last of an odd height 3
+     * @param count     Number of rows
+     * @param w         Width of the rows
+     * @param out       Filtered row
+     */
+    void reduce_row(const uint8_t* const* rows, int count, int w, uint8_t* out)
+    {
+        int out_w = level_size(w, 1);
+        int pairs = count == 2 && w > 1 ? w / 2 - w % 2 : 0;
+
+        // whole 2x2 boxes, the bulk of every row
+        const uint8_t* a = rows[0];
+        const uint8_t* b = rows[1];
+        for (int x = 0; x < pairs; x++)
+        {
+            const uint8_t* p[4] = { a + 2 * x * CHANNELS, a + (2 * x + 1) * CHANNELS, b + 2 * x * CHANNELS, b + (2 * x + 1) * CHANNELS };
+
+            int alpha = p[0][3] + p[1][3] + p[2][3] + p[3][3];
+            for (int c = 0; c < 3; c++)
+            {
+                if (alpha > 0)
+                    out[c] = (p[0][c] * p[0][3] + p[1][c] * p[1][3] + p[2][c] * p[2][3] + p[3][c] * p[3][3] + alpha / 2) / alpha;
+                else
+                    out[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) >> 2;
+            }
+            out[3] = (alpha + 2) >> 2;
+            out += CHANNELS;
+        }
+
+        for (int x = pairs; x < out_w; x++, out += CHANNELS)
+        {
+            int span = w == 1 ? 1 : x == out_w - 1 && w % 2 ? 3 : 2;
+            reduce_box(rows, count, 2 * x, span, out);
+        }
+    }
+}
+
+////////////////////////////////////
+//
+// block writer
+//
+
+block_writer::block_writer(int w, int h, int block_h, int levels, int layers)
+    : m_w(w), m_h(h), m_rows(0), m_block_h(block_h), m_levels(levels), m_layers(layers),
+      m_pending_rows(0), m_mip_rows(0)
+{
+    m_good = w > 0 && h > 0 && levels >= 1 && levels <= level_count(w, h) && layers >= 1;
+}
+
+/**
+ * @brief           Encodes and writes the next rows of the image,
+ *                  holding back any rows short of a full row of blocks
+ *
+ * @param pixels    RGBA pixels of the rows
+ * @param rows      Number of rows
+ * @return true     If the rows fit in the image
+ */
+bool block_writer::write_rows(const uint8_t* pixels, int rows)
+{
+    if (!m_good || m_rows + rows > m_h * m_layers)
+        return m_good = false;
+
+    std::size_t stride = (std::size_t)m_w * CHANNELS;
+    while (rows > 0)
+    {
+        // writes never straddle two layers
+        int n = std::min(rows, m_h - m_rows % m_h);
+        write_layer(pixels, n);
+        pixels += n * stride;
+        rows -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief           Encodes the image once all rows are written
+ *                  and closes the file
+ *
+ * @return true     If every row was written and the file closed whole
+ */
+bool block_writer::finish()
+{
+    if (m_rows != m_h * m_layers)
+        m_good = false;
+    return close() && m_good;
+}
+
+void block_writer::write_layer(const uint8_t* pixels, int rows)
+{
+    int layer = m_rows / m_h;
+    if (m_levels > 1)
+        reduce(pixels, rows);
+    m_rows += rows;
+
+    std::size_t stride = (std::size_t)m_w * CHANNELS;
+    while (rows > 0)
+    {
+        if (m_pending_rows == 0 && rows >= m_block_h)
+        {
+            int n = rows - rows % m_block_h;
+            encode(0, layer, pixels, m_w, n);
+            pixels += n * stride;
+            rows -= n;
+            continue;
+        }
+
+        int n = std::min(m_block_h - m_pending_rows, rows);
+        m_pending.resize(stride * m_block_h);
+        memcpy(m_pending.data() + m_pending_rows * stride, pixels, n * stride);
+        m_pending_rows += n;
+        pixels += n * stride;
+        rows -= n;
+
+        if (m_pending_rows == m_block_h)
+        {
+            encode(0, layer, m_pending.data(), m_w, m_block_h);
+            m_pending_rows = 0;
+        }
+    }
+
+    if (m_rows % m_h == 0)
+        finish_layer(layer);
+}
+
+/**
+ * @brief           Filters pairs of rows of the first level
+ *                  into rows of the second
+ *
+ * @param pixels    RGBA pixels of the rows
+ * @param rows      Number of rows
+ */
+void block_writer::reduce(const uint8_t* pixels, int rows)
+{
+    std::size_t stride = (std::size_t)m_w * CHANNELS;
+    std::size_t mip_stride = (std::size_t)level_size(m_w, 1) * CHANNELS;
+    m_mip.resize(mip_stride * level_size(m_h, 1));
+    m_carry.resize(stride * 2);
+
+    bool odd = m_h % 2 && m_h > 1;
+    uint8_t* first = m_carry.data();
+    uint8_t* second = m_carry.data() + stride;
+    for (int y = m_rows % m_h; y < m_rows % m_h + rows; y++, pixels += stride)
+    {
+        if (odd && y == m_h - 1)
+        {
+            // the last row of an odd height joins the last pair,
+            // both still waiting in the carry, filtering it again
+            const uint8_t* three[3] = { first, second, pixels };
+            reduce_row(three, 3, m_w, m_mip.data() + (m_mip_rows - 1) * mip_stride);
+        }
+        else if (y % 2 == 0)
+            memcpy(first, pixels, stride);
+        else
+        {
+            const uint8_t* two[2] = { first, pixels };
+            reduce_row(two, 2, m_w, m_mip.data() + m_mip_rows++ * mip_stride);
+            if (odd)
+                memcpy(second, pixels, stride);
+        }
+    }
+}
+
+/**
+ * @brief           Encodes the last partial row of blocks of a layer,
+ *                  then each smaller level filtered from the one before
+ *
+ * @param layer     Layer of the image
+ */
+void block_writer::finish_layer(int layer)
+{
+    if (m_pending_rows > 0)
+        encode(0, layer, m_pending.data(), m_w, m_pending_rows);
+    m_pending_rows = 0;
+
+    if (m_levels == 1)
+        return;
+
+    // a single row has no pair, so is filtered with itself
+    if (m_mip_rows == 0)
+    {
+        const uint8_t* one[2] = { m_carry.data(), m_carry.data() };
+        reduce_row(one, 2, m_w, m_mip.data());
+    }
+    m_mip_rows = 0;
+
+    std::vector<uint8_t> level, next;
+    const uint8_t* pixels = m_mip.data();
+    for (int l = 1; l < m_levels; l++)
+    {
+        int w = level_size(m_w, l);
+        int h = level_size(m_h, l);
+        if (l > 1)
+        {
+            int prev_w = level_size(m_w, l - 1);
+            int prev_h = level_size(m_h, l - 1);
+            std::size_t prev_stride = (std::size_t)prev_w * CHANNELS;
+            next.resize((std::size_t)w * h * CHANNELS);
+            for (int y = 0; y < h; y++)
+            {
+                const uint8_t* rows[3] = { pixels + 2 * y * prev_stride, pixels + std::min(2 * y + 1, prev_h - 1) * prev_stride,
+                    pixels + std::min(2 * y + 2, prev_h - 1) * prev_stride };
+                int count = y == h - 1 && prev_h % 2 && prev_h > 1 ? 3 : 2;
+                reduce_row(rows, count, prev_w, next.data() + (std::size_t)y * w * CHANNELS);
+            }
+            level.swap(next);
+            pixels = level.data();
+        }
+        encode(l, layer, pixels, w, h);
+    }
+}
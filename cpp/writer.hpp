@@ -0,0 +1,160 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#define CHANNELS 4
+
+namespace blocs__atlas
+{
+    ////////////////////////////////////
+    //
+    // output formats fed rows of rgba
+    // pixels from top to bottom
+    //
+
+    enum class Format
+    {
+        PNG,
+        QOI,
+        RGBA8,
+        BC1,
+        BC3,
+        BC7,
+        ETC2,
+        ASTC,
+    };
+
+    // file holding block compressed formats
+    enum class Container
+    {
+        DDS,
+        KTX2,
+        RAW,
+    };
+
+    class row_writer
+    {
+    public:
+        virtual ~row_writer() = default;
+
+        /**
+         * @brief           Encodes and writes the next rows of the image
+         *
+         * @param pixels    RGBA pixels of the rows
+         * @param rows      Number of rows
+         * @return true     If the rows fit in the image and were written
+         */
+        virtual bool write_rows(const uint8_t* pixels, int rows) = 0;
+
+        /**
+         * @brief           Flushes anything buffered and closes the file
+         *
+         * @return true     If every row was written and the file is complete
+         */
+        virtual bool finish() = 0;
+
+        /**
+         * @brief           Checks the file opened and nothing failed since
+         *
+         * @return true     If the writer can still be written to
+         */
+        bool good() const { return m_good; }
+
+    protected:
+        bool        m_good = true;
+    };
+
+    ////////////////////////////////////
+    //
+    // base of writers that encode whole
+    // rows of blocks at a time
+    //
+
+    /**
+     * @brief           Gets the number of levels of a full mip chain,
+     *                  down to a single pixel
+     *
+     * @param w         Width of the first level
+     * @param h         Height of the first level
+     * @return int
+     */
+    inline int level_count(int w, int h)
+    {
+        int levels = 1;
+        while ((w | h) >> levels)
+            levels++;
+        return levels;
+    }
+
+    /**
+     * @brief           Gets the width or height of a mip level
+     *
+     * @param size      Width or height of the first level
+     * @param level     Mip level
+     * @return int
+     */
+    inline int level_size(int size, int level)
+    {
+        return std::max(size >> level, 1);
+    }
+
+    // images hold one or more layers of the same size, written one after
+    // another, each followed by its mip levels once its last row is in
+    class block_writer : public row_writer
+    {
+    public:
+        bool write_rows(const uint8_t* pixels, int rows) override;
+        bool finish() override;
+
+    protected:
+        int         m_w;
+        int         m_h;
+        int         m_rows;
+        int         m_block_h;
+        int         m_levels;
+        int         m_layers;
+
+        block_writer(int w, int h, int block_h, int levels = 1, int layers = 1);
+
+        /**
+         * @brief           Encodes rows of a level of a layer, for the first
+         *                  level rows spanning whole rows of blocks, fewer only
+         *                  for the last rows of the layer, for the smaller
+         *                  levels the whole level at once
+         *
+         * @param level     Mip level
+         * @param layer     Layer of the image
+         * @param pixels    RGBA pixels of the rows
+         * @param w         Width of the level
+         * @param rows      Number of rows
+         */
+        virtual void encode(int level, int layer, const uint8_t* pixels, int w, int rows) = 0;
+
+        /**
+         * @brief           Finishes the file once all rows are encoded
+         *
+         * @return true     If the file was written out whole
+         */
+        virtual bool close() = 0;
+
+    private:
+        // rows short of a full row of blocks
+        // wait here for the next write
+        std::vector<uint8_t> m_pending;
+        int         m_pending_rows;
+
+        // second level of the layer, filtered as rows arrive, the
+        // first row of each pair waits in the carry, and for an odd
+        // height the second too, for the last row to join them
+        std::vector<uint8_t> m_mip;
+        std::vector<uint8_t> m_carry;
+        int         m_mip_rows;
+
+        void write_layer(const uint8_t* pixels, int rows);
+        void reduce(const uint8_t* pixels, int rows);
+        void finish_layer(int layer);
+    };
+}